@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "common.h"
+#include "libvcprompt.h"
+
+/* never start more threads than this, whatever --jobs says */
+#define MAX_JOBS 256
+
+/* the output for a dir that could not be examined at all */
+static char failed[] = "";
+
+typedef struct {
+    vcprompt_session_t *session;
+    char **dirs;
+    char **outputs;             /* NULL until that dir is done */
+    int ndirs;
+    int next;                   /* next dir for a worker to take */
+    pthread_mutex_t lock;
+    pthread_cond_t done;        /* signalled whenever a dir is done */
+} batch_t;
+
+/* Read all of stdin and split it into dirs.  Return the number of
+ * dirs, or -1 on error.
+ */
+static int
+read_dirs(char **input, char ***dirs)
+{
+    size_t len = 0, size = 65536;
+    char *buf = malloc(size);
+    int n = 0, max = 0;
+    ssize_t nread;
+    char sep;
+
+    *dirs = NULL;
+    while (buf != NULL) {
+        if (len == size) {
+            char *bigger = realloc(buf, size * 2);
+            if (bigger == NULL)
+                break;
+            buf = bigger;
+            size *= 2;
+        }
+        nread = read(STDIN_FILENO, buf + len, size - len);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread < 0) {
+            perror("vcprompt: error reading stdin");
+            break;
+        }
+        if (nread == 0) {
+            sep = (memchr(buf, '\0', len) != NULL) ? '\0' : '\n';
+            for (size_t start = 0; start < len; ) {
+                char *end = memchr(buf + start, sep, len - start);
+                size_t stop = (end != NULL) ? (size_t) (end - buf) : len;
+                if (n == max) {
+                    char **more = realloc(*dirs, (max + 1024) * sizeof(char *));
+                    if (more == NULL)
+                        goto err;
+                    *dirs = more;
+                    max += 1024;
+                }
+                (*dirs)[n++] = buf + start;
+                buf[stop] = '\0';       /* len < size, so buf[len] is ours */
+                start = stop + 1;
+            }
+            *input = buf;
+            return n;
+        }
+        len += nread;
+    }
+ err:
+    free(*dirs);
+    free(buf);
+    return -1;
+}
+
+static void *
+worker(void *arg)
+{
+    batch_t *b = arg;
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&b->lock);
+        i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+        if (i >= b->ndirs)
+            break;
+
+        /* -t applies to each dir */
+        char *output = vcprompt_query(b->session, b->dirs[i]);
+        if (output == NULL)
+            output = failed;
+
+        pthread_mutex_lock(&b->lock);
+        b->outputs[i] = output;
+        pthread_cond_broadcast(&b->done);
+        pthread_mutex_unlock(&b->lock);
+    }
+    return NULL;
+}
+
+int
+batch_main(options_t *options)
+{
+    batch_t b;
+    pthread_t threads[MAX_JOBS];
+    char *input = NULL;
+    int nthreads, i;
+    int status = 0;
+
+    /* -s is left out: a background refresh means fork(), which does
+       not mix with threads */
+    vcprompt_options_t session_options = {
+        .format    = options->format,
+        .timeout   = options->timeout,
+        .cache_ttl = options->cache_ttl,
+        .debug     = options->debug,
+        .unknown_budget  = options->unknown_budget,
+        .modified_budget = options->modified_budget,
+        .placeholder     = options->placeholder,
+    };
+
+    memset(&b, 0, sizeof(b));
+    b.session = vcprompt_session_new(NULL, &session_options, NULL);
+    if (b.session == NULL) {
+        perror("vcprompt");
+        return 1;
+    }
+    if ((b.ndirs = read_dirs(&input, &b.dirs)) < 0) {
+        vcprompt_session_free(b.session);
+        return 1;
+    }
+    b.outputs = calloc(b.ndirs + 1, sizeof(char *));
+    if (b.outputs == NULL) {
+        free(b.dirs);
+        free(input);
+        vcprompt_session_free(b.session);
+        return 1;
+    }
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.done, NULL);
+
+    nthreads = options->jobs;
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > MAX_JOBS)
+        nthreads = MAX_JOBS;
+    if (nthreads > b.ndirs)
+        nthreads = b.ndirs;
+    if (nthreads < 1 && b.ndirs > 0)
+        nthreads = 1;
+    debug("batch: %d dirs, %d threads", b.ndirs, nthreads);
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, worker, &b) != 0) {
+            debug("pthread_create() failed");
+            break;
+        }
+    }
+    if (i == 0 && b.ndirs > 0) {
+        /* no threads at all: do the work ourselves */
+        worker(&b);
+    }
+    nthreads = i;
+
+    /* print each answer as soon as it and all before it are done */
+    for (i = 0; i < b.ndirs; i++) {
+        pthread_mutex_lock(&b.lock);
+        while (b.outputs[i] == NULL)
+            pthread_cond_wait(&b.done, &b.lock);
+        pthread_mutex_unlock(&b.lock);
+        fputs(b.outputs[i], stdout);
+        putc('\n', stdout);
+        fflush(stdout);
+        if (b.outputs[i] != failed)
+            vcprompt_free(b.session, b.outputs[i]);
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&b.done);
+    pthread_mutex_destroy(&b.lock);
+    if (ferror(stdout))
+        status = 1;
+    free(b.outputs);
+    free(b.dirs);
+    free(input);
+    vcprompt_session_free(b.session);
+    return status;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+
+/* Run vcprompt --batch: read dirs from stdin (NUL-separated if there
+ * is a NUL anywhere in the input, else newline-separated), work on
+ * options->jobs of them at a time (default: one per CPU) on a pool of
+ * threads, and print one line per dir, in input order, with what
+ * vcprompt would print there (an empty line if it is not under
+ * version control).  Return the exit status for main().
+ */
+int
+batch_main(options_t *options);
+
+#endif
@@ -0,0 +1,553 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * The result cache: a hash table of fixed-size slots in a file that
+ * every vcprompt process maps shared.  Each slot is guarded by a
+ * sequence counter, seqlock-style: a writer makes it odd while it
+ * changes the slot and even again when done, and a reader trusts what
+ * it copied only if the counter was even and unchanged throughout.
+ * Readers never wait, and a writer that finds the slot busy simply
+ * does not store its result, so no shell ever blocks another.  An
+ * entry goes in the first of PROBE_SLOTS slots from its hash that
+ * holds the same name, else an empty one, else the oldest one.
+ *
+ * Separately, a vcprompt about to compute a result holds an fcntl()
+ * write lock on one byte past the end of the file, picked by the hash
+ * of its key (working copy and fields), so that others that want the
+ * same result can wait for it (single flight) rather than run the
+ * same "git diff" alongside it, while other working copies go ahead.
+ * Writers also hold a lock on their slot's bytes while they write.
+ * The kernel drops the locks if their holder dies, so a crashed
+ * vcprompt never leaves anything locked; and a writer that gets the
+ * lock of a slot whose counter is odd knows that the last one died
+ * in the middle, and takes the slot over.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define NUM_SLOTS 128
+
+/* how many slots from its hash an entry may be in */
+#define PROBE_SLOTS 8
+
+/* single-flight locks are on bytes CACHE_SIZE + (hash % LOCK_RANGE) */
+#define LOCK_RANGE 0x40000000
+
+/* how long to wait for another vcprompt's result, if there is no -t
+ * timeout, and how often to check on it */
+#define SINGLE_FLIGHT_WAIT_MS 5000
+#define SINGLE_FLIGHT_STEP_MS 10
+
+/* longest strings we cache: longer results are just not cached */
+#define BRANCH_MAX 256
+#define REVISION_MAX 128
+#define PATCH_MAX 256
+#define OPERATION_MAX 64
+
+/* bits of cache_key_t.fields */
+#define FIELD_BRANCH    0x01
+#define FIELD_REVISION  0x02
+#define FIELD_PATCH     0x04
+#define FIELD_UNKNOWN   0x08
+#define FIELD_MODIFIED  0x10
+#define FIELD_UPSTREAM  0x20
+#define FIELD_OPERATION 0x40
+#define FIELD_STASH     0x80
+#define FIELD_STAGED    0x100
+
+/* bits of slot_t.present: which result_t strings were not NULL */
+#define HAVE_BRANCH     0x01
+#define HAVE_REVISION   0x02
+#define HAVE_PATCH      0x04
+#define HAVE_OPERATION  0x08
+
+typedef struct {
+    unsigned int seq;                   /* odd while being written */
+    unsigned int fields;
+    unsigned long long signature;
+    long long stored;                   /* when written (ns since epoch) */
+    int present;
+    int unknown;
+    int modified;
+    int staged;
+    int ahead;
+    int behind;
+    int stashes;
+    char name[PATH_MAX];
+    char branch[BRANCH_MAX];
+    char revision[REVISION_MAX];
+    char patch[PATCH_MAX];
+    char operation[OPERATION_MAX];
+} slot_t;
+
+#define CACHE_SIZE (NUM_SLOTS * sizeof(slot_t))
+
+static slot_t *slots = NULL;
+static int cache_fd = -1;               /* kept open for the locks */
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/* fcntl() locks belong to the process, so they do not keep the
+ * threads of vcprompt --batch from writing at the same time: this
+ * does */
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Map the cache file, creating it if need be.  On failure, explain
+ * why with debug() and leave slots NULL.
+ */
+static void
+map_cache(void)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    int fd;
+    void *map;
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] != '/') {
+        debug("XDG_RUNTIME_DIR not set: no result cache");
+        return;
+    }
+    if (snprintf(path, sizeof(path), "%s/%s", dir, CACHE_FILE)
+        >= (int) sizeof(path))
+        return;
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+        debug("%s: %s", path, strerror(errno));
+        return;
+    }
+    /* a new file is all zeros, i.e. empty slots; growing it again
+       after another process did so is harmless */
+    if (fstat(fd, &st) < 0 ||
+        (st.st_size != (off_t) CACHE_SIZE &&
+         ftruncate(fd, CACHE_SIZE) < 0)) {
+        debug("%s: %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        debug("unable to mmap() %s: %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    slots = map;
+    cache_fd = fd;
+}
+
+/* Return true if the cache file is mapped (mapping it the first time:
+ * threads of vcprompt --batch share the mapping).
+ */
+static int
+open_cache(void)
+{
+    pthread_once(&cache_once, map_cache);
+    return slots != NULL;
+}
+
+static long long
+now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* FNV-1a, 64 bit */
+static unsigned long long
+hash_bytes(unsigned long long hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#define HASH_INIT 0xcbf29ce484222325ULL
+
+/* Add the stat() info of a stamp file (all zeros if it is missing) to
+ * the signature of key.
+ */
+static void
+stamp_file(int dirfd, const char *filename, void *arg)
+{
+    cache_key_t *key = arg;
+    long long sig[6] = {0, 0, 0, 0, 0, 0};
+    struct stat st;
+
+    if (fstatat(dirfd, filename, &st, 0) == 0) {
+        sig[0] = st.st_ino;
+        sig[1] = st.st_size;
+        sig[2] = st.st_mtim.tv_sec;
+        sig[3] = st.st_mtim.tv_nsec;
+        sig[4] = st.st_ctim.tv_sec;
+        sig[5] = st.st_ctim.tv_nsec;
+    }
+    key->signature = hash_bytes(key->signature, sig, sizeof(sig));
+}
+
+int
+cache_make_key(cache_key_t *key, vccontext_t *context)
+{
+    options_t *options = context->options;
+
+    if (snprintf(key->name, sizeof(key->name), "%s:%s",
+                 context->name, context->top) >= (int) sizeof(key->name))
+        return 0;
+
+    key->fields = ((options->show_branch ? FIELD_BRANCH : 0) |
+                   (options->show_revision ? FIELD_REVISION : 0) |
+                   (options->show_patch ? FIELD_PATCH : 0) |
+                   (options->show_unknown ? FIELD_UNKNOWN : 0) |
+                   (options->show_modified ? FIELD_MODIFIED : 0) |
+                   (options->show_upstream ? FIELD_UPSTREAM : 0) |
+                   (options->show_operation ? FIELD_OPERATION : 0) |
+                   (options->show_stash ? FIELD_STASH : 0) |
+                   (options->show_staged ? FIELD_STAGED : 0));
+
+    key->signature = HASH_INIT;
+    for (const char *const *s = context->stamps; s && *s; s++)
+        stamp_file(context->dirfd, *s, key);
+    if (context->get_stamps != NULL &&
+        !context->get_stamps(context, stamp_file, key)) {
+        debug("cache: unable to find the stamps of %s", key->name);
+        return 0;
+    }
+    return 1;
+}
+
+/* The first slot where the entry for key may be: look in it and the
+ * next PROBE_SLOTS - 1 ones (wrapping around).
+ */
+static unsigned int
+first_slot(const cache_key_t *key)
+{
+    return hash_bytes(HASH_INIT, key->name, strlen(key->name)) % NUM_SLOTS;
+}
+
+/* Pick the slot to store the entry for key in: the one it is in
+ * already, else an empty one, else the one stored longest ago.  The
+ * slots may change under us, so this is only a good guess.
+ */
+static slot_t *
+find_store_slot(const cache_key_t *key)
+{
+    unsigned int first = first_slot(key);
+    slot_t *empty = NULL, *oldest = NULL;
+
+    for (unsigned int i = 0; i < PROBE_SLOTS; i++) {
+        slot_t *slot = &slots[(first + i) % NUM_SLOTS];
+        if (strncmp(slot->name, key->name, sizeof(slot->name)) == 0)
+            return slot;
+        if (slot->name[0] == '\0') {
+            if (empty == NULL)
+                empty = slot;
+        }
+        else if (oldest == NULL || slot->stored < oldest->stored)
+            oldest = slot;
+    }
+    return (empty != NULL) ? empty : oldest;
+}
+
+/* Copy a string out of a slot that may be changing under us: it is
+ * only guaranteed to be terminated if the slot turns out to be
+ * consistent, so terminate it ourselves.
+ */
+static void
+copy_field(char *dest, const char *src, size_t size)
+{
+    memcpy(dest, src, size);
+    dest[size - 1] = '\0';
+}
+
+/* Copy slot to copy.  Return 0 if it changed too often while we read
+ * it.
+ */
+static int
+copy_slot(slot_t *slot, slot_t *copy)
+{
+    unsigned int seq;
+    int tries;
+
+    for (tries = 0; tries < 3; tries++) {
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        copy->fields = slot->fields;
+        copy->signature = slot->signature;
+        copy->stored = slot->stored;
+        copy->present = slot->present;
+        copy->unknown = slot->unknown;
+        copy->modified = slot->modified;
+        copy->staged = slot->staged;
+        copy->ahead = slot->ahead;
+        copy->behind = slot->behind;
+        copy->stashes = slot->stashes;
+        copy_field(copy->name, slot->name, sizeof(copy->name));
+        copy_field(copy->branch, slot->branch, sizeof(copy->branch));
+        copy_field(copy->revision, slot->revision, sizeof(copy->revision));
+        copy_field(copy->patch, slot->patch, sizeof(copy->patch));
+        copy_field(copy->operation, slot->operation,
+                   sizeof(copy->operation));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+    return tries < 3;
+}
+
+/* Copy the entry for key out of its slot to copy, and check that it
+ * has at least the fields key asks for.  Return 0 if there is no such
+ * entry, or its slot changed too often while we read it.
+ */
+static int
+read_slot(const cache_key_t *key, slot_t *copy)
+{
+    unsigned int first = first_slot(key);
+    unsigned int i;
+
+    for (i = 0; i < PROBE_SLOTS; i++) {
+        if (!copy_slot(&slots[(first + i) % NUM_SLOTS], copy)) {
+            debug("cache: slot busy");
+            return 0;
+        }
+        /* entries are never removed, so an empty slot ends the search */
+        if (copy->name[0] == '\0' || strcmp(copy->name, key->name) == 0)
+            break;
+    }
+    if (i == PROBE_SLOTS || copy->name[0] == '\0') {
+        debug("cache: no entry for %s", key->name);
+        return 0;
+    }
+    if ((copy->fields & key->fields) != key->fields) {
+        debug("cache: entry for %s lacks fields", key->name);
+        return 0;
+    }
+    return 1;
+}
+
+/* Turn a copied slot into a new result_t (NULL if out of memory). */
+static result_t*
+slot_result(const slot_t *copy, int stale)
+{
+    result_t *result = init_result();
+    if (result == NULL)
+        return NULL;
+    if (((copy->present & HAVE_BRANCH) &&
+         !(result->branch = strdup(copy->branch))) ||
+        ((copy->present & HAVE_REVISION) &&
+         !(result->revision = strdup(copy->revision))) ||
+        ((copy->present & HAVE_PATCH) &&
+         !(result->patch = strdup(copy->patch))) ||
+        ((copy->present & HAVE_OPERATION) &&
+         !(result->operation = strdup(copy->operation)))) {
+        free_result(result);
+        return NULL;
+    }
+    result->unknown = copy->unknown;
+    result->modified = copy->modified;
+    result->staged = copy->staged;
+    result->ahead = copy->ahead;
+    result->behind = copy->behind;
+    result->stashes = copy->stashes;
+    result->stale = stale;
+    return result;
+}
+
+result_t*
+cache_lookup(const cache_key_t *key, unsigned int ttl, int stale_ok)
+{
+    slot_t copy;
+    int stale = 0;
+
+    if (!open_cache() || !read_slot(key, &copy))
+        return NULL;
+
+    long long age = (now_ns() - copy.stored) / 1000000000LL;
+    if (copy.signature != key->signature) {
+        debug("cache: entry for %s is stale", key->name);
+        stale = 1;
+    }
+    else if (copy.stored > now_ns() || age >= (long long) ttl) {
+        debug("cache: entry for %s is %lld s old", key->name, age);
+        stale = 1;
+    }
+    if (stale && !stale_ok)
+        return NULL;
+    if (!stale)
+        debug("cache: hit for %s", key->name);
+    return slot_result(&copy, stale);
+}
+
+/* Lock or unlock (type F_WRLCK or F_UNLCK) len bytes at start in the
+ * cache file, without waiting.  Return 1 on success.
+ */
+static int
+lock_range(off_t start, off_t len, short type)
+{
+    struct flock fl;
+
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = start;
+    fl.l_len = len;
+    return fcntl(cache_fd, F_SETLK, &fl) == 0;
+}
+
+/* The byte whose lock says that someone is computing the result for
+ * key: past the slots, so it never gets in the way of writers.
+ */
+static off_t
+key_lock_offset(const cache_key_t *key)
+{
+    unsigned long long hash = hash_bytes(HASH_INIT, key->name,
+                                         strlen(key->name));
+    hash = hash_bytes(hash, &key->fields, sizeof(key->fields));
+    return CACHE_SIZE + (off_t) (hash % LOCK_RANGE);
+}
+
+result_t*
+cache_get_info(vccontext_t *context, const cache_key_t *key, int wait)
+{
+    slot_t copy;
+    result_t *result;
+    long long start = now_ns();
+    int waited = 0, locked, remaining;
+    off_t lock;
+
+    if (!open_cache())
+        return context->get_info(context);
+    lock = key_lock_offset(key);
+
+    while (!(locked = lock_range(lock, 1, F_WRLCK))) {
+        if (errno != EACCES && errno != EAGAIN) {
+            debug("cache: unable to lock %s: %s", key->name, strerror(errno));
+            break;
+        }
+        if (!wait) {
+            debug("cache: another vcprompt is working on %s", key->name);
+            return NULL;
+        }
+        remaining = timeout_remaining();
+        if (remaining == 0 || waited >= SINGLE_FLIGHT_WAIT_MS)
+            break;
+        if (waited == 0)
+            debug("cache: waiting for another vcprompt working on %s",
+                  key->name);
+        if (remaining < 0 || remaining > SINGLE_FLIGHT_STEP_MS)
+            remaining = SINGLE_FLIGHT_STEP_MS;
+        poll(NULL, 0, remaining);
+        waited += remaining;
+    }
+
+    /* only a result computed while we waited will do: one that was
+       there before would have been found by cache_lookup() */
+    if (waited > 0 && read_slot(key, &copy) &&
+        copy.signature == key->signature && copy.stored >= start) {
+        debug("cache: using the result of the other vcprompt");
+        result = slot_result(&copy, 0);
+    }
+    else {
+        result = context->get_info(context);
+        /* a timeout or a budget may have cut get_info() short: don't
+           remember a partial result */
+        if (result != NULL && timeout_remaining() != 0 &&
+            result->unknown >= 0 && result->modified >= 0 &&
+            result->staged >= 0 &&
+            result->ahead >= 0 && result->behind >= 0 &&
+            result->stashes >= 0)
+            cache_store(key, result);
+    }
+    if (locked)
+        lock_range(lock, 1, F_UNLCK);
+    return result;
+}
+
+/* Copy src (which fits) to a slot field. */
+static void
+store_field(char *dest, const char *src)
+{
+    if (src == NULL)
+        dest[0] = '\0';
+    else
+        strcpy(dest, src);
+}
+
+void
+cache_store(const cache_key_t *key, const result_t *result)
+{
+    slot_t *slot;
+    off_t offset;
+    unsigned int seq;
+
+    if ((result->branch && strlen(result->branch) >= BRANCH_MAX) ||
+        (result->revision && strlen(result->revision) >= REVISION_MAX) ||
+        (result->patch && strlen(result->patch) >= PATCH_MAX) ||
+        (result->operation && strlen(result->operation) >= OPERATION_MAX)) {
+        debug("cache: result too long to store");
+        return;
+    }
+    if (!open_cache())
+        return;
+    pthread_mutex_lock(&store_mutex);
+    slot = find_store_slot(key);
+    offset = (char *) slot - (char *) slots;
+    if (!lock_range(offset, sizeof(slot_t), F_WRLCK)) {
+        debug("cache: slot busy, not storing");
+        pthread_mutex_unlock(&store_mutex);
+        return;
+    }
+
+    /* with the lock, nobody else can be writing: an odd counter was
+       left by a writer that died halfway, and the slot is ours */
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    if (seq & 1)
+        debug("cache: taking over a slot abandoned mid-write");
+    else
+        __atomic_store_n(&slot->seq, ++seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->fields = key->fields;
+    slot->signature = key->signature;
+    slot->stored = now_ns();
+    slot->present = ((result->branch ? HAVE_BRANCH : 0) |
+                     (result->revision ? HAVE_REVISION : 0) |
+                     (result->patch ? HAVE_PATCH : 0) |
+                     (result->operation ? HAVE_OPERATION : 0));
+    slot->unknown = result->unknown;
+    slot->modified = result->modified;
+    slot->staged = result->staged;
+    slot->ahead = result->ahead;
+    slot->behind = result->behind;
+    slot->stashes = result->stashes;
+    strcpy(slot->name, key->name);
+    store_field(slot->branch, result->branch);
+    store_field(slot->revision, result->revision);
+    store_field(slot->patch, result->patch);
+    store_field(slot->operation, result->operation);
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    lock_range(offset, sizeof(slot_t), F_UNLCK);
+    pthread_mutex_unlock(&store_mutex);
+    debug("cache: stored result for %s", key->name);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <limits.h>
+
+#include "common.h"
+
+/* The result cache (vcprompt -c) is a fixed-size file with this name
+ * in $XDG_RUNTIME_DIR, mapped shared by every vcprompt process of the
+ * user.  Bump the number whenever the layout changes.
+ */
+#define CACHE_FILE "vcprompt-cache.5"
+
+/* What a cached result is for, and what it depends on: the VC system
+ * and top dir of the working copy, the fields the format asks for,
+ * and the stat() signature of the context's stamp files (stamps and
+ * get_stamps() in vccontext_t).
+ */
+typedef struct {
+    char name[PATH_MAX];                /* "<vc>:<top dir>" */
+    unsigned int fields;
+    unsigned long long signature;
+} cache_key_t;
+
+/* Fill in key for context, as found by probe_dirs().  Do this before
+ * get_info(), so that a change made while it runs
+ * makes the stored result stale rather than wrong.  Return 0 if the
+ * result cannot be cached (e.g. the path is too long).
+ */
+int
+cache_make_key(cache_key_t *key, vccontext_t *context);
+
+/* Look key up in the cache.  On a hit (stored no more than ttl seconds
+ * ago, under the same signature, for at least the same fields) return
+ * a new result_t; otherwise return NULL.  If stale_ok is true, an
+ * entry that is only too old or has the wrong signature is returned
+ * too, with result->stale set.  Never blocks.
+ */
+result_t*
+cache_lookup(const cache_key_t *key, unsigned int ttl, int stale_ok);
+
+/* Run context->get_info() and store its result for key, unless another
+ * vcprompt is already doing that: then wait for it to finish (for up
+ * to 5 s, or until the -t timeout) and return its result instead, or
+ * return NULL at once if wait is false.  Returns what get_info() does
+ * if there is no cache to be had.
+ */
+result_t*
+cache_get_info(vccontext_t *context, const cache_key_t *key, int wait);
+
+/* Remember result for key, unless another process is writing the
+ * same slot right now.
+ */
+void
+cache_store(const cache_key_t *key, const result_t *result);
+
+#endif
@@ -7,16 +7,46 @@
  * (at your option) any later version.
  */
 
+/* for pipe2(), posix_spawn_file_actions_addchdir_np() */
+#define _GNU_SOURCE
+#include "../config.h"
+
 #include "capture.h"
 #include "common.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
-#include <sys/select.h>
+#include <time.h>
 #include <sys/types.h>
+#if HAVE_SPAWN_H && HAVE_POSIX_SPAWNP && \
+    HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+# include <spawn.h>
+# define USE_POSIX_SPAWN 1
+#endif
+
+extern char **environ;
+
+/* child's stderr is only for debug output: don't keep too much */
+#define MAX_STDERR 4096
+
+/* Environment variables we override in every child: we parse their
+ * output, so we want it untranslated and unadorned, and we must not
+ * take locks that would get in the way of the user's own commands
+ * (e.g. git status refreshing the index).
+ */
+static const char *child_env[] = {
+    "LC_ALL=C",
+    "GIT_OPTIONAL_LOCKS=0",
+    "HGPLAIN=1",
+    NULL,
+};
 
 static void
 init_dynbuf(dynbuf *dbuf, int bufsize)
@@ -24,20 +54,39 @@ init_dynbuf(dynbuf *dbuf, int bufsize)
     dbuf->size = bufsize;
     dbuf->len = 0;
     dbuf->buf = malloc(bufsize); /* caller handles NULL */
+    if (dbuf->buf != NULL)
+        dbuf->buf[0] = '\0';
     dbuf->eof = 0;
 }
 
+/* Read from fd into dbuf, keeping at most max bytes (0: no limit);
+ * anything past that is read and thrown away.
+ */
 static ssize_t
-read_dynbuf(int fd, dynbuf *dbuf)
+read_dynbuf(int fd, dynbuf *dbuf, size_t max)
 {
+    if (max > 0 && dbuf->len >= max) {
+        char discard[1024];
+        ssize_t nread = read(fd, discard, sizeof(discard));
+        if (nread == 0)
+            dbuf->eof = 1;
+        return nread;
+    }
+
     size_t avail = dbuf->size - dbuf->len;
     if (avail < 1024) {
+        char *buf = realloc(dbuf->buf, dbuf->size * 2);
+        if (buf == NULL)
+            return -1;
+        dbuf->buf = buf;
         dbuf->size *= 2;
-        dbuf->buf = realloc(dbuf->buf, dbuf->size);
         avail = dbuf->size - dbuf->len;
     }
     /* read avail-1 bytes to leave room for termininating \0 */
-    ssize_t nread = read(fd, dbuf->buf + dbuf->len, avail - 1);
+    size_t want = avail - 1;
+    if (max > 0 && want > max - dbuf->len)
+        want = max - dbuf->len;
+    ssize_t nread = read(fd, dbuf->buf + dbuf->len, want);
     if (nread < 0)
         return nread;
     else if (nread == 0) {
@@ -48,6 +97,7 @@ read_dynbuf(int fd, dynbuf *dbuf)
     }
     //debug("capture: read %d bytes from child via fd %d", nread, fd);
     dbuf->len += nread;
+    dbuf->buf[dbuf->len] = '\0';
     return nread;
 }
 
@@ -55,7 +105,7 @@ capture_t *
 new_capture()
 {
     int bufsize = 4096;
-    capture_t *result = malloc(sizeof(capture_t));
+    capture_t *result = calloc(1, sizeof(capture_t));
     if (result == NULL)
         goto err;
     init_dynbuf(&result->childout, bufsize);
@@ -112,79 +162,289 @@ print_cmd(char *const argv[])
     debug("spawning child process: %s", cmd);
 }
 
-capture_t *
-capture_child(const char *file, char *const argv[])
+/* Pass the next chunk of the child's stdout to opts->consume(). */
+static ssize_t
+read_consume(int fd, dynbuf *dbuf, const capture_opts_t *opts, int *stop)
+{
+    char chunk[4096];
+    ssize_t nread = read(fd, chunk, sizeof(chunk));
+    if (nread == 0)
+        dbuf->eof = 1;
+    else if (nread > 0 && opts->consume(chunk, nread, opts->arg))
+        *stop = 1;
+    return nread;
+}
+
+/* per-child state of capture_children() */
+typedef struct {
+    pid_t pid;
+    int outfd;                  /* read end of child's stdout pipe */
+    int errfd;                  /* read end of child's stderr pipe */
+    int stop;                   /* caller has seen enough */
+    long long deadline;         /* when to kill it (see monotonic_ms()),
+                                   or -1 for never */
+} child_t;
+
+/* Milliseconds since some fixed point in the past. */
+static long long
+monotonic_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/* The deadline of a child started now: the earlier of the job's own
+ * timeout and the -t timeout.
+ */
+static long long
+child_deadline(const capture_job_t *job, long long now)
+{
+    long long deadline = -1;
+    int remaining = timeout_remaining();
+
+    if (remaining >= 0)
+        deadline = now + remaining;
+    if (job->opts != NULL && job->opts->timeout > 0 &&
+        (deadline < 0 || now + job->opts->timeout < deadline))
+        deadline = now + job->opts->timeout;
+    return deadline;
+}
+
+/* Return a copy of our environment with child_env applied, or NULL
+ * on failure.  Only the array is allocated: free it with free().
+ */
+static char **
+make_child_env(void)
+{
+    size_t i, j, n = 0, nextra = 0;
+    char **envp;
+
+    while (environ[n] != NULL)
+        n++;
+    while (child_env[nextra] != NULL)
+        nextra++;
+    envp = malloc((n + nextra + 1) * sizeof(char *));
+    if (envp == NULL)
+        return NULL;
+
+    n = 0;
+    for (i = 0; environ[i] != NULL; i++) {
+        int overridden = 0;
+        for (j = 0; j < nextra && !overridden; j++) {
+            size_t namelen = strchr(child_env[j], '=') - child_env[j] + 1;
+            overridden = (strncmp(environ[i], child_env[j], namelen) == 0);
+        }
+        if (!overridden)
+            envp[n++] = environ[i];
+    }
+    for (j = 0; j < nextra; j++)
+        envp[n++] = (char *) child_env[j];
+    envp[n] = NULL;
+    return envp;
+}
+
+/* Create a pipe whose ends are not inherited by any child (the child
+ * gets its own copy of the write end via dup2()).
+ */
+static int
+cloexec_pipe(int fds[2])
+{
+#if HAVE_PIPE2
+    return pipe2(fds, O_CLOEXEC);
+#else
+    if (pipe(fds) < 0)
+        return -1;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return 0;
+#endif
+}
+
+/* Start the child with stdin from /dev/null and stdout/stderr going
+ * to the write ends of the pipes, in the dir that job asks for.
+ * Return its pid, or -1 with errno set.  posix_spawn() can use vfork()
+ * or clone(CLONE_VM), so we do not pay for copying our page tables
+ * just to exec().
+ */
+static pid_t
+start_child(const capture_job_t *job, int outfd, int errfd, char **envp)
+{
+    pid_t pid;
+    const char *dir = (job->opts != NULL) ? job->opts->dir : NULL;
+#if USE_POSIX_SPAWN
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    int err;
+
+    if ((err = posix_spawnattr_init(&attr)) != 0) {
+        errno = err;
+        return -1;
+    }
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0) {
+        posix_spawnattr_destroy(&attr);
+        errno = err;
+        return -1;
+    }
+    /* own process group, so we can kill it along with its children */
+    if ((err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP)) != 0 ||
+        (err = posix_spawnattr_setpgroup(&attr, 0)) != 0 ||
+        (err = posix_spawn_file_actions_addopen(
+             &actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(
+            &actions, outfd, STDOUT_FILENO)) != 0 ||
+        (err = posix_spawn_file_actions_adddup2(
+            &actions, errfd, STDERR_FILENO)) != 0 ||
+        (dir != NULL &&
+         (err = posix_spawn_file_actions_addchdir_np(&actions, dir)) != 0) ||
+        (err = posix_spawnp(&pid, job->file, &actions, &attr,
+                            job->argv, envp)) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        errno = err;
+        return -1;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+#else
+    pid = fork();
+    if (pid == 0) {             /* in the child */
+        setpgid(0, 0);
+        int nullfd = open("/dev/null", O_RDONLY);
+        if (nullfd < 0 || dup2(nullfd, STDIN_FILENO) < 0)
+            _exit(1);
+        if (dup2(outfd, STDOUT_FILENO) < 0)
+            _exit(1);
+        if (dup2(errfd, STDERR_FILENO) < 0)
+            _exit(1);
+        if (dir != NULL && chdir(dir) < 0)
+            _exit(127);
+
+        environ = envp;
+        execvp(job->file, job->argv);
+        debug("error executing %s: %s\n", job->file, strerror(errno));
+        _exit(127);
+    }
+#endif
+    return pid;
+}
+
+/* Create the pipes and start one child.  Return 1 on success, -1 if
+ * the program could not be executed, or 0 on any other failure.  On
+ * failure, no resources are left over.
+ */
+static int
+spawn_child(const capture_job_t *job, child_t *child, char **envp)
 {
     int stdout_pipe[] = {-1, -1};
     int stderr_pipe[] = {-1, -1};
-    capture_t *result = NULL;
-    if (pipe(stdout_pipe) < 0)
+    int ret = 0;
+    if (cloexec_pipe(stdout_pipe) < 0)
         goto err;
-    if (pipe(stderr_pipe) < 0)
+    if (cloexec_pipe(stderr_pipe) < 0)
         goto err;
 
     if (debug_mode())
-        print_cmd(argv);
-    pid_t pid = fork();
+        print_cmd(job->argv);
+    pid_t pid = start_child(job, stdout_pipe[1], stderr_pipe[1], envp);
     if (pid < 0) {
+        if (errno == EAGAIN || errno == ENOMEM)
+            goto err;
+        debug("error executing %s: %s", job->file, strerror(errno));
+        ret = -1;
         goto err;
     }
-    if (pid == 0) {             /* in the child */
-        close(stdout_pipe[0]);  /* don't need the read ends of the pipes */
-        close(stderr_pipe[0]);
-        if (dup2(stdout_pipe[1], STDOUT_FILENO) < 0)
-            _exit(1);
-        if (dup2(stderr_pipe[1], STDERR_FILENO) < 0)
-            _exit(1);
 
-        execvp(file, argv);
-        debug("error executing %s: %s\n", file, strerror(errno));
-        _exit(127);
-    }
-
-    /* parent: don't need write ends of the pipes */
+    /* don't need write ends of the pipes */
     close(stdout_pipe[1]);
     close(stderr_pipe[1]);
+    child->pid = pid;
+    child->outfd = stdout_pipe[0];
+    child->errfd = stderr_pipe[0];
+    child->stop = 0;
+    return 1;
 
-    result = new_capture();
-    if (result == NULL)
-        goto err;
+ err:
+    if (ret == 0)
+        debug("unable to run %s: %s", job->file, strerror(errno));
+    if (stdout_pipe[0] > -1)
+        close(stdout_pipe[0]);
+    if (stdout_pipe[1] > -1)
+        close(stdout_pipe[1]);
+    if (stderr_pipe[0] > -1)
+        close(stderr_pipe[0]);
+    if (stderr_pipe[1] > -1)
+        close(stderr_pipe[1]);
+    return ret;
+}
 
-    int cstdout = stdout_pipe[0];
-    int cstderr = stderr_pipe[0];
-
-    int done = 0;
-    while (!done) {
-        int maxfd = -1;
-        fd_set child_fds;
-        FD_ZERO(&child_fds);
-        if (!result->childout.eof) {
-            FD_SET(cstdout, &child_fds);
-            maxfd = cstdout;
-        }
-        if (!result->childerr.eof) {
-            FD_SET(cstderr, &child_fds);
-            maxfd = cstderr;
-        }
-        int numavail = select(maxfd+1, &child_fds, NULL, NULL, NULL);
-        if (numavail < 0)
-            goto err;
-        else if (numavail == 0) /* EOF on both pipes */
-            break;
+/* Read whatever is ready on one of child's pipes (fd).  Return 0 on
+ * read error.
+ */
+static int
+read_child(const capture_job_t *job, child_t *child, int fd)
+{
+    capture_t *result = job->result;
+    const capture_opts_t *opts = job->opts;
+    size_t limit = (opts != NULL) ? opts->limit : 0;
 
-        if (FD_ISSET(cstdout, &child_fds)) {
-            if (read_dynbuf(cstdout, &result->childout) < 0)
-                goto err;
-        }
-        if (FD_ISSET(cstderr, &child_fds)) {
-            if (read_dynbuf(cstderr, &result->childerr) < 0)
-                goto err;
-        }
-        done = result->childout.eof && result->childerr.eof;
+    if (fd == child->errfd)
+        return read_dynbuf(fd, &result->childerr, MAX_STDERR) >= 0;
+
+    ssize_t nread;
+    if (opts != NULL && opts->consume != NULL)
+        nread = read_consume(fd, &result->childout, opts, &child->stop);
+    else
+        nread = read_dynbuf(fd, &result->childout, limit);
+    if (limit > 0 && result->childout.len >= limit)
+        child->stop = 1;
+    return nread >= 0;
+}
+
+/* Stop listening to child: close its pipes and, if it still has
+ * something to say that we do not want to hear, kill it.  Closing the
+ * pipes makes the child's next write fail with SIGPIPE anyways, if it
+ * did not get the SIGTERM.
+ */
+static void
+finish_child(const capture_job_t *job, child_t *child)
+{
+    capture_t *result = job->result;
+    int done = result->childout.eof && result->childerr.eof;
+
+    close(child->outfd);
+    close(child->errfd);
+    child->outfd = child->errfd = -1;
+    result->stopped = child->stop && !done;
+    if (result->stopped) {
+        debug("seen enough output from %s: killing it", job->file);
+        kill(-child->pid, SIGTERM);
     }
+}
+
+/* The child is past its deadline: stop listening and kill its whole
+ * process group, without giving it a chance to linger.
+ */
+static void
+expire_child(const capture_job_t *job, child_t *child)
+{
+    debug("child process %s timed out: killing it", job->file);
+    close(child->outfd);
+    close(child->errfd);
+    child->outfd = child->errfd = -1;
+    job->result->timedout = 1;
+    kill(-child->pid, SIGKILL);
+}
 
+/* Wait for child to exit and record how it went. */
+static void
+reap_child(const capture_job_t *job, child_t *child)
+{
+    capture_t *result = job->result;
+    const char *file = job->file;
     int status;
-    waitpid(pid, &status, 0);
+
+    waitpid(child->pid, &status, 0);
     result->status = result->signal = 0;
     if (WIFEXITED(status))
         result->status = WEXITSTATUS(status);
@@ -194,25 +454,142 @@ capture_child(const char *file, char *const argv[])
     if (result->status != 0)
         debug("child process %s exited with status %d",
               file, result->status);
-    if (result->signal != 0)
+    if (result->signal != 0 && !result->stopped && !result->timedout)
         debug("child process %s killed by signal %d",
               file, result->signal);
     if (result->childerr.len > 0)
         debug("child process %s wrote to stderr:\n%s",
               file, result->childerr.buf);
+}
 
-    return result;
- err:
-    if (stdout_pipe[0] > -1)
-        close(stdout_pipe[0]);
-    if (stdout_pipe[1] > -1)
-        close(stdout_pipe[1]);
-    if (stderr_pipe[0] > -1)
-        close(stderr_pipe[0]);
-    if (stderr_pipe[1] > -1)
-        close(stderr_pipe[1]);
-    free_capture(result);
-    return NULL;
+int
+capture_children(capture_job_t *jobs, int njobs)
+{
+    child_t *children = calloc(njobs, sizeof(child_t));
+    struct pollfd *pfds = calloc(2 * njobs, sizeof(struct pollfd));
+    char **envp = make_child_env();
+    int i, nrunning = 0, ok = 0;
+
+    for (i = 0; i < njobs; i++)
+        jobs[i].result = NULL;
+    if (children == NULL || pfds == NULL || envp == NULL)
+        goto out;
+
+    for (i = 0; i < njobs; i++) {
+        long long now = monotonic_ms();
+        children[i].pid = -1;
+        children[i].deadline = child_deadline(&jobs[i], now);
+        jobs[i].result = new_capture();
+        if (jobs[i].result == NULL)
+            continue;
+        if (children[i].deadline >= 0 && children[i].deadline <= now) {
+            debug("no time left to run %s", jobs[i].file);
+            children[i].outfd = children[i].errfd = -1;
+            jobs[i].result->timedout = 1;
+            continue;
+        }
+        int spawned = spawn_child(&jobs[i], &children[i], envp);
+        if (spawned == 0) {
+            free_capture(jobs[i].result);
+            jobs[i].result = NULL;
+            continue;
+        }
+        if (spawned < 0) {
+            /* same as the shell's "command not found" */
+            children[i].outfd = children[i].errfd = -1;
+            jobs[i].result->status = 127;
+            continue;
+        }
+        nrunning++;
+    }
+
+    /* multiplex the pipes of all children until each one has either
+       closed both of them, told us enough, or run out of time */
+    while (nrunning > 0) {
+        int npfds = 0;
+        long long now = monotonic_ms();
+        long long wait = -1;
+        for (i = 0; i < njobs; i++) {
+            if (children[i].outfd < 0 || jobs[i].result == NULL)
+                continue;
+            if (children[i].deadline >= 0) {
+                long long left = children[i].deadline - now;
+                if (left < 0)
+                    left = 0;
+                if (wait < 0 || left < wait)
+                    wait = left;
+            }
+            if (!jobs[i].result->childout.eof) {
+                pfds[npfds].fd = children[i].outfd;
+                pfds[npfds++].events = POLLIN;
+            }
+            if (!jobs[i].result->childerr.eof) {
+                pfds[npfds].fd = children[i].errfd;
+                pfds[npfds++].events = POLLIN;
+            }
+        }
+        if (wait > INT_MAX)
+            wait = INT_MAX;
+        if (poll(pfds, npfds, (int) wait) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        int p = 0;
+        now = monotonic_ms();
+        for (i = 0; i < njobs; i++) {
+            capture_t *result = jobs[i].result;
+            child_t *child = &children[i];
+            int failed = 0;
+            if (child->outfd < 0 || result == NULL)
+                continue;
+            if (!result->childout.eof && pfds[p++].revents != 0)
+                failed |= !read_child(&jobs[i], child, child->outfd);
+            if (!result->childerr.eof && pfds[p++].revents != 0)
+                failed |= !read_child(&jobs[i], child, child->errfd);
+            if (failed || child->stop ||
+                (result->childout.eof && result->childerr.eof)) {
+                finish_child(&jobs[i], child);
+                nrunning--;
+            }
+            else if (child->deadline >= 0 && now >= child->deadline) {
+                expire_child(&jobs[i], child);
+                nrunning--;
+            }
+        }
+    }
+
+ out:
+    for (i = 0; i < njobs; i++) {
+        if (jobs[i].result == NULL)
+            continue;
+        if (children[i].pid > 0) {
+            if (children[i].outfd >= 0)
+                finish_child(&jobs[i], &children[i]);
+            reap_child(&jobs[i], &children[i]);
+        }
+        ok++;
+    }
+    free(children);
+    free(pfds);
+    free(envp);
+    return ok;
+}
+
+capture_t *
+capture_child(const char *file, char *const argv[])
+{
+    return capture_child_opts(file, argv, NULL);
+}
+
+capture_t *
+capture_child_opts(const char *file, char *const argv[],
+                   const capture_opts_t *opts)
+{
+    capture_job_t job = {file, argv, opts, NULL};
+    capture_children(&job, 1);
+    return job.result;
 }
 
 #if 0
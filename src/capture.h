@@ -15,12 +15,37 @@ typedef struct {
     dynbuf childerr;
     int status;                 /* exit status that child passed (if any) */
     int signal;                 /* signal that killed the child (if any) */
+    int stopped;                /* we stopped reading early and killed
+                                   the child (status, signal meaningless) */
+    int timedout;               /* the child ran out of time and was
+                                   killed, or never started for lack
+                                   of time (output is incomplete) */
 } capture_t;
 
-/* fork() and exec() a child process, capturing its entire stdout and
- * stderr to a capture object. Just like with execvp(), argv[0] should
- * be file (unless you are playing funny games) and the last element
- * of argv must be NULL.
+/* Called with each chunk of the child's stdout; return true once you
+ * have seen enough.
+ */
+typedef int (*capture_consume_t)(const char *chunk, size_t len, void *arg);
+
+typedef struct {
+    size_t limit;               /* stop once childout holds this many
+                                   bytes (0: no limit) */
+    capture_consume_t consume;  /* pass stdout to this function instead
+                                   of saving it in childout */
+    void *arg;                  /* passed to consume() */
+    unsigned int timeout;       /* kill the child after this many ms
+                                   (0: only the -t timeout applies) */
+    const char *dir;            /* run the child in this dir (NULL:
+                                   our current dir) */
+} capture_opts_t;
+
+/* Spawn a child process, capturing its entire stdout and stderr to a
+ * capture object. Just like with execvp(), argv[0] should be file
+ * (unless you are playing funny games) and the last element of argv
+ * must be NULL. The child gets /dev/null as stdin, none of our other
+ * file descriptors, and our environment with LC_ALL=C,
+ * GIT_OPTIONAL_LOCKS=0 and HGPLAIN=1. If file cannot be executed,
+ * capture->status is 127, like in the shell.
  *
  * On return, capture->childout.buf will be the child's stdout, and
  * capture->childout.len the number of bytes read. capture->childout.buf
@@ -32,6 +57,38 @@ typedef struct {
 capture_t *
 capture_child(const char *file, char *const argv[]);
 
+/* Like capture_child(), but stop as soon as the caller has seen
+ * enough of the child's stdout (see capture_opts_t): then stop
+ * reading, kill the child with SIGTERM, reap it, and set
+ * capture->stopped.  Every child runs in its own process group; if
+ * it is still running at its deadline (opts->timeout or the -t
+ * timeout, whichever comes first), the whole group is killed with
+ * SIGKILL and reaped, and capture->timedout is set.  Memory use is
+ * bounded by opts->limit, or by a small constant if opts->consume is
+ * set.  opts may be NULL.
+ */
+capture_t *
+capture_child_opts(const char *file, char *const argv[],
+                   const capture_opts_t *opts);
+
+/* One child process for capture_children() to run. */
+typedef struct {
+    const char *file;           /* as for capture_child() */
+    char *const *argv;
+    const capture_opts_t *opts; /* may be NULL */
+    capture_t *result;          /* set by capture_children(): NULL if
+                                   the child could not be run */
+} capture_job_t;
+
+/* Run njobs children at once, multiplexing all of their pipes in one
+ * loop, so that the whole thing takes as long as the slowest child
+ * rather than all of them combined.  Each child is handled exactly
+ * like capture_child_opts() would handle it, with its result in
+ * jobs[i].result.  Return the number of children that ran.
+ */
+int
+capture_children(capture_job_t *jobs, int njobs);
+
 /* free all resources in the object returned by capture_child() */
 void
 free_capture(capture_t *capture);
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * vcprompt-client: ask vcpromptd (vcprompt -D) for the prompt, and
+ * fall back to running vcprompt itself if there is no daemon or it
+ * cannot help.  Takes the same -f and -t options as vcprompt; any
+ * other option also means running vcprompt.  This is deliberately
+ * tiny: it must start faster than vcprompt itself to be worth it.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../daemon.h"
+
+/* Replace ourselves with vcprompt: the one next to us if we were run
+ * by path, else the first one in $PATH.
+ */
+static void
+run_vcprompt(char **argv)
+{
+    char path[PATH_MAX];
+    const char *slash = strrchr(argv[0], '/');
+
+    if (slash != NULL &&
+        snprintf(path, sizeof(path), "%.*s/vcprompt",
+                 (int) (slash - argv[0]), argv[0]) < (int) sizeof(path)) {
+        argv[0] = path;
+        execv(path, argv);
+    }
+    argv[0] = "vcprompt";
+    execvp("vcprompt", argv);
+    fprintf(stderr, "vcprompt-client: unable to run vcprompt: %s\n",
+            strerror(errno));
+    exit(1);
+}
+
+/* Send all len bytes of buf to fd. */
+static int
+send_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* Milliseconds left until deadline (CLOCK_MONOTONIC), at least 0. */
+static int
+ms_left(const struct timespec *deadline)
+{
+    struct timespec now;
+    long long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (deadline->tv_sec - now.tv_sec) * 1000LL +
+        (deadline->tv_nsec - now.tv_nsec) / 1000000;
+    return ms > 0 ? (int) ms : 0;
+}
+
+/* Ask the daemon, and print its answer if all of it arrives within
+ * the timeout (or DAEMON_REPLY_WAIT_MS without one).  Return 1 on
+ * success, 0 if we have to do it ourselves.
+ */
+static int
+ask_daemon(const char *format, const char *timeout)
+{
+    struct sockaddr_un addr;
+    char request[DAEMON_MAX_REQUEST];
+    char cwd[PATH_MAX];
+    char reply[4096];
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    struct timespec deadline;
+    size_t got = 0;
+    int len, fd, replied = 0;
+    int wait = atoi(timeout) > 0 ? atoi(timeout) : DAEMON_REPLY_WAIT_MS;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += wait / 1000;
+    deadline.tv_nsec += (wait % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (dir == NULL || dir[0] != '/' ||
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s",
+                 dir, DAEMON_SOCKET) >= (int) sizeof(addr.sun_path))
+        return 0;
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        return 0;
+    len = snprintf(request, sizeof(request), "%s%c%s%s%c%s%c",
+                   cwd, '\0', format ? "f" : "-", format ? format : "",
+                   '\0', timeout, '\0');
+    if (len < 0 || len >= (int) sizeof(request))
+        return 0;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return 0;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        !send_all(fd, request, len) || shutdown(fd, SHUT_WR) < 0)
+        goto done;
+
+    /* the reply is "y" + the prompt, then EOF: don't print anything
+       until all of it is here (or it outgrows reply), so that running
+       vcprompt after the deadline cannot print the prompt twice */
+    for (;;) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        ssize_t n;
+        if (poll(&pfd, 1, ms_left(&deadline)) <= 0)
+            break;
+        n = read(fd, reply + got, sizeof(reply) - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || (n == 0 && got == 0) || reply[0] != 'y')
+            break;
+        got += n;
+        if (n == 0 || got == sizeof(reply)) {
+            fwrite(reply + 1, 1, got - 1, stdout);
+            replied = 1;
+            break;
+        }
+    }
+    /* a reply too big for the buffer: stream the rest */
+    while (replied && got == sizeof(reply)) {
+        ssize_t n = read(fd, reply, sizeof(reply));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        fwrite(reply, 1, n, stdout);
+    }
+
+ done:
+    close(fd);
+    return replied;
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *format = getenv("VCPROMPT_FORMAT");
+    const char *timeout = "0";
+    int opt;
+
+    opterr = 0;
+    while ((opt = getopt(argc, argv, "+f:t:")) != -1) {
+        switch (opt) {
+            case 'f':
+                format = optarg;
+                break;
+            case 't':
+                timeout = optarg;
+                break;
+            default:
+                run_vcprompt(argv);
+        }
+    }
+    if (optind < argc || !ask_daemon(format, timeout)) {
+        optind = 1;
+        run_vcprompt(argv);
+    }
+    return 0;
+}
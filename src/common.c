@@ -13,8 +13,12 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <mntent.h>
 
 #include "common.h"
@@ -31,22 +35,71 @@ free_result(result_t *result)
     free(result->branch);
     free(result->revision);
     free(result->patch);
+    free(result->operation);
     free(result->full_revision);
     free(result);
 }
 
-static options_t* _options = NULL;
+/* per thread, so that each thread of vcprompt --batch can work on its
+ * own dir with its own timeout */
+static __thread options_t* _options = NULL;
+static __thread struct timespec start_time;
 
 void
 set_options(options_t *options)
 {
     _options = options;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 }
 
 int
 debug_mode()
 {
-    return _options->debug;
+    return _options != NULL && _options->debug;
+}
+
+int
+timeout_remaining(void)
+{
+    struct timespec now;
+    long long elapsed;
+
+    if (_options == NULL || _options->timeout == 0)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start_time.tv_sec) * 1000LL +
+        (now.tv_nsec - start_time.tv_nsec) / 1000000;
+    if (elapsed >= _options->timeout)
+        return 0;
+    if (_options->timeout - elapsed > INT_MAX)
+        return INT_MAX;
+    return _options->timeout - elapsed;
+}
+
+int
+budget_remaining(char field)
+{
+    struct timespec now;
+    unsigned int budget = 0;
+    long long elapsed;
+    int remaining = timeout_remaining();
+
+    if (_options != NULL && field == 'u')
+        budget = _options->unknown_budget;
+    else if (_options != NULL && field == 'm')
+        budget = _options->modified_budget;
+    if (budget == 0)
+        return remaining;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start_time.tv_sec) * 1000LL +
+        (now.tv_nsec - start_time.tv_nsec) / 1000000;
+    if (elapsed >= budget)
+        return 0;
+    if (remaining >= 0 && budget - elapsed >= remaining)
+        return remaining;
+    if (budget - elapsed > INT_MAX)
+        return INT_MAX;
+    return budget - elapsed;
 }
 
 int
@@ -78,20 +131,30 @@ result_set_branch(result_t *result, const char *branch)
 vccontext_t*
 init_context(const char *name,
              options_t *options,
-             int (*probe)(vccontext_t*),
+             const char *const *markers,
+             const char *const *stamps,
+             int (*probe)(vccontext_t*, int),
              result_t* (*get_info)(vccontext_t*))
 {
     vccontext_t *context = (vccontext_t*) calloc(1, sizeof(vccontext_t));
     context->options = options;
     context->name = name;
+    context->markers = markers;
+    context->stamps = stamps;
     context->probe = probe;
     context->get_info = get_info;
+    context->dirfd = -1;
     return context;
 }
 
 void
 free_context(vccontext_t *context)
 {
+    if (context->state != NULL)
+        context->free_state(context->state);
+    if (context->dirfd >= 0)
+        close(context->dirfd);
+    free(context->top);
     free(context->rel_path);
     free(context);
 }
@@ -101,7 +164,7 @@ debug(char *fmt, ...)
 {
     va_list args;
 
-    if (!_options->debug)
+    if (_options == NULL || !_options->debug)
         return;
 
     va_start(args, fmt);
@@ -112,10 +175,10 @@ debug(char *fmt, ...)
 }
 
 static int
-_testmode(char *name, mode_t bits, char what[])
+_testmode(int dirfd, const char *name, mode_t bits, char what[])
 {
     struct stat statbuf;
-    if (stat(name, &statbuf) < 0) {
+    if (fstatat(dirfd, name, &statbuf, 0) < 0) {
         debug("failed to stat() '%s': %s", name, strerror(errno));
         return 0;
     }
@@ -129,13 +192,25 @@ _testmode(char *name, mode_t bits, char what[])
 int
 isdir(char *name)
 {
-    return _testmode(name, S_IFDIR, "directory");
+    return _testmode(AT_FDCWD, name, S_IFDIR, "directory");
 }
 
 int
 isfile(char *name)
 {
-    return _testmode(name, S_IFREG, "regular file");
+    return _testmode(AT_FDCWD, name, S_IFREG, "regular file");
+}
+
+int
+isdir_at(int dirfd, const char *name)
+{
+    return _testmode(dirfd, name, S_IFDIR, "directory");
+}
+
+int
+isfile_at(int dirfd, const char *name)
+{
+    return _testmode(dirfd, name, S_IFREG, "regular file");
 }
 
 static
@@ -147,7 +222,7 @@ int is_remote(const char *fsname)
 }
 
 int
-should_ignore_modified(const char *dirname)
+should_ignore_modified_at(int dirfd, const char *dirname)
 {
     static const char *ignore_file = "/vcprompt-no-modified";
     char *filename = malloc(strlen(dirname) + strlen(ignore_file) + 1);
@@ -155,7 +230,7 @@ should_ignore_modified(const char *dirname)
     strcat(filename, ignore_file);
     int ignore_modified = 0;
     struct stat buf;
-    if (stat(filename, &buf) == 0) {
+    if (fstatat(dirfd, filename, &buf, 0) == 0) {
         ignore_modified = 1;
     }
     free(filename);
@@ -163,26 +238,25 @@ should_ignore_modified(const char *dirname)
 }
 
 
-/* returns 1 if cwd is remote, 0 if it is local */
+/* returns 1 if dir is remote, 0 if it is local */
 int
-is_cwd_remote(void)
+is_dir_remote(const char *dir)
 {
     FILE *fp;
-    struct mntent *mnt;
-    char cwd[BUFSIZ];
-    size_t cwdlen, longest_match;
+    struct mntent *mnt, mntbuf;
+    char strings[BUFSIZ];
+    size_t pathlen, longest_match;
     char *mntpt;
     char *filename = _PATH_MOUNTED;
-    char *result = getcwd(cwd, sizeof(cwd));
-    if (result == NULL)
-        return 0;
     fp = setmntent(filename, "r");
-    cwdlen = strlen(cwd);
+    if (fp == NULL)
+        return 0;
+    pathlen = strlen(dir);
     longest_match = 0;
     mntpt = NULL;
-    while ((mnt = getmntent(fp))) {
+    while ((mnt = getmntent_r(fp, &mntbuf, strings, sizeof(strings)))) {
         size_t dirlen = strlen(mnt->mnt_dir);
-        if (dirlen < cwdlen && strncmp(cwd, mnt->mnt_dir, dirlen) == 0
+        if (dirlen < pathlen && strncmp(dir, mnt->mnt_dir, dirlen) == 0
             && dirlen > longest_match) {
             /* found a possible mount point, only keep the longest one */
             longest_match = dirlen;
@@ -190,6 +264,7 @@ is_cwd_remote(void)
             mntpt = strdup(mnt->mnt_fsname);
         }
     }
+    endmntent(fp);
     if (mntpt != NULL) {
         debug("using mount point: '%s'", mntpt);
         int rem = is_remote(mntpt);
@@ -199,12 +274,27 @@ is_cwd_remote(void)
     return 0;
 }
 
+/* fopen() filename relative to dirfd, for reading */
+static FILE *
+fopen_at(int dirfd, const char *filename)
+{
+    FILE *file = NULL;
+    int fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (file = fdopen(fd, "r")) == NULL)
+        close(fd);
+    return file;
+}
+
 int
 read_first_line(char *filename, char *buf, int size)
 {
-    FILE *file;
+    return read_first_line_at(AT_FDCWD, filename, buf, size);
+}
 
-    file = fopen(filename, "r");
+int
+read_first_line_at(int dirfd, const char *filename, char *buf, int size)
+{
+    FILE *file = fopen_at(dirfd, filename);
     if (file == NULL) {
         debug("error opening '%s': %s", filename, strerror(errno));
         return 0;
@@ -224,11 +314,11 @@ read_first_line(char *filename, char *buf, int size)
 }
 
 int
-read_last_line(char *filename, char *buf, int size)
+read_last_line_at(int dirfd, const char *filename, char *buf, int size)
 {
     FILE *file;
 
-    file = fopen(filename, "r");
+    file = fopen_at(dirfd, filename);
     if (file == NULL) {
         debug("error opening '%s': %s", filename, strerror(errno));
         return 0;
@@ -250,12 +340,12 @@ read_last_line(char *filename, char *buf, int size)
 }
 
 int
-read_file(const char *filename, char *buf, int size)
+read_file_at(int dirfd, const char *filename, char *buf, int size)
 {
     FILE *file;
     int readsize;
 
-    file = fopen(filename, "r");
+    file = fopen_at(dirfd, filename);
     if (file == NULL) {
         debug("error opening '%s': %s", filename, strerror(errno));
         return 0;
@@ -291,6 +381,30 @@ dump_hex(char *dest, const char *data, int datasize)
     dest[i * 2] = '\0';
 }
 
+static int
+hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+int
+parse_hex(unsigned char *dest, const char *src, int datasize)
+{
+    for (int i = 0; i < datasize; i++) {
+        int hi = hex_digit(src[2 * i]), lo = hex_digit(src[2 * i + 1]);
+        if (hi < 0 || lo < 0)
+            return 0;
+        dest[i] = (hi << 4) | lo;
+    }
+    return 1;
+}
+
 void
 get_till_eol(char *dest, const char *src, int nchars)
 {
@@ -300,3 +414,68 @@ get_till_eol(char *dest, const char *src, int nchars)
     strncpy(dest, src, nchars);
     dest[nchars] = '\0';
 }
+
+unsigned int
+get_be16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+unsigned int
+get_be24(const unsigned char *p)
+{
+    return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+unsigned int
+get_be32(const unsigned char *p)
+{
+    return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+unsigned long long
+get_be64(const unsigned char *p)
+{
+    return ((unsigned long long) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+void *
+map_file(int dirfd, const char *filename, size_t *size, struct stat *st)
+{
+    struct stat statbuf;
+    void *data;
+    int fd;
+
+    fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        debug("error opening '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &statbuf) < 0) {
+        debug("failed to fstat() '%s': %s", filename, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    if (statbuf.st_size == 0) {
+        debug("'%s' is empty", filename);
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        debug("failed to mmap() '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+    *size = statbuf.st_size;
+    if (st != NULL)
+        *st = statbuf;
+    return data;
+}
+
+void
+unmap_file(void *data, size_t size)
+{
+    if (data != NULL)
+        munmap(data, size);
+}
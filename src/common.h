@@ -20,8 +20,22 @@ typedef struct {
     int show_patch;                     /* show patch name? */
     int show_unknown;                   /* show ? if unknown files? */
     int show_modified;                  /* show + if local changes? */
+    int show_upstream;                  /* show commits ahead/behind? */
+    int show_operation;                 /* show merge/rebase/... state? */
+    int show_stash;                     /* show number of stashes? */
+    int show_staged;                    /* show * if staged changes? */
     unsigned int timeout;               /* timeout in milliseconds */
+    unsigned int unknown_budget;        /* ... just for %u (--budget u=) */
+    unsigned int modified_budget;       /* ... just for %m (--budget m=) */
+    char *placeholder;                  /* for %u/%m out of time */
     int show_features;                  /* list builtin features */
+    int daemon;                         /* run as vcpromptd */
+    unsigned int cache_ttl;             /* use the result cache (-c)? */
+    int stale_ok;                       /* print stale results (-s)? */
+    int batch;                          /* read dirs from stdin? */
+    int jobs;                           /* threads for --batch */
+    int serve_stdio;                    /* answer requests on stdin? */
+    int watch;                          /* print a line per change? */
 } options_t;
 
 /* What we figured out by analyzing the working dir: info that
@@ -34,6 +48,19 @@ typedef struct {
     char *patch;                        /* name of current patch */
     int unknown;                        /* any unknown files? */
     int modified;                       /* any local changes? */
+    int staged;                         /* any changes in the index? */
+                                        /* (for all three: -1 if we ran
+                                           out of time to find out) */
+    int ahead;                          /* commits not in upstream */
+    int behind;                         /* upstream commits not here */
+                                        /* (for both: 0 if there is no
+                                           upstream, -1 if we ran out of
+                                           time to find out) */
+    char *operation;                    /* operation in progress, e.g.
+                                           "MERGING" or "REBASE 2/5" */
+    int stashes;                        /* number of stashes (-1 if we
+                                           ran out of time to count) */
+    int stale;                          /* from the cache, out of date? */
 
     /* revision ID in VC-specific, not-necessarily-human-readable form */
     void *full_revision;
@@ -42,6 +69,11 @@ typedef struct {
 int result_set_revision(result_t *result, const char *revision, int len);
 int result_set_branch(result_t *result, const char *branch);
 
+/* Called by a context's get_stamps() with each stamp file, relative
+ * to dirfd.
+ */
+typedef void (*stamp_fn_t)(int dirfd, const char *filename, void *arg);
+
 typedef struct vccontext_t vccontext_t;
 struct vccontext_t {
     const char *name;                   /* name of the VC system */
@@ -54,21 +86,79 @@ struct vccontext_t {
      */
     char *rel_path;
 
-    /* context methods */
-    int (*probe)(vccontext_t*);
+    /* The top of the working copy that probe_dirs() found: its
+     * absolute path, and a directory fd open on it.  get_info()
+     * reads everything relative to dirfd, and runs child processes
+     * in top, so it never depends on the current dir.
+     */
+    char *top;
+    int dirfd;
+
+    /* NULL-terminated list of names whose presence in a directory
+     * makes it worth calling probe() there, e.g. ".git"
+     */
+    const char *const *markers;
+
+    /* NULL-terminated list of metadata files, relative to the top of
+     * the working copy, that change whenever the branch, revision or
+     * patch do, e.g. ".git/HEAD": the result cache (vcprompt -c)
+     * trusts a result only while their stat() info is unchanged
+     */
+    const char *const *stamps;
+
+    /* context methods: probe() checks the directory open on dirfd;
+     * get_info() examines the one it claimed (top and dirfd above)
+     */
+    int (*probe)(vccontext_t*, int dirfd);
     result_t* (*get_info)(vccontext_t*);
+
+    /* optional, for stamp files that are not at fixed paths under the
+     * top dir (e.g. in the git dir of a linked worktree): call stamp()
+     * with each of them, in the same order every time.  Return 0 if
+     * they cannot be found, and so the result must not be cached.
+     */
+    int (*get_stamps)(vccontext_t*, stamp_fn_t stamp, void *arg);
+
+    /* whatever get_info() keeps open for its next call (e.g. a
+     * database connection), which pays off when a context is reused
+     * for many requests (vcprompt -D, --serve-stdio); NULL, or freed
+     * with free_state() by free_context()
+     */
+    void *state;
+    void (*free_state)(void *state);
 };
 
+/* Make options the options of the calling thread, and start its -t
+ * timeout.  Every thread that calls debug() or timeout_remaining()
+ * must call this first.
+ */
 void
 set_options(options_t*);
 
 int
 debug_mode();
 
+/* Milliseconds left before the -t timeout expires, counting from the
+ * call to set_options(): -1 if there is no timeout, 0 if it has
+ * already expired.
+ */
+int
+timeout_remaining(void);
+
+/* Like timeout_remaining(), but for working out the field of the
+ * format with this letter: 'u' or 'm' have their own budgets
+ * (--budget), also counted from the call to set_options(), within
+ * the -t timeout.
+ */
+int
+budget_remaining(char field);
+
 vccontext_t*
 init_context(const char *name,
              options_t *options,
-             int (*probe)(vccontext_t*),
+             const char *const *markers,
+             const char *const *stamps,
+             int (*probe)(vccontext_t*, int),
              result_t* (*get_info)(vccontext_t*));
 
 void
@@ -98,6 +188,15 @@ isdir(char *name);
 int
 isfile(char *name);
 
+/* Same as isdir() and isfile(), but name is relative to the directory
+ * open on dirfd (or the current dir, if dirfd is AT_FDCWD).
+ */
+int
+isdir_at(int dirfd, const char *name);
+
+int
+isfile_at(int dirfd, const char *name);
+
 /* Open the specified file, read the first line (up to size-1 chars) to
  * buf, and close the file.  buf will not contain a newline.  Caller
  * must allocate at least size chars for buf.  Return 1 on successful
@@ -107,21 +206,28 @@ isfile(char *name);
 int
 read_first_line(char *filename, char *buf, int size);
 
-/* Open the specified file, reading and discarding every line except the
- * last.  The last line is written to buf (up to size-1 chars) without
- * the newline.  Caller must allocate at least size chars for buf.
- * Return value and error handling: same as read_first_line().
+/* Same as read_first_line(), but filename is relative to the directory
+ * open on dirfd (or the current dir, if dirfd is AT_FDCWD).
+ */
+int
+read_first_line_at(int dirfd, const char *filename, char *buf, int size);
+
+/* Open the specified file (relative to dirfd), reading and discarding
+ * every line except the last.  The last line is written to buf (up to
+ * size-1 chars) without the newline.  Caller must allocate at least
+ * size chars for buf.  Return value and error handling: same as
+ * read_first_line().
  */
 int
-read_last_line(char *filename, char *buf, int size);
+read_last_line_at(int dirfd, const char *filename, char *buf, int size);
 
-/* Open and read the specified file to buf (up to size chars).  Caller
- * must allocate at least size chars for buf.  buf is assumed to be
- * binary data, i.e. not NUL-terminated.  Return value and error
- * handling: same as read_first_line().
+/* Open and read the specified file (relative to dirfd) to buf (up to
+ * size chars).  Caller must allocate at least size chars for buf.  buf
+ * is assumed to be binary data, i.e. not NUL-terminated.  Return value
+ * and error handling: same as read_first_line().
  */
 int
-read_file(const char *filename, char *buf, int size);
+read_file_at(int dirfd, const char *filename, char *buf, int size);
 
 /* If the last char of buf is '\n', replace it with '\0', i.e. terminate
  * the string one char earlier.
@@ -135,6 +241,13 @@ chop_newline(char *buf);
 void
 dump_hex(char *dest, const char *data, int datasize);
 
+/* The reverse of dump_hex(): decode datasize * 2 hex chars from src
+ * to datasize bytes in dest.  Return 1 on success, 0 if src has
+ * anything but hex digits.
+ */
+int
+parse_hex(unsigned char *dest, const char *src, int datasize);
+
 /* Copy up to nchars chars from src to dest, stopping at the first
  * newline and terminating dest with a NUL char.  On return, it is
  * guaranteed that dest will not contain a newline and that strlen(dest)
@@ -143,9 +256,43 @@ dump_hex(char *dest, const char *data, int datasize);
 void
 get_till_eol(char *dest, const char *src, int nchars);
 
+/* Decode big-endian (network byte order) integers of the given width
+ * from a (possibly unaligned) pointer into some binary file format.
+ */
+unsigned int
+get_be16(const unsigned char *p);
+
+unsigned int
+get_be24(const unsigned char *p);
+
+unsigned int
+get_be32(const unsigned char *p);
+
+unsigned long long
+get_be64(const unsigned char *p);
+
+/* mmap() all of filename (relative to dirfd, or to the current dir if
+ * dirfd is AT_FDCWD) read-only.  Return a pointer to the mapped data
+ * and store its size in *size; if st is not NULL, also store the
+ * file's stat() info there.  Return NULL on any error, including an
+ * empty file.  Error messages are written with debug().  Caller must
+ * release the mapping with unmap_file().
+ */
+struct stat;
+void *
+map_file(int dirfd, const char *filename, size_t *size, struct stat *st);
+
+void
+unmap_file(void *data, size_t size);
+
+/* Return true if the user asked us not to look for modified files in
+ * the working copy whose metadata dir is dirname (relative to dirfd),
+ * e.g. by creating .hg/vcprompt-no-modified.
+ */
 int
-should_ignore_modified(const char *dirname);
+should_ignore_modified_at(int dirfd, const char *dirname);
 
+/* Return true if dir (an absolute path) is on a remote filesystem. */
 int
-is_cwd_remote(void);
+is_dir_remote(const char *dir);
 #endif
@@ -15,9 +15,9 @@
 #include "cvs.h"
 
 static int
-cvs_probe(vccontext_t *context)
+cvs_probe(vccontext_t *context, int dirfd)
 {
-    return isfile("CVS/Entries");
+    return isfile_at(dirfd, "CVS/Entries");
 }
 
 static result_t*
@@ -26,7 +26,7 @@ cvs_get_info(vccontext_t *context)
     result_t *result = init_result();
     char buf[1024];
 
-    if (!read_first_line("CVS/Tag", buf, 1024)) {
+    if (!read_first_line_at(context->dirfd, "CVS/Tag", buf, 1024)) {
         debug("unable to read CVS/Tag: assuming trunk");
         result_set_branch(result, "trunk");
     }
@@ -47,5 +47,8 @@ cvs_get_info(vccontext_t *context)
 vccontext_t*
 get_cvs_context(options_t *options)
 {
-    return init_context("cvs", options, cvs_probe, cvs_get_info);
+    static const char *const markers[] = {"CVS", NULL};
+    static const char *const stamps[] = {"CVS/Entries", "CVS/Tag", NULL};
+    return init_context("cvs", options, markers, stamps,
+                        cvs_probe, cvs_get_info);
 }
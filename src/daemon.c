@@ -0,0 +1,1063 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE             /* for accept4() */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "daemon.h"
+#include "vcprompt.h"
+
+/* how many answers to remember */
+#define MAX_ENTRIES 64
+
+/* how many working copies to watch at once, and how many dirs in
+ * all: past either limit, start over */
+#define MAX_REPOS 32
+#define MAX_WATCHES 65536
+
+/* how many dirs outside its top dir a working copy's metadata may be
+ * in (e.g. the git dir and common dir of a linked worktree) */
+#define MAX_META_DIRS 16
+
+/* how long a client may take to send its request */
+#define REQUEST_TIMEOUT_MS 1000
+
+/* vcprompt --watch waits for this long without events before it
+ * works out the prompt again, but no longer than the max in all */
+#define WATCH_DEBOUNCE_MS 100
+#define WATCH_MAX_DELAY_MS 1000
+
+#define WATCH_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+                    IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF |         \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR |          \
+                    IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* Metadata dirs that are big, and change without affecting anything
+ * we print (e.g. new objects are only interesting once a ref points
+ * to them, and then the ref changes too).
+ */
+static const char *unwatched[] = {
+    ".git/objects",
+    ".git/logs",
+    ".hg/store",
+    ".svn/pristine",
+    NULL,
+};
+
+/* A working copy that we watch with inotify. */
+typedef struct {
+    char *top;                  /* absolute path of its top dir */
+    size_t toplen;
+    const char *const *markers; /* of the context that claimed it */
+    unsigned int generation;    /* bumped on every change below top */
+    unsigned int meta_generation; /* ... only for metadata changes */
+    int watched;                /* every dir below top is watched */
+    int metawds[MAX_META_DIRS]; /* watches of metadata dirs outside top */
+    int nmetawds;
+} repo_t;
+
+/* A cached answer. */
+typedef struct {
+    char *cwd;                  /* the request */
+    char *format;
+    repo_t *repo;
+    unsigned int generation;    /* repo->generation when computed */
+    char *output;
+} entry_t;
+
+typedef struct {
+    options_t *base;            /* from the command line */
+    options_t options;          /* for the current request */
+    vccontext_t *contexts[NUM_CONTEXTS];
+    int inotify_fd;
+    char **watches;             /* watched path, indexed by wd */
+    int nwatches;               /* size of watches */
+    int nwatched;               /* number of non-NULL watches */
+    repo_t repos[MAX_REPOS];
+    int nrepos;
+    entry_t entries[MAX_ENTRIES];
+    int nentries;
+    unsigned int nevents;       /* bumped on every event and flush() */
+} daemon_t;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void
+stop_daemon(int sig)
+{
+    stopping = 1;
+}
+
+static int
+socket_path(char *path, size_t size)
+{
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] != '/') {
+        debug("XDG_RUNTIME_DIR not set: no socket for vcpromptd");
+        return 0;
+    }
+    return snprintf(path, size, "%s/%s", dir, DAEMON_SOCKET) < (int) size;
+}
+
+/* Forget all cached answers and watches, e.g. when the kernel
+ * dropped events or we ran out of room.
+ */
+static void
+flush(daemon_t *d)
+{
+    int i;
+
+    debug("vcpromptd: forgetting everything");
+    d->nevents++;
+    for (i = 0; i < d->nentries; i++) {
+        free(d->entries[i].cwd);
+        free(d->entries[i].format);
+        free(d->entries[i].output);
+    }
+    d->nentries = 0;
+    for (i = 0; i < d->nrepos; i++)
+        free(d->repos[i].top);
+    d->nrepos = 0;
+    for (i = 0; i < d->nwatches; i++)
+        free(d->watches[i]);
+    free(d->watches);
+    d->watches = NULL;
+    d->nwatches = d->nwatched = 0;
+
+    if (d->inotify_fd >= 0)
+        close(d->inotify_fd);
+    d->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (d->inotify_fd < 0)
+        debug("inotify_init1() failed: %s", strerror(errno));
+}
+
+/* Is path (relative to a top dir) one of the unwatched dirs? */
+static int
+is_unwatched(const char *path)
+{
+    size_t len = strlen(path);
+    for (const char **u = unwatched; *u != NULL; u++) {
+        size_t ulen = strlen(*u);
+        if (len >= ulen && strcmp(path + len - ulen, *u) == 0 &&
+            (len == ulen || path[len - ulen - 1] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+/* Watch the dir path (if it is not watched already).  Return its
+ * watch descriptor, or -1 on failure.
+ */
+static int
+add_watch(daemon_t *d, const char *path)
+{
+    int wd;
+
+    if (d->nwatched >= MAX_WATCHES) {
+        debug("vcpromptd: too many dirs to watch");
+        return -1;
+    }
+    wd = inotify_add_watch(d->inotify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        debug("unable to watch %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (wd >= d->nwatches) {
+        int n = (wd + 1) * 2;
+        char **watches = realloc(d->watches, n * sizeof(char *));
+        if (watches == NULL)
+            return -1;
+        memset(watches + d->nwatches, 0, (n - d->nwatches) * sizeof(char *));
+        d->watches = watches;
+        d->nwatches = n;
+    }
+    if (d->watches[wd] == NULL) {
+        if ((d->watches[wd] = strdup(path)) == NULL)
+            return -1;
+        d->nwatched++;
+    }
+    return wd;
+}
+
+/* Watch the dir path and every dir below it, except for the
+ * unwatched metadata dirs and other filesystems.  top is the length
+ * of the path of the working copy's top dir.  Return 1 if all of
+ * them are now watched.
+ */
+static int
+watch_tree(daemon_t *d, char *path, size_t len, size_t top, dev_t dev)
+{
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+    int ok = 1;
+
+    if (add_watch(d, path) < 0)
+        return 0;
+    if ((dir = opendir(path)) == NULL)
+        return 0;
+    while (ok && (de = readdir(dir)) != NULL) {
+        size_t namelen = strlen(de->d_name);
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+            continue;
+        if (len + 1 + namelen >= PATH_MAX) {
+            ok = 0;
+            break;
+        }
+        path[len] = '/';
+        memcpy(path + len + 1, de->d_name, namelen + 1);
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode) &&
+            st.st_dev == dev && !is_unwatched(path + top + 1))
+            ok = watch_tree(d, path, len + 1 + namelen, top, dev);
+        path[len] = '\0';
+    }
+    closedir(dir);
+    return ok;
+}
+
+static repo_t *
+find_repo(daemon_t *d, const char *top)
+{
+    for (int i = 0; i < d->nrepos; i++) {
+        if (strcmp(d->repos[i].top, top) == 0)
+            return &d->repos[i];
+    }
+    return NULL;
+}
+
+/* Start watching the working copy whose top dir is top, as claimed
+ * by a context with markers.
+ */
+static repo_t *
+add_repo(daemon_t *d, const char *top, const char *const *markers)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    repo_t *repo;
+
+    if (d->nrepos == MAX_REPOS)
+        flush(d);
+    repo = &d->repos[d->nrepos];
+    if ((repo->top = strdup(top)) == NULL)
+        return NULL;
+    d->nrepos++;
+    repo->toplen = strlen(top);
+    repo->markers = markers;
+    repo->generation = repo->meta_generation = 0;
+    repo->nmetawds = 0;
+    strcpy(path, top);
+    repo->watched = (d->inotify_fd >= 0 && stat(top, &st) == 0 &&
+                     watch_tree(d, path, repo->toplen, repo->toplen,
+                                st.st_dev));
+    debug("vcpromptd: %s %s (%d dirs watched in all)", repo->watched
+          ? "watching" : "unable to watch all of", top, d->nwatched);
+    return repo;
+}
+
+/* For watch_stamps(). */
+typedef struct {
+    daemon_t *d;
+    repo_t *repo;
+    int ok;
+} stamp_watch_t;
+
+/* Make sure that the dir holding a stamp file is watched, if it is
+ * outside the top dir of the working copy; or, while it does not
+ * exist, the nearest dir above it, which will see it being created.
+ * dirfd's path comes from /proc, like inotify itself Linux-only.
+ */
+static void
+watch_stamp(int dirfd, const char *filename, void *arg)
+{
+    stamp_watch_t *w = arg;
+    repo_t *repo = w->repo;
+    char link[32], path[PATH_MAX];
+    const char *slash = strrchr(filename, '/');
+    struct stat st;
+    ssize_t len, base;
+    int wd, i;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", dirfd);
+    if ((base = len = readlink(link, path, sizeof(path) - 1)) < 0) {
+        debug("unable to read %s: %s", link, strerror(errno));
+        w->ok = 0;
+        return;
+    }
+    if (slash != NULL) {
+        if (len + 1 + (slash - filename) >= (ssize_t) sizeof(path)) {
+            w->ok = 0;
+            return;
+        }
+        path[len++] = '/';
+        memcpy(path + len, filename, slash - filename);
+        len += slash - filename;
+    }
+    path[len] = '\0';
+    if (strncmp(path, repo->top, repo->toplen) == 0 &&
+        (path[repo->toplen] == '/' || path[repo->toplen] == '\0'))
+        return;                         /* watched with the tree */
+
+    while (len > base && (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))) {
+        while (path[--len] != '/')
+            ;
+        path[len] = '\0';
+    }
+    if ((wd = add_watch(w->d, path)) < 0) {
+        w->ok = 0;
+        return;
+    }
+    for (i = 0; i < repo->nmetawds; i++) {
+        if (repo->metawds[i] == wd)
+            return;
+    }
+    if (repo->nmetawds == MAX_META_DIRS) {
+        debug("vcpromptd: too many metadata dirs outside %s", repo->top);
+        w->ok = 0;
+        return;
+    }
+    debug("vcpromptd: watching %s for %s", path, repo->top);
+    repo->metawds[repo->nmetawds++] = wd;
+}
+
+/* Watch the dirs of the stamp files of context (see get_stamps() in
+ * vccontext_t) that are not below the top dir of its working copy,
+ * repo: e.g. the git dir of a linked worktree, or the refs in the
+ * common dir it shares with the main one.  They may change along with
+ * the metadata (e.g. another branch's refs dir after a checkout), so
+ * this is done every time the answer is worked out again.
+ */
+static void
+watch_stamps(daemon_t *d, repo_t *repo, vccontext_t *context)
+{
+    stamp_watch_t w = {d, repo, 1};
+
+    if (context->get_stamps == NULL || d->inotify_fd < 0)
+        return;
+    if (!context->get_stamps(context, watch_stamp, &w) || !w.ok)
+        repo->watched = 0;
+}
+
+/* Is name one of the markers of repo? len is the length of name. */
+static int
+is_marker(const repo_t *repo, const char *name, size_t len)
+{
+    for (const char *const *m = repo->markers; *m != NULL; m++) {
+        if (strlen(*m) == len && strncmp(*m, name, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Is the entry name of dir path (NULL: path itself) part of the
+ * metadata of repo, e.g. ".git/refs" or "sub/CVS/Entries"?  path is
+ * below the top of repo.
+ */
+static int
+is_metadata(const repo_t *repo, const char *path, const char *name)
+{
+    const char *p = path + repo->toplen;
+    while (*p == '/') {
+        const char *end = strchrnul(++p, '/');
+        if (is_marker(repo, p, end - p))
+            return 1;
+        p = end;
+    }
+    return name != NULL && is_marker(repo, name, strlen(name));
+}
+
+/* Is wd one of the metadata dirs of repo outside its top dir? */
+static int
+is_meta_watch(const repo_t *repo, int wd)
+{
+    for (int i = 0; i < repo->nmetawds; i++) {
+        if (repo->metawds[i] == wd)
+            return 1;
+    }
+    return 0;
+}
+
+/* Something changed in the dir path, watched as wd (to its entry
+ * name, if not NULL): every working copy containing it, or with
+ * metadata in it, is now stale.
+ */
+static void
+invalidate(daemon_t *d, int wd, const char *path, const char *name)
+{
+    size_t len = strlen(path);
+    d->nevents++;
+    for (int i = 0; i < d->nrepos; i++) {
+        repo_t *repo = &d->repos[i];
+        if (len >= repo->toplen &&
+            strncmp(path, repo->top, repo->toplen) == 0 &&
+            (path[repo->toplen] == '/' || path[repo->toplen] == '\0')) {
+            repo->generation++;
+            if (is_metadata(repo, path, name))
+                repo->meta_generation++;
+        }
+        else if (is_meta_watch(repo, wd)) {
+            repo->generation++;
+            repo->meta_generation++;
+        }
+    }
+}
+
+/* Read all pending inotify events. */
+static void
+read_events(daemon_t *d)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    while (d->inotify_fd >= 0 &&
+           (len = read(d->inotify_fd, buf, sizeof(buf))) > 0) {
+        const char *p = buf;
+        while (p < buf + len) {
+            const struct inotify_event *ev = (const struct inotify_event *) p;
+            p += sizeof(*ev) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                flush(d);
+                return;
+            }
+            if (ev->wd < 0 || ev->wd >= d->nwatches ||
+                d->watches[ev->wd] == NULL)
+                continue;
+
+            char *dir = d->watches[ev->wd];
+            invalidate(d, ev->wd, dir, ev->len > 0 ? ev->name : NULL);
+            if (ev->mask & IN_IGNORED) {
+                free(dir);
+                d->watches[ev->wd] = NULL;
+                d->nwatched--;
+                /* the number may come back for another dir */
+                for (int i = 0; i < d->nrepos; i++) {
+                    repo_t *repo = &d->repos[i];
+                    for (int j = 0; j < repo->nmetawds; j++) {
+                        if (repo->metawds[j] == ev->wd)
+                            repo->metawds[j--] =
+                                repo->metawds[--repo->nmetawds];
+                    }
+                }
+            }
+            else if ((ev->mask & IN_ISDIR) &&
+                     (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                /* a new dir: watch it too, on behalf of every working
+                   copy that contains it */
+                char path[PATH_MAX];
+                struct stat st;
+                if (snprintf(path, sizeof(path), "%s/%s", dir, ev->name)
+                    >= (int) sizeof(path) || lstat(path, &st) < 0)
+                    continue;
+                for (int i = 0; i < d->nrepos; i++) {
+                    repo_t *repo = &d->repos[i];
+                    if (strncmp(path, repo->top, repo->toplen) != 0 ||
+                        path[repo->toplen] != '/' || !repo->watched ||
+                        is_unwatched(path + repo->toplen + 1))
+                        continue;
+                    if (!watch_tree(d, path, strlen(path), repo->toplen,
+                                    st.st_dev))
+                        repo->watched = 0;
+                }
+            }
+        }
+    }
+}
+
+static entry_t *
+find_entry(daemon_t *d, const char *cwd, const char *format)
+{
+    for (int i = 0; i < d->nentries; i++) {
+        entry_t *e = &d->entries[i];
+        if (strcmp(e->cwd, cwd) == 0 && strcmp(e->format, format) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/* Remember output as the answer for cwd and format. */
+static void
+add_entry(daemon_t *d, const char *cwd, const char *format, repo_t *repo,
+          unsigned int generation, const char *output)
+{
+    entry_t *e = find_entry(d, cwd, format);
+
+    if (e == NULL) {
+        if (d->nentries == MAX_ENTRIES) {
+            /* forget the oldest */
+            free(d->entries[0].cwd);
+            free(d->entries[0].format);
+            free(d->entries[0].output);
+            memmove(d->entries, d->entries + 1,
+                    (MAX_ENTRIES - 1) * sizeof(entry_t));
+            d->nentries--;
+        }
+        e = &d->entries[d->nentries];
+        e->cwd = strdup(cwd);
+        e->format = strdup(format);
+        e->output = NULL;
+        if (e->cwd == NULL || e->format == NULL) {
+            free(e->cwd);
+            free(e->format);
+            return;
+        }
+        d->nentries++;
+    }
+    free(e->output);
+    e->output = strdup(output);
+    e->repo = repo;
+    e->generation = generation;
+}
+
+/* Work out the answer for cwd from scratch, just like vcprompt does.
+ * Return it in a malloc'd string, or NULL on failure.  If it is worth
+ * caching, also set *repo and *generation.
+ */
+static char *
+compute(daemon_t *d, const char *cwd, repo_t **repo,
+        unsigned int *generation)
+{
+    vccontext_t *context;
+    char *output = NULL;
+    size_t outlen;
+    FILE *out;
+
+    *repo = NULL;
+    if ((out = open_memstream(&output, &outlen)) == NULL)
+        return NULL;
+
+    context = probe_dirs(d->contexts, NUM_CONTEXTS, cwd);
+    if (context != NULL) {
+        /* anything that changes from now on invalidates the answer */
+        read_events(d);
+        *repo = find_repo(d, context->top);
+        if (*repo == NULL)
+            *repo = add_repo(d, context->top, context->markers);
+        if (*repo != NULL) {
+            watch_stamps(d, *repo, context);
+            *generation = (*repo)->generation;
+        }
+    }
+    int partial = 0;
+    if (context != NULL) {
+        result_t *result = context->get_info(context);
+        if (result != NULL) {
+            print_result(out, context, &d->options, result);
+            partial = (result->unknown < 0 || result->modified < 0 ||
+                       result->staged < 0 ||
+                       result->ahead < 0 || result->behind < 0 ||
+                       result->stashes < 0);
+            free_result(result);
+        }
+    }
+    if (fclose(out) != 0) {
+        free(output);
+        return NULL;
+    }
+
+    /* don't remember partial answers */
+    if (partial || (d->options.timeout && timeout_remaining() == 0))
+        *repo = NULL;
+    return output;
+}
+
+/* Read a whole request from fd into buf (at most size bytes).  Return
+ * its length, or -1 on error.
+ */
+static ssize_t
+read_request(int fd, char *buf, size_t size)
+{
+    struct pollfd pfd = {fd, POLLIN, 0};
+    size_t len = 0;
+
+    while (len < size) {
+        ssize_t n;
+        if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) <= 0)
+            return -1;
+        n = read(fd, buf + len, size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            return len;
+        len += n;
+    }
+    return -1;                  /* too big */
+}
+
+/* Answer a request for cwd and format (as in a daemon request: "f"
+ * and the format, or "-"): from the cache if nothing has changed in
+ * the working copy since, else from scratch.  Return the answer in a
+ * malloc'd string, or NULL on failure.
+ */
+static char *
+answer(daemon_t *d, const char *cwd, const char *format,
+       unsigned int timeout)
+{
+    char *output;
+    repo_t *repo;
+    unsigned int generation = 0;
+
+    read_events(d);
+    entry_t *e = find_entry(d, cwd, format);
+    if (e != NULL && e->repo->watched &&
+        e->generation == e->repo->generation) {
+        debug("vcpromptd: %s: nothing changed", cwd);
+        return strdup(e->output);
+    }
+
+    d->options = *d->base;
+    d->options.format = (format[0] == 'f') ? (char *) format + 1
+                                           : DEFAULT_FORMAT;
+    d->options.timeout = timeout;
+    parse_format(&d->options);
+    set_options(&d->options);
+    output = compute(d, cwd, &repo, &generation);
+    if (output != NULL && repo != NULL)
+        add_entry(d, cwd, format, repo, generation, output);
+    return output;
+}
+
+static void
+send_reply(int fd, const char *output)
+{
+    size_t len = strlen(output);
+    while (len > 0) {
+        ssize_t n = send(fd, output, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        output += n;
+        len -= n;
+    }
+}
+
+static void
+serve(daemon_t *d, int fd)
+{
+    char request[DAEMON_MAX_REQUEST];
+    const char *cwd, *format, *timeout;
+    char *output;
+    ssize_t len;
+
+    len = read_request(fd, request, sizeof(request));
+    if (len <= 0 || request[len - 1] != '\0') {
+        debug("vcpromptd: bad request");
+        return;
+    }
+    cwd = request;
+    format = cwd + strlen(cwd) + 1;
+    if (format >= request + len)
+        return;
+    timeout = format + strlen(format) + 1;
+    if (timeout >= request + len || cwd[0] != '/' ||
+        (format[0] != 'f' && strcmp(format, "-") != 0))
+        return;
+
+    output = answer(d, cwd, format, strtoul(timeout, NULL, 10));
+    if (output == NULL)
+        return;
+    send_reply(fd, "y");
+    send_reply(fd, output);
+    free(output);
+}
+
+/* Bind the socket at path, unless another daemon is listening there. */
+static int
+listen_at(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "vcprompt: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        goto err;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "vcprompt: daemon already running on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+    mode_t mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(fd, 16) < 0)
+        goto err;
+    return fd;
+
+ err:
+    fprintf(stderr, "vcprompt: unable to listen on %s: %s\n",
+            path, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static void
+init_daemon(daemon_t *d, options_t *options)
+{
+    d->base = options;
+    d->options = *options;
+    d->inotify_fd = -1;
+    flush(d);
+    init_contexts(&d->options, d->contexts);
+}
+
+static void
+free_daemon(daemon_t *d)
+{
+    for (int i = 0; i < NUM_CONTEXTS; i++)
+        free_context(d->contexts[i]);
+    set_options(d->base);
+    flush(d);
+    close(d->inotify_fd);
+}
+
+int
+daemon_main(options_t *options)
+{
+    static daemon_t d;
+    char path[PATH_MAX];
+    int listen_fd;
+
+    if (!socket_path(path, sizeof(path))) {
+        fprintf(stderr, "vcprompt: $XDG_RUNTIME_DIR must be set "
+                "to run the daemon\n");
+        return 1;
+    }
+    if ((listen_fd = listen_at(path)) < 0)
+        return 1;
+
+    signal(SIGINT, stop_daemon);
+    signal(SIGTERM, stop_daemon);
+    init_daemon(&d, options);
+    debug("vcpromptd: listening on %s", path);
+    fflush(stdout);
+
+    while (!stopping) {
+        struct pollfd pfds[2] = {
+            {listen_fd, POLLIN, 0},
+            {d.inotify_fd, POLLIN, 0},
+        };
+        if (poll(pfds, d.inotify_fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfds[1].revents & POLLIN)
+            read_events(&d);
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                serve(&d, fd);
+                close(fd);
+            }
+        }
+        /* the debug log may well be going to a file */
+        fflush(stdout);
+    }
+
+    debug("vcpromptd: exiting");
+    unlink(path);
+    close(listen_fd);
+    free_daemon(&d);
+    return 0;
+}
+
+/* Answer one --serve-stdio request line (without its newline). */
+static void
+serve_line(daemon_t *d, char *line)
+{
+    char *tab = strchr(line, '\t');
+    const char *format = (tab != NULL) ? tab + 1 : d->base->format;
+    char *key, *output = NULL;
+
+    if (tab != NULL)
+        *tab = '\0';
+    if (*line != '\0' && (key = malloc(strlen(format) + 2)) != NULL) {
+        key[0] = 'f';
+        strcpy(key + 1, format);
+        output = answer(d, line, key, d->base->timeout);
+        free(key);
+    }
+    /* exactly one line per request, whatever happens */
+    if (output != NULL)
+        fputs(output, stdout);
+    putc('\n', stdout);
+    free(output);
+}
+
+int
+serve_stdio_main(options_t *options)
+{
+    static daemon_t d;
+    static char buf[DAEMON_MAX_REQUEST];
+    size_t len = 0;
+    int skipping = 0;           /* discarding an overlong line */
+
+    init_daemon(&d, options);
+    while (!ferror(stdout)) {
+        struct pollfd pfds[2] = {
+            {STDIN_FILENO, POLLIN, 0},
+            {d.inotify_fd, POLLIN, 0},
+        };
+        if (poll(pfds, d.inotify_fd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfds[1].revents & POLLIN)
+            read_events(&d);
+        if (!(pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        ssize_t n = read(STDIN_FILENO, buf + len, sizeof(buf) - len);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+
+        char *line = buf, *nl;
+        while ((nl = memchr(line, '\n', buf + len - line)) != NULL) {
+            *nl = '\0';
+            if (skipping)
+                skipping = 0;
+            else
+                serve_line(&d, line);
+            line = nl + 1;
+        }
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(buf)) {
+            debug("serve-stdio: request too long");
+            if (!skipping)
+                putc('\n', stdout);
+            skipping = 1;
+            len = 0;
+        }
+        fflush(stdout);
+    }
+
+    free_daemon(&d);
+    return 0;
+}
+
+/* Work out what to print in cwd for vcprompt --watch.  *result is
+ * what was found last time, if anything: when tree_only is true, only
+ * files outside the metadata have changed since then, so only the %u
+ * and %m parts of it need working out again.  On return, *top is the
+ * top of the working copy (malloc'd; NULL if there is none), and
+ * *generation and *meta_generation those of its repo_t, as of just
+ * before the metadata was read.
+ */
+static char *
+watch_update(daemon_t *d, const char *cwd, int tree_only, result_t **result,
+             char **top, unsigned int *generation,
+             unsigned int *meta_generation)
+{
+    vccontext_t *context;
+    repo_t *repo = NULL;
+    char *output = NULL;
+    size_t outlen;
+    FILE *out;
+
+    free(*top);
+    *top = NULL;
+    d->options = *d->base;
+    set_options(&d->options);
+    if ((out = open_memstream(&output, &outlen)) == NULL)
+        return NULL;
+
+    context = probe_dirs(d->contexts, NUM_CONTEXTS, cwd);
+    if (context != NULL) {
+        read_events(d);
+        if ((repo = find_repo(d, context->top)) == NULL)
+            repo = add_repo(d, context->top, context->markers);
+        if (repo != NULL)
+            watch_stamps(d, repo, context);
+    }
+    if (repo != NULL) {
+        *top = strdup(repo->top);
+        *generation = repo->generation;
+        *meta_generation = repo->meta_generation;
+    }
+
+    if (context == NULL) {
+        if (*result != NULL)
+            free_result(*result);
+        *result = NULL;
+    }
+    else if (tree_only && *result != NULL) {
+        if (d->options.show_unknown || d->options.show_modified) {
+            debug("watch: only the working tree changed");
+            d->options.show_branch = 0;
+            d->options.show_revision = 0;
+            d->options.show_patch = 0;
+            d->options.show_upstream = 0;
+            d->options.show_operation = 0;
+            d->options.show_stash = 0;
+            d->options.show_staged = 0;
+            result_t *fresh = context->get_info(context);
+            if (fresh != NULL) {
+                (*result)->unknown = fresh->unknown;
+                (*result)->modified = fresh->modified;
+                free_result(fresh);
+            }
+            d->options = *d->base;
+        }
+    }
+    else {
+        if (*result != NULL)
+            free_result(*result);
+        *result = context->get_info(context);
+    }
+    if (context != NULL && *result != NULL)
+        print_result(out, context, &d->options, *result);
+
+    if (fclose(out) != 0) {
+        free(output);
+        return NULL;
+    }
+    return output;
+}
+
+static long long
+now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/* When there is no working copy, watch cwd and every dir above it, so
+ * that we notice one being created.
+ */
+static void
+watch_ancestors(daemon_t *d, const char *cwd)
+{
+    char path[PATH_MAX];
+    char *slash;
+
+    if (d->inotify_fd < 0 || realpath(cwd, path) == NULL)
+        return;
+    while (1) {
+        add_watch(d, path);
+        if ((slash = strrchr(path, '/')) == NULL || slash == path)
+            break;
+        *slash = '\0';
+    }
+    add_watch(d, "/");
+}
+
+int
+watch_main(options_t *options)
+{
+    static daemon_t d;
+    char cwd[PATH_MAX];
+    char *last = NULL, *top = NULL;
+    result_t *result = NULL;
+    unsigned int generation = 0, meta_generation = 0, nevents;
+    int tree_only = 0;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("vcprompt: getcwd");
+        return 1;
+    }
+    signal(SIGINT, stop_daemon);
+    signal(SIGTERM, stop_daemon);
+    init_daemon(&d, options);
+
+    while (!stopping) {
+        char *output = watch_update(&d, cwd, tree_only, &result, &top,
+                                    &generation, &meta_generation);
+        if (top == NULL)
+            watch_ancestors(&d, cwd);
+        nevents = d.nevents;
+        if (output != NULL && (last == NULL || strcmp(output, last) != 0)) {
+            fputs(output, stdout);
+            putc('\n', stdout);
+            if (fflush(stdout) != 0) {
+                free(output);
+                break;
+            }
+            free(last);
+            last = output;
+        }
+        else {
+            free(output);
+        }
+
+        /* Wait for something that might change the output, then for
+           things to settle down: a checkout or a build touches many
+           files in a row. */
+        long long first = -1;   /* when the first change came */
+        int timeout = -1;
+        repo_t *repo = NULL;
+        while (!stopping) {
+            struct pollfd pfd = {d.inotify_fd, POLLIN, 0};
+            if (d.inotify_fd < 0) {
+                /* no inotify: fall back to polling */
+                poll(NULL, 0, WATCH_MAX_DELAY_MS);
+                repo = NULL;
+                break;
+            }
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0 && errno != EINTR)
+                break;
+            if (ready > 0)
+                read_events(&d);
+            repo = (top != NULL) ? find_repo(&d, top) : NULL;
+            int changed = (repo != NULL) ? repo->generation != generation
+                                         : d.nevents != nevents;
+            if (first < 0) {
+                if (changed) {
+                    first = now_ms();
+                    timeout = WATCH_DEBOUNCE_MS;
+                }
+                continue;
+            }
+            /* debouncing: stop at the first quiet spell, or after
+               WATCH_MAX_DELAY_MS in all */
+            if (ready == 0 || now_ms() - first >= WATCH_MAX_DELAY_MS)
+                break;
+        }
+        tree_only = (repo != NULL && repo->meta_generation == meta_generation);
+    }
+
+    free(last);
+    free(top);
+    if (result != NULL)
+        free_result(result);
+    free_daemon(&d);
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <limits.h>
+
+#include "common.h"
+
+/* vcpromptd listens on a Unix socket with this name in
+ * $XDG_RUNTIME_DIR.
+ *
+ * A request is three NUL-terminated fields, followed by EOF (the
+ * client shuts down its side of the connection):
+ *
+ *   - the client's current dir (absolute)
+ *   - "f" followed by the format string, or "-" for the default
+ *     format (what vcprompt would print without -f or
+ *     $VCPROMPT_FORMAT)
+ *   - the timeout in milliseconds, in decimal ("0" for none)
+ *
+ * The reply is "y" followed by exactly what vcprompt would print, and
+ * then EOF.  Anything else (including no reply at all) means the
+ * client should do the work itself.
+ */
+#define DAEMON_SOCKET "vcprompt.sock"
+
+/* longest request we accept */
+#define DAEMON_MAX_REQUEST (PATH_MAX + 8192)
+
+/* how long vcprompt-client waits for the whole reply when there is no
+ * -t timeout, before running vcprompt itself: the daemon answers one
+ * request at a time, so one slow working copy must not hold up every
+ * prompt */
+#define DAEMON_REPLY_WAIT_MS 300
+
+/* Run vcpromptd in the foreground until killed: answer requests on
+ * the socket, caching the answer for each dir and format until
+ * inotify reports a change anywhere in the working copy.  options
+ * supplies everything but the format and timeout (e.g. debug mode).
+ * Return the exit status for main().
+ */
+int
+daemon_main(options_t *options);
+
+/* Run vcprompt --serve-stdio until stdin runs out: for each line
+ * "<dir>\t<format>" (or just "<dir>", for the -f format) on stdin,
+ * print one line with what vcprompt would print in dir, keeping
+ * contexts and answers between requests just like vcpromptd.
+ * Return the exit status for main().
+ */
+int
+serve_stdio_main(options_t *options);
+
+/* Run vcprompt --watch until killed: print what vcprompt would print
+ * in the current dir, and then a new line each time that changes, as
+ * inotify reports changes to the working copy.  Return the exit
+ * status for main().
+ */
+int
+watch_main(options_t *options);
+
+#endif
@@ -17,9 +17,9 @@
 #include "capture.h"
 
 static int
-fossil_probe(vccontext_t *context)
+fossil_probe(vccontext_t *context, int dirfd)
 {
-    return isfile("_FOSSIL_") || isfile(".fslckout");
+    return isfile_at(dirfd, "_FOSSIL_") || isfile_at(dirfd, ".fslckout");
 }
 
 static result_t*
@@ -36,9 +36,27 @@ fossil_get_info(vccontext_t *context)
     // several lines long) plus eventual output indicating changes in
     // the repo.
     char *argv[] = {"fossil", "status", NULL};
-    capture_t *capture = capture_child("fossil", argv);
+
+    // Unknown files can't be read from 'fossil status' output: run
+    // 'fossil extra' alongside it, if needed (and there is time).
+    // 'fossil status' gives the branch too, so it gets no budget of
+    // its own.
+    char *extra_argv[] = {"fossil", "extra", NULL};
+    int extra_budget = budget_remaining('u');
+    capture_opts_t status_opts = {0, NULL, NULL, 0, context->top};
+    capture_opts_t extra_opts = {
+        1, NULL, NULL, extra_budget > 0 ? extra_budget : 0, context->top};
+    capture_job_t jobs[] = {
+        {"fossil", argv, &status_opts, NULL},
+        {"fossil", extra_argv, &extra_opts, NULL},
+    };
+    int run_extra = context->options->show_unknown && extra_budget != 0;
+    capture_children(jobs, run_extra ? 2 : 1);
+    capture_t *capture = jobs[0].result;
     if (capture == NULL) {
         debug("unable to execute 'fossil status'");
+        free_capture(jobs[1].result);
+        free_result(result);
         return NULL;
     }
     char *cstdout = capture->childout.buf;
@@ -86,15 +104,18 @@ fossil_get_info(vccontext_t *context)
     cstdout = NULL;
     free_capture(capture);
 
-    if (context->options->show_unknown) {
-        // This can't be read from 'fossil status' output
-        char *argv[] = {"fossil", "extra", NULL};
-        capture = capture_child("fossil", argv);
+    if (context->options->show_unknown && !run_extra) {
+        result->unknown = -1;
+    }
+    else if (context->options->show_unknown) {
+        capture = jobs[1].result;
         if (capture == NULL) {
             debug("unable to execute 'fossil extra'");
+            free_result(result);
             return NULL;
         }
-        result->unknown = (capture->childout.len > 0);
+        result->unknown = capture->timedout ? -1
+                                            : (capture->childout.len > 0);
         free_capture(capture);
     }
 
@@ -104,5 +125,8 @@ fossil_get_info(vccontext_t *context)
 vccontext_t*
 get_fossil_context(options_t *options)
 {
-    return init_context("fossil", options, fossil_probe, fossil_get_info);
+    /* the checkout db is both the marker and all the metadata */
+    static const char *const markers[] = {"_FOSSIL_", ".fslckout", NULL};
+    return init_context("fossil", options, markers, markers,
+                        fossil_probe, fossil_get_info);
 }
@@ -0,0 +1,408 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "common.h"
+#include "fsmonitor.h"
+
+/* how long to wait for fsmonitor--daemon before giving up on it */
+#define IPC_TIMEOUT_MS 1000
+
+/* how long a hook may run, if the budgets of %m and %u allow */
+#define HOOK_TIMEOUT_MS 1000
+
+/* largest payload of a pkt-line */
+#define PKT_MAX (65520 - 4)
+
+/* Run the hook as "hook <version> <token>" from the top of the working
+ * dir, like git does (minus the shell).  Its answer is only worth
+ * waiting for while %m or %u still has time left, and never for more
+ * than HOOK_TIMEOUT_MS: a hook that hangs must not hang the prompt.
+ */
+static int
+hook_query(const gitrepo_t *repo, const char *setting, int version,
+           const char *token, char **out, size_t *outlen)
+{
+    char vbuf[16];
+    char *argv[] = {(char *) setting, vbuf, (char *) token, NULL};
+    capture_opts_t opts = {0, NULL, NULL, HOOK_TIMEOUT_MS, repo->worktree};
+    capture_t *capture;
+    int mbudget = budget_remaining('m');
+    int ubudget = budget_remaining('u');
+    int budget = (mbudget < 0 || ubudget < 0) ? -1
+        : (mbudget > ubudget) ? mbudget : ubudget;
+
+    if (budget == 0) {
+        debug("no time left to run the fsmonitor hook");
+        return 0;
+    }
+    if (budget > 0 && budget < HOOK_TIMEOUT_MS)
+        opts.timeout = budget;
+
+    snprintf(vbuf, sizeof(vbuf), "%d", version);
+    capture = capture_child_opts(setting, argv, &opts);
+    if (capture != NULL && capture->timedout)
+        debug("fsmonitor hook timed out after %u ms", opts.timeout);
+    if (capture == NULL || capture->timedout ||
+        capture->status != 0 || capture->signal != 0) {
+        free_capture(capture);
+        return 0;
+    }
+    *out = capture->childout.buf;
+    *outlen = capture->childout.len;
+    capture->childout.buf = NULL;
+    free_capture(capture);
+    return 1;
+}
+
+const fsmonitor_provider_t fsmonitor_hook = {"hook", hook_query};
+
+/* Transfer exactly len bytes to/from fd, waiting at most
+ * IPC_TIMEOUT_MS for each chunk.
+ */
+static int
+ipc_transfer(int fd, char *buf, size_t len, int writing)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = writing ? POLLOUT : POLLIN;
+    while (len > 0) {
+        ssize_t n;
+        if (poll(&pfd, 1, IPC_TIMEOUT_MS) <= 0) {
+            debug("fsmonitor--daemon: timeout");
+            return 0;
+        }
+        n = writing ? write(fd, buf, len) : read(fd, buf, len);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n <= 0) {
+            debug("fsmonitor--daemon: %s",
+                  n < 0 ? strerror(errno) : "unexpected EOF");
+            return 0;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* Send the token as a pkt-line message and read the reply up to the
+ * next flush packet: the same protocol as git's simple-ipc.
+ */
+static int
+ipc_query(const gitrepo_t *repo, const char *setting, int version,
+          const char *token, char **out, size_t *outlen)
+{
+    struct sockaddr_un addr;
+    char hdr[5];
+    char *buf = NULL;
+    size_t len = 0, alloc = 0;
+    size_t tokenlen = strlen(token);
+    int fd;
+
+    (void) setting;
+    if (version != 2)
+        return 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path),
+                 "%s%s%s/fsmonitor--daemon.ipc",
+                 repo->gitdir[0] == '/' ? "" : repo->worktree,
+                 repo->gitdir[0] == '/' ? "" : "/", repo->gitdir)
+        >= (int) sizeof(addr.sun_path))
+        return 0;
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return 0;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        debug("unable to connect to %s: %s", addr.sun_path, strerror(errno));
+        goto err;
+    }
+
+    for (size_t sent = 0; sent < tokenlen; ) {
+        size_t n = tokenlen - sent > PKT_MAX ? PKT_MAX : tokenlen - sent;
+        snprintf(hdr, sizeof(hdr), "%04x", (unsigned int) n + 4);
+        if (!ipc_transfer(fd, hdr, 4, 1) ||
+            !ipc_transfer(fd, (char *) token + sent, n, 1))
+            goto err;
+        sent += n;
+    }
+    if (!ipc_transfer(fd, "0000", 4, 1))
+        goto err;
+
+    for (;;) {
+        unsigned int pktlen;
+        if (!ipc_transfer(fd, hdr, 4, 0))
+            goto err;
+        hdr[4] = '\0';
+        if (sscanf(hdr, "%4x", &pktlen) != 1 ||
+            (pktlen != 0 && pktlen < 4)) {
+            debug("fsmonitor--daemon: bad pkt-line header");
+            goto err;
+        }
+        if (pktlen == 0)                /* flush */
+            break;
+        pktlen -= 4;
+        if (len + pktlen + 1 > alloc) {
+            alloc = (len + pktlen + 1) * 2;
+            char *p = realloc(buf, alloc);
+            if (p == NULL)
+                goto err;
+            buf = p;
+        }
+        if (!ipc_transfer(fd, buf + len, pktlen, 0))
+            goto err;
+        len += pktlen;
+    }
+    if (buf == NULL && (buf = malloc(1)) == NULL)
+        goto err;
+    buf[len] = '\0';
+    close(fd);
+    *out = buf;
+    *outlen = len;
+    return 1;
+
+ err:
+    close(fd);
+    free(buf);
+    return 0;
+}
+
+const fsmonitor_provider_t fsmonitor_ipc = {"fsmonitor--daemon", ipc_query};
+
+/* Read the FSMN extension of index: the token and the bitmap of
+ * entries that were not known to be clean.
+ */
+static int
+read_extension(fsmonitor_t *fsm, gitindex_t *index, char *token, int size,
+               int *version)
+{
+    const unsigned char *p, *end;
+    size_t extsize;
+
+    p = gitindex_extension(index, "FSMN", &extsize);
+    if (p == NULL) {
+        debug("index has no fsmonitor token");
+        return 0;
+    }
+    end = p + extsize;
+    if (extsize < 8)
+        goto corrupt;
+    *version = get_be32(p);
+    p += 4;
+    if (*version == 1) {
+        if (end - p < 8)
+            goto corrupt;
+        snprintf(token, size, "%" PRIu64, (uint64_t) get_be64(p));
+        p += 8;
+    }
+    else if (*version == 2) {
+        const unsigned char *nul = memchr(p, '\0', end - p);
+        if (nul == NULL || nul - p >= size)
+            goto corrupt;
+        memcpy(token, p, nul - p + 1);
+        p = nul + 1;
+    }
+    else {
+        debug("unsupported fsmonitor extension version %d", *version);
+        return 0;
+    }
+
+    if (end - p < 4)
+        goto corrupt;
+    size_t ewahsize = get_be32(p);
+    p += 4;
+    if (ewahsize > (size_t) (end - p))
+        goto corrupt;
+    fsm->nentries = index->nentries;
+    fsm->dirty = calloc(index->nentries + 1, 1);
+    if (fsm->dirty == NULL ||
+        !gitindex_read_ewah(&p, p + ewahsize, fsm->dirty, fsm->nentries))
+        goto corrupt;
+    return 1;
+
+ corrupt:
+    debug("fsmonitor extension is corrupt");
+    return 0;
+}
+
+static int
+cmp_paths(const void *a, const void *b)
+{
+    return strcmp(*(const char **) a, *(const char **) b);
+}
+
+/* Parse the NUL-separated paths in buf (len bytes).  Take ownership of
+ * buf.
+ */
+static int
+parse_paths(fsmonitor_t *fsm, char *buf, size_t len)
+{
+    size_t i, n = 0;
+    char *p;
+
+    fsm->buf = buf;
+    for (i = 0; i < len; i++) {
+        if (buf[i] == '\0')
+            n++;
+    }
+    fsm->paths = malloc((n + 1) * sizeof(char *));
+    if (fsm->paths == NULL)
+        return 0;
+    for (p = buf; p < buf + len; p += strlen(p) + 1) {
+        size_t plen = strlen(p);
+        if (plen == 0)
+            continue;
+        if (strcmp(p, "/") == 0) {
+            /* "trivial response": assume everything changed */
+            fsm->trivial = 1;
+            continue;
+        }
+        if (p[plen - 1] == '/')
+            p[plen - 1] = '\0';
+        fsm->paths[fsm->npaths++] = p;
+    }
+    qsort(fsm->paths, fsm->npaths, sizeof(char *), cmp_paths);
+    return 1;
+}
+
+int
+fsmonitor_open(fsmonitor_t *fsm, const gitrepo_t *repo, gitindex_t *index)
+{
+    const fsmonitor_provider_t *provider;
+    char setting[PATH_MAX];
+    char token[1024];
+    char *out = NULL;
+    size_t outlen = 0;
+    int version;
+
+    memset(fsm, 0, sizeof(*fsm));
+    if (!gitrepo_config(repo, "core.fsmonitor", setting, sizeof(setting)) ||
+        setting[0] == '\0')
+        return 0;
+    if (strcasecmp(setting, "false") == 0 || strcasecmp(setting, "no") == 0 ||
+        strcasecmp(setting, "off") == 0 || strcmp(setting, "0") == 0)
+        return 0;
+    if (gitrepo_config_bool(setting))
+        provider = &fsmonitor_ipc;
+    else
+        provider = &fsmonitor_hook;
+
+    if (!read_extension(fsm, index, token, sizeof(token), &version))
+        goto err;
+    debug("asking %s for changes since '%s'", provider->name, token);
+    if (!provider->query(repo, setting, version, token, &out, &outlen)) {
+        debug("%s query failed", provider->name);
+        goto err;
+    }
+
+    /* version 2 responses start with the new token */
+    if (version == 2) {
+        size_t skip = strnlen(out, outlen);
+        if (skip == outlen) {
+            debug("%s: response has no token", provider->name);
+            free(out);
+            goto err;
+        }
+        memmove(out, out + skip + 1, outlen - skip);
+        outlen -= skip + 1;
+    }
+    if (!parse_paths(fsm, out, outlen))
+        goto err;
+    debug("%s reported %u changed paths%s", provider->name,
+          fsm->npaths, fsm->trivial ? " (and maybe everything else)" : "");
+    return 1;
+
+ err:
+    fsmonitor_free(fsm);
+    return 0;
+}
+
+void
+fsmonitor_free(fsmonitor_t *fsm)
+{
+    free(fsm->paths);
+    free(fsm->buf);
+    free(fsm->dirty);
+    memset(fsm, 0, sizeof(*fsm));
+}
+
+/* Is the first len chars of path one of the changed paths? */
+static int
+path_changed(const fsmonitor_t *fsm, const char *path, size_t len)
+{
+    unsigned int lo = 0, hi = fsm->npaths;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        const char *p = fsm->paths[mid];
+        int cmp = strncmp(p, path, len);
+        if (cmp == 0)
+            cmp = (p[len] != '\0');
+        if (cmp == 0)
+            return 1;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return 0;
+}
+
+int
+fsmonitor_entry_changed(const fsmonitor_t *fsm, unsigned int pos,
+                        const char *name, size_t len)
+{
+    size_t i;
+
+    if (fsm->trivial || pos >= fsm->nentries || fsm->dirty[pos])
+        return 1;
+    if (path_changed(fsm, name, len))
+        return 1;
+    /* a changed directory (e.g. renamed) affects everything below it */
+    for (i = 0; i < len; i++) {
+        if (name[i] == '/' && path_changed(fsm, name, i))
+            return 1;
+    }
+    return 0;
+}
+
+int
+fsmonitor_dir_changed(const fsmonitor_t *fsm, const char *dir, size_t len)
+{
+    unsigned int lo = 0, hi = fsm->npaths;
+
+    if (fsm->trivial || (len == 0 && fsm->npaths > 0))
+        return 1;
+    if (len == 0)
+        return 0;
+    if (path_changed(fsm, dir, len - 1))
+        return 1;
+
+    /* first path at or after "dir/": does it start with "dir/"? */
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (strncmp(fsm->paths[mid], dir, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < fsm->npaths && strncmp(fsm->paths[lo], dir, len) == 0);
+}
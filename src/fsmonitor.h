@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+#include "gitindex.h"
+#include "gitrepo.h"
+
+/* Support for git's filesystem monitor integration (core.fsmonitor).
+ * The index records a token for the last time it was brought up to
+ * date (the "FSMN" extension), plus which entries were not known to be
+ * clean at that time.  The monitor tells us which paths changed since
+ * that token; every other entry is still clean, and every untracked
+ * cache directory with no changes below it is still valid.
+ */
+
+/* A source of changes: either a hook program (core.fsmonitor is a
+ * path) or git's builtin fsmonitor--daemon (core.fsmonitor=true).
+ * query() asks what changed since token and returns the response in
+ * *out (malloc()ed, *outlen bytes plus a terminating NUL): a new token
+ * (if version is 2) and changed paths, all NUL-separated.  Return 1 on
+ * success, 0 on error.
+ */
+typedef struct {
+    const char *name;
+    int (*query)(const gitrepo_t *repo, const char *setting, int version,
+                 const char *token, char **out, size_t *outlen);
+} fsmonitor_provider_t;
+
+extern const fsmonitor_provider_t fsmonitor_hook;
+extern const fsmonitor_provider_t fsmonitor_ipc;
+
+typedef struct {
+    int trivial;                        /* everything may have changed */
+    const char **paths;                 /* sorted, without trailing '/' */
+    unsigned int npaths;
+    char *buf;                          /* storage for paths */
+    unsigned char *dirty;               /* per entry: not known clean */
+    unsigned int nentries;
+} fsmonitor_t;
+
+/* If core.fsmonitor is set and index has a token, ask the monitor what
+ * changed since then.  Return 1 if fsm can be used, 0 if not (with
+ * debug() messages).  Caller must call fsmonitor_free().
+ */
+int
+fsmonitor_open(fsmonitor_t *fsm, const gitrepo_t *repo, gitindex_t *index);
+
+void
+fsmonitor_free(fsmonitor_t *fsm);
+
+/* Might index entry number pos (path name, len chars) have changed? */
+int
+fsmonitor_entry_changed(const fsmonitor_t *fsm, unsigned int pos,
+                        const char *name, size_t len);
+
+/* Might anything in directory dir (len chars: "" for the top, else
+ * with a trailing slash) or below it have changed?
+ */
+int
+fsmonitor_dir_changed(const fsmonitor_t *fsm, const char *dir, size_t len);
+
+#endif
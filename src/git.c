@@ -7,81 +7,740 @@
  * (at your option) any later version.
  */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "git.h"
 #include "capture.h"
 #include "common.h"
+#include "fsmonitor.h"
+#include "gitgraph.h"
+#include "gitindex.h"
+#include "gitodb.h"
+#include "gitrefs.h"
+#include "gitrepo.h"
+#include "gitwalk.h"
 
 
 static int
-git_probe(vccontext_t *context)
+git_probe(vccontext_t *context, int dirfd)
 {
-    return isdir(".git");
+    return gitrepo_probe(dirfd);
+}
+
+/* Compare the stat() info of one index entry against the working tree,
+ * the same way git's ie_match_stat() does.  Return 1 if the file is
+ * definitely modified, 0 if it is definitely clean, and -1 if we
+ * cannot tell without comparing file contents.
+ */
+static int
+git_entry_modified(const gitindex_t *index, const gitindex_entry_t *entry,
+                   int wtfd)
+{
+    struct stat st;
+
+    if (entry->flags & GITINDEX_STAGEMASK) {
+        debug("%s: unmerged", entry->name);
+        return 1;
+    }
+    if (entry->flags & (GITINDEX_ASSUME_VALID | GITINDEX_SKIP_WORKTREE))
+        return 0;
+    if (entry->flags & GITINDEX_INTENT_TO_ADD) {
+        debug("%s: intent to add", entry->name);
+        return 1;
+    }
+
+    if (fstatat(wtfd, entry->name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            debug("%s: deleted", entry->name);
+            return 1;
+        }
+        return -1;
+    }
+
+    switch (entry->mode & S_IFMT) {
+    case GITINDEX_S_IFGITLINK:
+        /* an empty directory is a submodule that isn't checked out;
+           anything else means comparing the submodule's HEAD */
+        if (!S_ISDIR(st.st_mode))
+            return 1;
+        else {
+            char gitfile[PATH_MAX];
+            snprintf(gitfile, sizeof(gitfile), "%s/.git", entry->name);
+            return (fstatat(wtfd, gitfile, &st, AT_SYMLINK_NOFOLLOW) < 0
+                    && errno == ENOENT) ? 0 : -1;
+        }
+    case S_IFLNK:
+        if (S_ISLNK(st.st_mode))
+            break;
+        /* core.symlinks = false checks out symlinks as plain files */
+        return S_ISREG(st.st_mode) ? -1 : 1;
+    default:
+        if (!S_ISREG(st.st_mode)) {
+            debug("%s: type changed", entry->name);
+            return 1;
+        }
+        /* might be ignored by core.fileMode = false */
+        if ((entry->mode ^ st.st_mode) & S_IXUSR)
+            return -1;
+    }
+
+    if (entry->size != (unsigned int) st.st_size) {
+        /* git zeroes the size of racily clean entries to force a
+           content check, so only a non-zero size is conclusive */
+        if (entry->size == 0)
+            return -1;
+        debug("%s: size changed", entry->name);
+        return 1;
+    }
+
+    if (entry->mtime_sec != (unsigned int) st.st_mtim.tv_sec ||
+        entry->ctime_sec != (unsigned int) st.st_ctim.tv_sec ||
+        (entry->mtime_nsec &&
+         entry->mtime_nsec != (unsigned int) st.st_mtim.tv_nsec) ||
+        (entry->ctime_nsec &&
+         entry->ctime_nsec != (unsigned int) st.st_ctim.tv_nsec) ||
+        entry->ino != (unsigned int) st.st_ino ||
+        entry->uid != (unsigned int) st.st_uid ||
+        entry->gid != (unsigned int) st.st_gid)
+        return -1;
+
+    /* Racily clean: the file was modified in the same timestamp
+       granule as the index was written, so a matching stat() says
+       nothing about its contents. */
+    if (entry->mtime_sec > (unsigned int) index->st.st_mtim.tv_sec ||
+        (entry->mtime_sec == (unsigned int) index->st.st_mtim.tv_sec &&
+         entry->mtime_nsec >= (unsigned int) index->st.st_mtim.tv_nsec))
+        return -1;
+
+    return 0;
+}
+
+/* Look for uncommitted changes in the working tree (open on wtfd) by
+ * comparing it against the stat() info cached in index, stopping at the first
+ * modified file.  If fsm is not NULL, only entries that the filesystem
+ * monitor says might have changed are checked.  Return 1 if something
+ * is modified, 0 if nothing is, and -1 if some file might be modified,
+ * the index is corrupt, or we ran out of time (in which case only "git
+ * diff" knows for sure, if it still has time).
+ */
+static int
+git_index_modified(const gitindex_t *index, const fsmonitor_t *fsm, int wtfd)
+{
+    gitindex_iter_t iter;
+    gitindex_entry_t entry;
+    int ambiguous = 0;
+    int modified = 0;
+    int ok;
+
+    gitindex_iter_init(&iter, index);
+    while ((ok = gitindex_next(&iter, &entry)) > 0) {
+        if (iter.pos % 1024 == 0 && budget_remaining('m') == 0) {
+            debug("timed out checking the index for modified files");
+            return -1;
+        }
+        if (fsm != NULL &&
+            !(entry.flags & (GITINDEX_STAGEMASK | GITINDEX_INTENT_TO_ADD)) &&
+            !fsmonitor_entry_changed(fsm, iter.pos - 1,
+                                     entry.name, entry.namelen))
+            continue;
+        int changed = git_entry_modified(index, &entry, wtfd);
+        if (changed > 0) {
+            modified = 1;
+            break;
+        }
+        if (changed < 0 && !ambiguous) {
+            debug("%s: stat info changed, need to check contents",
+                  entry.name);
+            ambiguous = 1;
+        }
+    }
+
+    if (modified)
+        return 1;
+    if (ok < 0 || ambiguous)
+        return -1;
+    return 0;
+}
+
+/* The repo opened by the last git_get_info() on a context, and what
+ * .git looked like then.  A .git dir stays the same repo for as long
+ * as it exists; a .git file may be rewritten to point elsewhere.
+ */
+typedef struct {
+    gitrepo_t repo;
+    char top[PATH_MAX];
+    struct stat st;
+} git_state_t;
+
+static void
+git_free_state(void *state)
+{
+    git_state_t *s = state;
+    gitrepo_close(&s->repo);
+    free(s);
+}
+
+/* Return the repo of the working copy that context claimed: the one
+ * kept in context->state, if it is for the same .git, else a freshly
+ * opened one that is kept there instead.  NULL if it cannot be opened.
+ */
+static gitrepo_t*
+git_open_repo(vccontext_t *context)
+{
+    git_state_t *s = context->state;
+    struct stat st;
+
+    if (fstatat(context->dirfd, ".git", &st, 0) < 0)
+        return NULL;
+    if (s != NULL && strcmp(s->top, context->top) == 0 &&
+        s->st.st_dev == st.st_dev && s->st.st_ino == st.st_ino &&
+        (S_ISDIR(st.st_mode) ||
+         (s->st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+          s->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec &&
+          s->st.st_size == st.st_size))) {
+        debug("reusing git dir from last time");
+        s->repo.worktree = context->top;
+        return &s->repo;
+    }
+
+    if (s != NULL) {
+        git_free_state(s);
+        context->state = NULL;
+    }
+    if (strlen(context->top) >= sizeof(s->top) ||
+        (s = malloc(sizeof(git_state_t))) == NULL)
+        return NULL;
+    if (!gitrepo_open(&s->repo, context->dirfd, context->top)) {
+        free(s);
+        return NULL;
+    }
+    strcpy(s->top, context->top);
+    s->st = st;
+    context->state = s;
+    context->free_state = git_free_state;
+    return &s->repo;
+}
+
+/* How many hex digits of oid to show: the shortest unique prefix,
+ * with core.abbrev as the minimum, just like "git rev-parse --short".
+ */
+static int
+git_abbrev_len(const gitrepo_t *repo, const char *oid)
+{
+    char value[32];
+    int minlen = -1;                    /* "auto" */
+
+    if (gitrepo_config(repo, "core.abbrev", value, sizeof(value)) &&
+        strcasecmp(value, "auto") != 0) {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (*end != '\0' || end == value) {
+            if (!gitrepo_config_bool(value))
+                return 2 * repo->hashlen;   /* core.abbrev=no */
+        }
+        else if (n >= 2 * repo->hashlen)
+            return 2 * repo->hashlen;
+        else if (n >= GITODB_MINIMUM_ABBREV)
+            minlen = n;
+    }
+    return gitodb_abbrev_len(repo, oid, minlen);
+}
+
+/* Map ref through refspec, a fetch refspec of a remote such as
+ * "+refs/heads/<glob>:refs/remotes/origin/<glob>" (with "*" for
+ * <glob>), to the remote-tracking ref it is fetched to, in dest (up
+ * to size-1 chars).  Return 1 on success, 0 if refspec does not
+ * cover ref.
+ */
+static int
+git_map_refspec(const char *refspec, const char *ref, char *dest, int size)
+{
+    char src[GITREFS_MAXNAME];
+    const char *colon, *dst, *star, *dststar;
+    size_t prefixlen, suffixlen, reflen = strlen(ref);
+
+    if (*refspec == '+')
+        refspec++;
+    if ((colon = strchr(refspec, ':')) == NULL ||
+        colon - refspec >= (int) sizeof(src))
+        return 0;
+    memcpy(src, refspec, colon - refspec);
+    src[colon - refspec] = '\0';
+    dst = colon + 1;
+
+    if ((star = strchr(src, '*')) == NULL)
+        return (strcmp(src, ref) == 0 &&
+                snprintf(dest, size, "%s", dst) < size);
+    prefixlen = star - src;
+    suffixlen = strlen(star + 1);
+    if ((dststar = strchr(dst, '*')) == NULL ||
+        reflen < prefixlen + suffixlen ||
+        strncmp(ref, src, prefixlen) != 0 ||
+        strcmp(ref + reflen - suffixlen, star + 1) != 0)
+        return 0;
+    return snprintf(dest, size, "%.*s%.*s%s",
+                    (int) (dststar - dst), dst,
+                    (int) (reflen - prefixlen - suffixlen), ref + prefixlen,
+                    dststar + 1) < size;
+}
+
+/* For git_upstream_ref(): look for the first fetch refspec of a
+ * remote that covers a ref.
+ */
+typedef struct {
+    const char *ref;
+    char *dest;                 /* GITREFS_MAXNAME chars */
+    int nrefspecs;
+} upstream_map_t;
+
+static int
+git_map_fetch(const char *refspec, void *arg)
+{
+    upstream_map_t *map = arg;
+    map->nrefspecs++;
+    return git_map_refspec(refspec, map->ref, map->dest, GITREFS_MAXNAME);
+}
+
+/* Work out the ref that branch is set to track, the way "git rev-parse
+ * @{upstream}" does: from branch.<name>.remote and branch.<name>.merge,
+ * through the first of the remote's fetch refspecs that covers it.
+ * Copy it to upstream, which must hold GITREFS_MAXNAME chars, and
+ * return 1; return 0 if there is no upstream.
+ */
+static int
+git_upstream_ref(const gitrepo_t *repo, const char *branch, char *upstream)
+{
+    char key[GITREFS_MAXNAME + 32];
+    char remote[256], merge[GITREFS_MAXNAME], refspec[GITREFS_MAXNAME];
+    upstream_map_t map = {NULL, upstream, 0};
+
+    snprintf(key, sizeof(key), "branch.%s.remote", branch);
+    if (!gitrepo_config(repo, key, remote, sizeof(remote)))
+        return 0;
+    snprintf(key, sizeof(key), "branch.%s.merge", branch);
+    if (!gitrepo_config(repo, key, merge, sizeof(merge)))
+        return 0;
+
+    /* "." is the repository itself: the upstream is a local branch */
+    if (strcmp(remote, ".") == 0) {
+        strcpy(upstream, merge);
+        return 1;
+    }
+    snprintf(key, sizeof(key), "remote.%s.fetch", remote);
+    map.ref = merge;
+    if (gitrepo_config_each(repo, key, git_map_fetch, &map))
+        return 1;
+    if (map.nrefspecs == 0) {
+        snprintf(refspec, sizeof(refspec),
+                 "+refs/heads/*:refs/remotes/%s/*", remote);
+        if (git_map_refspec(refspec, merge, upstream, GITREFS_MAXNAME))
+            return 1;
+    }
+    debug("upstream %s of %s is not fetched by remote %s",
+          merge, branch, remote);
+    return 0;
+}
+
+/* Count the commits on branch (at oid) and on its upstream that the
+ * other lacks, into result->ahead and result->behind: from the
+ * commit-graph if it has both commits, else by running "git rev-list".
+ */
+static void
+git_ahead_behind(vccontext_t *context, const gitrepo_t *repo,
+                 const char *branch, const char *oid, result_t *result)
+{
+    char upstream[GITREFS_MAXNAME];
+    char upstream_oid[GIT_MAX_HEXSZ + 1];
+    char range[2 * GIT_MAX_HEXSZ + 4];
+    gitgraph_t graph;
+    int status = 0;
+
+    if (!git_upstream_ref(repo, branch, upstream) ||
+        gitrefs_resolve(repo, upstream, upstream_oid, NULL) <= 0) {
+        debug("branch '%s' has no upstream", branch);
+        return;
+    }
+    debug("upstream of '%s' is %s", branch, upstream);
+    if (strcmp(oid, upstream_oid) == 0)
+        return;
+
+    if (gitgraph_open(&graph, repo)) {
+        status = gitgraph_ahead_behind(&graph, oid, upstream_oid,
+                                       &result->ahead, &result->behind);
+        gitgraph_close(&graph);
+    }
+    if (status < 0) {
+        result->ahead = result->behind = -1;
+        return;
+    }
+    if (status > 0)
+        return;
+
+    /* prints "<ahead>\t<behind>" */
+    snprintf(range, sizeof(range), "%s...%s", oid, upstream_oid);
+    char *argv[] = {
+        "git", "rev-list", "--count", "--left-right", range, NULL};
+    capture_opts_t opts = {0, NULL, NULL, 0, context->top};
+    capture_t *capture = capture_child_opts("git", argv, &opts);
+    result->ahead = result->behind = 0;
+    if (capture != NULL && capture->timedout)
+        result->ahead = result->behind = -1;
+    else if (capture != NULL && capture->status == 0 &&
+             sscanf(capture->childout.buf, "%d %d",
+                    &result->ahead, &result->behind) != 2)
+        result->ahead = result->behind = 0;
+    free_capture(capture);
+}
+
+/* The files that tell which operation is in progress in a git dir,
+ * the same ones git's own prompt (contrib/completion/git-prompt.sh)
+ * looks at: git_operation() checks them all at once.
+ */
+#define OP_REBASE_MERGE  0x001
+#define OP_REBASE_APPLY  0x002
+#define OP_REBASING      0x004
+#define OP_APPLYING      0x008
+#define OP_MERGE         0x010
+#define OP_CHERRY_PICK   0x020
+#define OP_REVERT        0x040
+#define OP_SEQUENCER     0x080
+#define OP_BISECT        0x100
+
+static const struct {
+    const char *name;
+    int flag;
+} git_op_files[] = {
+    {"rebase-merge", OP_REBASE_MERGE},
+    {"rebase-apply", OP_REBASE_APPLY},
+    {"rebase-apply/rebasing", OP_REBASING},
+    {"rebase-apply/applying", OP_APPLYING},
+    {"MERGE_HEAD", OP_MERGE},
+    {"CHERRY_PICK_HEAD", OP_CHERRY_PICK},
+    {"REVERT_HEAD", OP_REVERT},
+    {"sequencer/todo", OP_SEQUENCER},
+    {"BISECT_LOG", OP_BISECT},
+};
+
+/* Set result->operation to the operation in progress, if any, named
+ * like git's prompt does: "REBASE", "AM", "AM/REBASE", "MERGING",
+ * "CHERRY-PICKING", "REVERTING" or "BISECTING", followed by the
+ * progress of a rebase or am, e.g. "REBASE 2/5".
+ */
+static void
+git_operation(const gitrepo_t *repo, result_t *result)
+{
+    const char *operation = NULL;
+    const char *stepfile = NULL, *totalfile = NULL;
+    char step[32], total[32], todo[32];
+    char buf[sizeof(step) + sizeof(total) + 32];
+    struct stat st;
+    int found = 0;
+
+    for (size_t i = 0; i < sizeof(git_op_files) / sizeof(git_op_files[0]);
+         i++) {
+        if (fstatat(repo->gitfd, git_op_files[i].name, &st, 0) == 0)
+            found |= git_op_files[i].flag;
+    }
+    if (found == 0)
+        return;
+
+    if (found & OP_REBASE_MERGE) {
+        operation = "REBASE";
+        stepfile = "rebase-merge/msgnum";
+        totalfile = "rebase-merge/end";
+    }
+    else if (found & OP_REBASE_APPLY) {
+        if (found & OP_REBASING)
+            operation = "REBASE";
+        else if (found & OP_APPLYING)
+            operation = "AM";
+        else
+            operation = "AM/REBASE";
+        stepfile = "rebase-apply/next";
+        totalfile = "rebase-apply/last";
+    }
+    else if (found & OP_MERGE)
+        operation = "MERGING";
+    else if (found & OP_CHERRY_PICK)
+        operation = "CHERRY-PICKING";
+    else if (found & OP_REVERT)
+        operation = "REVERTING";
+    else if ((found & OP_SEQUENCER) &&
+             read_first_line_at(repo->gitfd, "sequencer/todo",
+                                todo, sizeof(todo))) {
+        /* picking or reverting a series, stopped between commits */
+        if (strncmp(todo, "p ", 2) == 0 || strncmp(todo, "pick ", 5) == 0)
+            operation = "CHERRY-PICKING";
+        else if (strncmp(todo, "revert ", 7) == 0)
+            operation = "REVERTING";
+    }
+    if (operation == NULL && (found & OP_BISECT))
+        operation = "BISECTING";
+    if (operation == NULL)
+        return;
+
+    debug("operation in progress: %s", operation);
+    if (stepfile != NULL &&
+        read_first_line_at(repo->gitfd, stepfile, step, sizeof(step)) &&
+        read_first_line_at(repo->gitfd, totalfile, total, sizeof(total)) &&
+        step[0] != '\0' && total[0] != '\0') {
+        snprintf(buf, sizeof(buf), "%s %s/%s", operation, step, total);
+        result->operation = strdup(buf);
+    }
+    else
+        result->operation = strdup(operation);
+}
+
+/* Count the entries of the stash reflog into result->stashes: one
+ * line each in logs/refs/stash, counted with memchr() (which libc
+ * vectorizes) over the mapped file.  The reflogs of a reftable
+ * repository are in its tables, so ask git there.
+ */
+static void
+git_stash_count(vccontext_t *context, const gitrepo_t *repo,
+                result_t *result)
+{
+    const char *data, *p, *end;
+    size_t size;
+    int count = 0;
+
+    result->stashes = 0;
+    if (repo->reftable) {
+        char *argv[] = {
+            "git", "rev-list", "--walk-reflogs", "--count", "refs/stash",
+            NULL};
+        capture_opts_t opts = {0, NULL, NULL, 0, context->top};
+        capture_t *capture = capture_child_opts("git", argv, &opts);
+        if (capture != NULL && capture->timedout)
+            result->stashes = -1;
+        else if (capture != NULL && capture->status == 0 &&
+                 sscanf(capture->childout.buf, "%d", &result->stashes) != 1)
+            result->stashes = 0;
+        free_capture(capture);
+        return;
+    }
+
+    if (faccessat(repo->commonfd, "logs/refs/stash", F_OK, 0) < 0)
+        return;
+    if ((data = map_file(repo->commonfd, "logs/refs/stash", &size,
+                         NULL)) == NULL)
+        return;
+    end = data + size;
+    for (p = data; (p = memchr(p, '\n', end - p)) != NULL; p++)
+        count++;
+    if (end[-1] != '\n')
+        count++;                        /* last line unterminated */
+    unmap_file((void *) data, size);
+    debug("found %d stash entries", count);
+    result->stashes = count;
+}
+
+/* Work out whether anything is staged for commit, without running
+ * git: the root of the index's cache-tree is the tree a commit would
+ * have right now, so compare it with the tree of HEAD (from the
+ * commit-graph, or else from the commit itself).  head is HEAD's
+ * commit ID, or NULL if HEAD did not resolve: unborn says whether
+ * that is because the branch has no commits yet, when anything in
+ * the index is staged.  Return 1 or 0, or -1 if we cannot tell: e.g.
+ * HEAD is unreadable, or a change to the index has invalidated the
+ * cache-tree, and only "git write-tree" would bring it back.
+ */
+static int
+git_index_staged(const gitrepo_t *repo, gitindex_t *index, const char *head,
+                 int unborn)
+{
+    char index_tree[GIT_MAX_HEXSZ + 1];
+    char head_tree[GIT_MAX_HEXSZ + 1];
+    gitgraph_t graph;
+    int found = 0;
+
+    if (head == NULL) {
+        if (!unborn) {
+            debug("unable to resolve HEAD");
+            return -1;
+        }
+        return index->nentries > 0;
+    }
+    if (!gitindex_cache_tree(index, index_tree)) {
+        debug("index has no valid cache-tree");
+        return -1;
+    }
+    if (gitgraph_open(&graph, repo)) {
+        found = gitgraph_commit_tree(&graph, head, head_tree);
+        gitgraph_close(&graph);
+    }
+    if (!found && !gitodb_commit_tree(repo, head, head_tree))
+        return -1;
+    debug("index has tree %s, HEAD has tree %s", index_tree, head_tree);
+    return strcmp(index_tree, head_tree) != 0;
 }
 
 static result_t*
 git_get_info(vccontext_t *context)
 {
     result_t *result = init_result();
+    gitrepo_t *repo;
+    gitindex_t index;
+    fsmonitor_t fsm;
+    int have_index = 0;                 /* 0: no index, -1: unreadable */
+    int have_fsm = 0;
+    int check_modified;
+    char oid[GIT_MAX_HEXSZ + 1];
+    int found_oid = 0;
+    int unborn = 0;
     char buf[1024];
 
-    if (!read_first_line(".git/HEAD", buf, 1024)) {
-        debug("unable to read .git/HEAD: assuming not a git repo");
+    if ((repo = git_open_repo(context)) == NULL) {
+        debug("unable to find git dir: assuming not a git repo");
+        free_result(result);
+        return NULL;
+    }
+    if (!read_first_line_at(repo->gitfd, "HEAD", buf, sizeof(buf))) {
+        debug("unable to read HEAD: assuming not a git repo");
         goto err;
     }
 
-    char *prefix = "ref: refs/heads/";
-    int prefixlen = strlen(prefix);
+    if (context->options->show_branch || context->options->show_revision ||
+        context->options->show_upstream || context->options->show_staged) {
+        char target[GITREFS_MAXNAME];
+        char *prefix = "refs/heads/";
+        int prefixlen = strlen(prefix);
 
-    if (context->options->show_branch || context->options->show_revision) {
-        int found_branch = 0;
-        if (strncmp(prefix, buf, prefixlen) == 0) {
+        int status = gitrefs_resolve(repo, "HEAD", oid, target);
+        found_oid = (status > 0);
+        unborn = (status == 0);
+        if (strncmp(prefix, target, prefixlen) == 0) {
             /* yep, we're on a known branch */
-            debug("read a head ref from .git/HEAD: '%s'", buf);
-            if (result_set_branch(result, buf + prefixlen))
-                found_branch = 1;
+            debug("HEAD refers to branch '%s'", target + prefixlen);
+            result_set_branch(result, target + prefixlen);
         }
         else {
-            /* if it's not a branch name, assume it is a commit ID */
-            debug(".git/HEAD doesn't look like a head ref: unknown branch");
+            /* detached HEAD, or a symref outside refs/heads */
+            debug("HEAD doesn't refer to a branch: unknown branch");
             result_set_branch(result, "(unknown)");
-            result_set_revision(result, buf, 12);
-        }
-        if (context->options->show_revision && found_branch) {
-            char buf[1024];
-            char filename[1024] = ".git/refs/heads/";
-            int nchars = sizeof(filename) - strlen(filename) - 1;
-            strncat(filename, result->branch, nchars);
-            if (read_first_line(filename, buf, 1024)) {
-                result_set_revision(result, buf, 12);
-            }
         }
+        if (found_oid && context->options->show_revision)
+            result_set_revision(result, oid, git_abbrev_len(repo, oid));
+        if (context->options->show_upstream && found_oid &&
+            strncmp(prefix, target, prefixlen) == 0)
+            git_ahead_behind(context, repo, target + prefixlen, oid, result);
     }
-    if (context->options->show_modified &&
-        !should_ignore_modified(".git") && !is_cwd_remote()) {
-        char *argv[] = {
-            "git", "diff", "--no-ext-diff", "--quiet", "--exit-code", NULL};
-        capture_t *capture = capture_child("git", argv);
-        result->modified = (capture->status == 1);
 
-        /* any other outcome (including failure to fork/exec,
-           failure to run git, or diff error): assume no
-           modifications */
-        free_capture(capture);
+    if (context->options->show_operation)
+        git_operation(repo, result);
+    if (context->options->show_stash)
+        git_stash_count(context, repo, result);
+
+    check_modified = (context->options->show_modified &&
+                      !should_ignore_modified_at(context->dirfd, ".git") &&
+                      !is_dir_remote(context->top));
+    if ((check_modified || context->options->show_unknown ||
+         context->options->show_staged) &&
+        faccessat(repo->gitfd, "index", F_OK, 0) == 0) {
+        have_index = gitindex_open(&index, repo->gitfd, "index",
+                                   repo->hashlen) ? 1 : -1;
+        if (have_index > 0)
+            have_fsm = fsmonitor_open(&fsm, repo, &index);
     }
-    if (context->options->show_unknown) {
-        char *argv[] = {
-            "git", "ls-files", "--others", "--exclude-standard", NULL};
-        capture_t *capture = capture_child("git", argv);
-        result->unknown = (capture != NULL && capture->childout.len > 0);
 
+    if (check_modified)
+        result->modified = (have_index > 0)
+            ? git_index_modified(&index, have_fsm ? &fsm : NULL,
+                                 context->dirfd)
+            : -1;
+    if (context->options->show_staged)
+        result->staged = (have_index > 0)
+            ? git_index_staged(repo, &index, found_oid ? oid : NULL,
+                               unborn)
+            : -1;
+    if (context->options->show_unknown)
+        result->unknown = (have_index >= 0)
+            ? gitwalk_untracked(repo, have_index ? &index : NULL,
+                                have_fsm ? &fsm : NULL, context->dirfd)
+            : -1;
+
+    /* if we could not work it out ourselves, ask git (if there is
+       time left): running the commands at once when we need several */
+    char *diff_argv[] = {
+        "git", "diff", "--no-ext-diff", "--quiet", "--exit-code", NULL};
+    char *cached_argv[] = {
+        "git", "diff", "--cached", "--no-ext-diff", "--quiet", "--exit-code",
+        NULL};
+    char *others_argv[] = {
+        "git", "ls-files", "--others", "--exclude-standard", NULL};
+    int diff_budget = budget_remaining('m');
+    int others_budget = budget_remaining('u');
+    int cached_budget = timeout_remaining();
+    capture_opts_t diff_opts = {
+        0, NULL, NULL, diff_budget > 0 ? diff_budget : 0, context->top};
+    /* for ls-files, the first byte will do */
+    capture_opts_t others_opts = {
+        1, NULL, NULL, others_budget > 0 ? others_budget : 0, context->top};
+    capture_opts_t cached_opts = {
+        0, NULL, NULL, cached_budget > 0 ? cached_budget : 0, context->top};
+    capture_job_t jobs[3];
+    capture_job_t *diff = NULL, *others = NULL, *cached = NULL;
+    int njobs = 0;
+
+    if (check_modified && result->modified < 0 && diff_budget != 0) {
+        diff = &jobs[njobs++];
+        *diff = (capture_job_t) {"git", diff_argv, &diff_opts, NULL};
+    }
+    if (context->options->show_unknown && result->unknown < 0 &&
+        others_budget != 0) {
+        others = &jobs[njobs++];
+        *others = (capture_job_t) {"git", others_argv, &others_opts, NULL};
+    }
+    if (context->options->show_staged && result->staged < 0 &&
+        cached_budget != 0) {
+        cached = &jobs[njobs++];
+        *cached = (capture_job_t) {"git", cached_argv, &cached_opts, NULL};
+    }
+    if (njobs > 0)
+        capture_children(jobs, njobs);
+    if (diff != NULL) {
+        /* any other outcome (including failure to fork/exec, failure
+           to run git, or diff error): assume no modifications */
+        if (diff->result != NULL && diff->result->timedout)
+            result->modified = -1;
+        else
+            result->modified = (diff->result != NULL &&
+                                diff->result->status == 1);
+        free_capture(diff->result);
+    }
+    if (others != NULL) {
         /* again, ignore other errors and assume no unknown files */
-        free_capture(capture);
+        if (others->result != NULL && others->result->timedout)
+            result->unknown = -1;
+        else
+            result->unknown = (others->result != NULL &&
+                               others->result->childout.len > 0);
+        free_capture(others->result);
+    }
+
+    if (cached != NULL) {
+        if (cached->result != NULL && cached->result->timedout)
+            result->staged = -1;
+        else
+            result->staged = (cached->result != NULL &&
+                              cached->result->status == 1);
+        free_capture(cached->result);
     }
 
+    if (have_fsm)
+        fsmonitor_free(&fsm);
+    if (have_index > 0)
+        gitindex_close(&index);
     return result;
 
  err:
@@ -89,8 +748,56 @@ git_get_info(vccontext_t *context)
     return NULL;
 }
 
+/* The stamp files of a git working dir: .git itself, then these in
+ * the git dir and the common dir, wherever .git says they are (in a
+ * linked worktree or a submodule, not under the top dir at all), then
+ * the loose refs of the current branch and (for %> and %<) of its
+ * upstream, which may be nested anywhere under refs/.
+ */
+static const char *const git_dir_stamps[] = {
+    ".", "HEAD", "index", "patches", "FETCH_HEAD", NULL,
+};
+static const char *const git_common_stamps[] = {
+    "packed-refs", "reftable/tables.list", "logs/refs/stash", NULL,
+};
+
+static int
+git_get_stamps(vccontext_t *context, stamp_fn_t stamp, void *arg)
+{
+    gitrepo_t *repo = git_open_repo(context);
+    const char *const *s;
+    char head[GITREFS_MAXNAME + 8], upstream[GITREFS_MAXNAME];
+    const char *branch;
+
+    if (repo == NULL)
+        return 0;
+    stamp(context->dirfd, ".git", arg);
+    for (s = git_dir_stamps; *s != NULL; s++)
+        stamp(repo->gitfd, *s, arg);
+    for (s = git_common_stamps; *s != NULL; s++)
+        stamp(repo->commonfd, *s, arg);
+
+    if (!read_first_line_at(repo->gitfd, "HEAD", head, sizeof(head)) ||
+        strncmp(head, "ref:", 4) != 0)
+        return 1;                       /* detached */
+    for (branch = head + 4; isspace((unsigned char) *branch); branch++)
+        ;
+    if (strncmp(branch, "refs/heads/", 11) != 0 || strstr(branch, ".."))
+        return 1;
+    stamp(repo->commonfd, branch, arg);
+    if (context->options->show_upstream &&
+        git_upstream_ref(repo, branch + 11, upstream) &&
+        strncmp(upstream, "refs/", 5) == 0 && !strstr(upstream, ".."))
+        stamp(repo->commonfd, upstream, arg);
+    return 1;
+}
+
 vccontext_t*
 get_git_context(options_t *options)
 {
-    return init_context("git", options, git_probe, git_get_info);
+    static const char *const markers[] = {".git", NULL};
+    vccontext_t *context = init_context("git", options, markers, NULL,
+                                        git_probe, git_get_info);
+    context->get_stamps = git_get_stamps;
+    return context;
 }
@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitgraph.h"
+
+#define HEADER_LEN 8
+#define CHUNK_TOC_ENTRY_LEN 12
+
+/* parent positions in CDAT (cf. git's commit-graph.c) */
+#define PARENT_NONE 0x70000000
+#define EXTRA_EDGES 0x80000000
+#define EDGE_LAST   0x80000000
+
+/* bits of the per-commit flags of gitgraph_ahead_behind() */
+#define FROM_OID      0x01
+#define FROM_UPSTREAM 0x02
+#define FROM_BOTH     (FROM_OID | FROM_UPSTREAM)
+#define QUEUED        0x04
+
+/* how many commits to visit between checks of the -t timeout */
+#define TIMEOUT_CHECK_STEP 4096
+
+/* Map one commit-graph file (relative to dirfd) to layer, and find its
+ * chunks.  Return 1 on success, 0 if it is missing or unusable.
+ */
+static int
+open_layer(gitgraph_layer_t *layer, int dirfd, const char *filename,
+           int hashlen, int nbase)
+{
+    const unsigned char *p, *end;
+    unsigned int nchunks, i;
+    int hashver = (hashlen == 32) ? 2 : 1;
+    size_t commitlen = hashlen + 16;
+
+    memset(layer, 0, sizeof(*layer));
+    layer->data = map_file(dirfd, filename, &layer->size, NULL);
+    if (layer->data == NULL)
+        return 0;
+
+    p = layer->data;
+    if (layer->size < (size_t) (HEADER_LEN + CHUNK_TOC_ENTRY_LEN + hashlen) ||
+        memcmp(p, "CGPH", 4) != 0 || p[4] != 1) {
+        debug("%s: not a version 1 commit-graph", filename);
+        goto err;
+    }
+    if (p[5] != hashver) {
+        debug("%s: wrong hash version %d", filename, p[5]);
+        goto err;
+    }
+    if (p[7] != nbase) {
+        debug("%s: has %d base graphs, expected %d", filename, p[7], nbase);
+        goto err;
+    }
+    nchunks = p[6];
+    end = layer->data + layer->size - hashlen;
+    if (HEADER_LEN + (nchunks + 1) * CHUNK_TOC_ENTRY_LEN > layer->size)
+        goto corrupt;
+
+    /* table of contents: (id, offset) pairs, then a zero id giving the
+       end of the last chunk */
+    for (i = 0; i < nchunks; i++) {
+        const unsigned char *entry = p + HEADER_LEN + i * CHUNK_TOC_ENTRY_LEN;
+        unsigned long long start = get_be64(entry + 4);
+        unsigned long long stop = get_be64(entry + CHUNK_TOC_ENTRY_LEN + 4);
+        if (start > stop || stop > (unsigned long long) (end - p))
+            goto corrupt;
+        const unsigned char *chunk = p + start;
+        size_t len = stop - start;
+
+        if (memcmp(entry, "OIDF", 4) == 0) {
+            if (len != 256 * 4)
+                goto corrupt;
+            layer->fanout = chunk;
+        }
+        else if (memcmp(entry, "OIDL", 4) == 0) {
+            layer->oids = chunk;
+            layer->ncommits = len / hashlen;
+        }
+        else if (memcmp(entry, "CDAT", 4) == 0) {
+            if (len % commitlen != 0)
+                goto corrupt;
+            layer->commits = chunk;
+        }
+        else if (memcmp(entry, "EDGE", 4) == 0) {
+            layer->edges = chunk;
+            layer->nedges = len / 4;
+        }
+    }
+    if (layer->fanout == NULL || layer->oids == NULL ||
+        layer->commits == NULL ||
+        get_be32(layer->fanout + 255 * 4) != layer->ncommits ||
+        (size_t) (end - layer->commits) < layer->ncommits * commitlen)
+        goto corrupt;
+    debug("read commit-graph %s: %u commits", filename, layer->ncommits);
+    return 1;
+
+ corrupt:
+    debug("%s: corrupt commit-graph", filename);
+ err:
+    unmap_file((void *) layer->data, layer->size);
+    layer->data = NULL;
+    return 0;
+}
+
+/* Add a layer to graph, on top of those it already has. */
+static int
+add_layer(gitgraph_t *graph, int dirfd, const char *filename)
+{
+    gitgraph_layer_t *layer = &graph->layers[graph->nlayers];
+
+    if (graph->nlayers == GITGRAPH_MAX_LAYERS) {
+        debug("commit-graph chain too long");
+        return 0;
+    }
+    if (!open_layer(layer, dirfd, filename, graph->hashlen, graph->nlayers))
+        return 0;
+    if (graph->ncommits + layer->ncommits < graph->ncommits) {
+        unmap_file((void *) layer->data, layer->size);
+        return 0;
+    }
+    layer->base = graph->ncommits;
+    graph->ncommits += layer->ncommits;
+    graph->nlayers++;
+    return 1;
+}
+
+/* Map every layer listed in commit-graphs/commit-graph-chain (relative
+ * to infofd, the objects/info dir), base layer first.
+ */
+static int
+open_chain(gitgraph_t *graph, int infofd)
+{
+    char filename[PATH_MAX];
+    const char *p, *end;
+    size_t size;
+    int hexlen = 2 * graph->hashlen;
+    int ok = 1;
+
+    p = map_file(infofd, "commit-graphs/commit-graph-chain", &size, NULL);
+    if (p == NULL)
+        return 0;
+    const char *chain = p;
+    for (end = p + size; p < end && ok; p += hexlen + 1) {
+        if (end - p < hexlen || (end - p > hexlen && p[hexlen] != '\n')) {
+            debug("commit-graph-chain: bad line");
+            ok = 0;
+            break;
+        }
+        for (int i = 0; i < hexlen; i++) {
+            if (!isxdigit((unsigned char) p[i]))
+                ok = 0;
+        }
+        snprintf(filename, sizeof(filename), "commit-graphs/graph-%.*s.graph",
+                 hexlen, p);
+        ok = ok && add_layer(graph, infofd, filename);
+    }
+    unmap_file((void *) chain, size);
+    return ok && graph->nlayers > 0;
+}
+
+int
+gitgraph_open(gitgraph_t *graph, const gitrepo_t *repo)
+{
+    int infofd, ok;
+
+    memset(graph, 0, sizeof(*graph));
+    graph->hashlen = repo->hashlen;
+    infofd = openat(repo->commonfd, "objects/info",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (infofd < 0)
+        return 0;
+
+    /* the same order as git: a single file wins over a chain */
+    if (faccessat(infofd, "commit-graph", F_OK, 0) == 0)
+        ok = add_layer(graph, infofd, "commit-graph");
+    else
+        ok = open_chain(graph, infofd);
+    close(infofd);
+    if (!ok) {
+        gitgraph_close(graph);
+        return 0;
+    }
+    return 1;
+}
+
+void
+gitgraph_close(gitgraph_t *graph)
+{
+    for (int i = 0; i < graph->nlayers; i++)
+        unmap_file((void *) graph->layers[i].data, graph->layers[i].size);
+    graph->nlayers = 0;
+    graph->ncommits = 0;
+}
+
+/* Find the commit with the given object ID (in hex) in graph.  Store
+ * its position in *pos and return 1, or return 0 if it is not there.
+ */
+static int
+find_commit(const gitgraph_t *graph, const char *hex, unsigned int *pos)
+{
+    unsigned char oid[GIT_MAX_RAWSZ];
+    int hashlen = graph->hashlen;
+
+    if (!parse_hex(oid, hex, hashlen))
+        return 0;
+    for (int i = graph->nlayers - 1; i >= 0; i--) {
+        const gitgraph_layer_t *layer = &graph->layers[i];
+        unsigned int lo = (oid[0] == 0)
+            ? 0 : get_be32(layer->fanout + (oid[0] - 1) * 4);
+        unsigned int hi = get_be32(layer->fanout + oid[0] * 4);
+        if (lo > hi || hi > layer->ncommits)
+            continue;
+        while (lo < hi) {
+            unsigned int mid = lo + (hi - lo) / 2;
+            int cmp = memcmp(layer->oids + (size_t) mid * hashlen,
+                             oid, hashlen);
+            if (cmp == 0) {
+                *pos = layer->base + mid;
+                return 1;
+            }
+            if (cmp < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+    }
+    return 0;
+}
+
+/* Return the layer holding the commit at pos (which must be valid). */
+static const gitgraph_layer_t *
+find_layer(const gitgraph_t *graph, unsigned int pos)
+{
+    int i = graph->nlayers - 1;
+    while (i > 0 && pos < graph->layers[i].base)
+        i--;
+    return &graph->layers[i];
+}
+
+/* The commit data of the commit at pos: tree ID, first and second
+ * parent, then the topological level (generation number v1) in the
+ * top 30 bits of the commit date.
+ */
+static const unsigned char *
+commit_data(const gitgraph_t *graph, const gitgraph_layer_t *layer,
+            unsigned int pos)
+{
+    return layer->commits +
+        (size_t) (pos - layer->base) * (graph->hashlen + 16);
+}
+
+static unsigned int
+commit_level(const gitgraph_t *graph, unsigned int pos)
+{
+    const gitgraph_layer_t *layer = find_layer(graph, pos);
+    return get_be32(commit_data(graph, layer, pos) + graph->hashlen + 8) >> 2;
+}
+
+/* A max-heap of commits to visit, by topological level: a commit's
+ * level is greater than that of all its ancestors, so by the time a
+ * commit comes out, every commit it is reachable from has been
+ * visited and its flags are final.
+ */
+typedef struct {
+    unsigned int level;
+    unsigned int pos;
+} queued_t;
+
+typedef struct {
+    queued_t *items;
+    size_t n, size;
+} queue_t;
+
+static int
+queue_push(queue_t *queue, unsigned int level, unsigned int pos)
+{
+    size_t i;
+
+    if (queue->n == queue->size) {
+        size_t size = queue->size ? 2 * queue->size : 256;
+        queued_t *items = realloc(queue->items, size * sizeof(queued_t));
+        if (items == NULL)
+            return 0;
+        queue->items = items;
+        queue->size = size;
+    }
+    for (i = queue->n++; i > 0; i = (i - 1) / 2) {
+        queued_t *parent = &queue->items[(i - 1) / 2];
+        if (parent->level >= level)
+            break;
+        queue->items[i] = *parent;
+    }
+    queue->items[i].level = level;
+    queue->items[i].pos = pos;
+    return 1;
+}
+
+static unsigned int
+queue_pop(queue_t *queue)
+{
+    unsigned int top = queue->items[0].pos;
+    queued_t last = queue->items[--queue->n];
+    size_t i = 0, child;
+
+    while ((child = 2 * i + 1) < queue->n) {
+        if (child + 1 < queue->n &&
+            queue->items[child + 1].level > queue->items[child].level)
+            child++;
+        if (queue->items[child].level <= last.level)
+            break;
+        queue->items[i] = queue->items[child];
+        i = child;
+    }
+    queue->items[i] = last;
+    return top;
+}
+
+/* Pass flags on to the parent at pos: queue it if it is new.  Keep
+ * *nonstale, the number of queued commits not yet known to be
+ * reachable from both sides, up to date.  Return 1 on success, 0 if
+ * the graph is unusable, -1 if out of memory.
+ */
+static int
+visit_parent(const gitgraph_t *graph, unsigned char *flags, queue_t *queue,
+             unsigned int pos, unsigned char from, size_t *nonstale)
+{
+    unsigned char old;
+    unsigned int level;
+
+    if (pos >= graph->ncommits)
+        return 0;
+    old = flags[pos];
+    flags[pos] |= from;
+    if (old & QUEUED) {
+        if ((old & FROM_BOTH) != FROM_BOTH &&
+            (flags[pos] & FROM_BOTH) == FROM_BOTH)
+            (*nonstale)--;
+        return 1;
+    }
+    if ((level = commit_level(graph, pos)) == 0)
+        return 0;
+    flags[pos] |= QUEUED;
+    if ((flags[pos] & FROM_BOTH) != FROM_BOTH)
+        (*nonstale)++;
+    return queue_push(queue, level, pos) ? 1 : -1;
+}
+
+int
+gitgraph_ahead_behind(const gitgraph_t *graph,
+                      const char *oid, const char *upstream,
+                      int *ahead, int *behind)
+{
+    unsigned int tips[2];
+    unsigned char *flags;
+    queue_t queue = {NULL, 0, 0};
+    size_t nonstale = 0, visited = 0;
+    int status = 1;
+
+    *ahead = *behind = 0;
+    if (!find_commit(graph, oid, &tips[0]) ||
+        !find_commit(graph, upstream, &tips[1])) {
+        debug("commit-graph: commit not found");
+        return 0;
+    }
+    if ((flags = calloc(graph->ncommits, 1)) == NULL)
+        return 0;
+    if (visit_parent(graph, flags, &queue, tips[0], FROM_OID,
+                     &nonstale) != 1 ||
+        visit_parent(graph, flags, &queue, tips[1], FROM_UPSTREAM,
+                     &nonstale) != 1) {
+        status = 0;
+        goto done;
+    }
+
+    while (nonstale > 0) {
+        unsigned int pos = queue_pop(&queue);
+        unsigned char from = flags[pos] & FROM_BOTH;
+        const gitgraph_layer_t *layer = find_layer(graph, pos);
+        const unsigned char *data = commit_data(graph, layer, pos);
+        unsigned int parent1 = get_be32(data + graph->hashlen);
+        unsigned int parent2 = get_be32(data + graph->hashlen + 4);
+        int ok = 1;
+
+        if (from != FROM_BOTH) {
+            nonstale--;
+            if (from == FROM_OID)
+                (*ahead)++;
+            else
+                (*behind)++;
+        }
+        if (++visited % TIMEOUT_CHECK_STEP == 0 && timeout_remaining() == 0) {
+            debug("commit-graph: timeout after %zu commits", visited);
+            status = -1;
+            goto done;
+        }
+
+        if (parent1 != PARENT_NONE)
+            ok = visit_parent(graph, flags, &queue, parent1, from, &nonstale);
+        if (ok == 1 && parent2 != PARENT_NONE && !(parent2 & EXTRA_EDGES))
+            ok = visit_parent(graph, flags, &queue, parent2, from, &nonstale);
+        else if (ok == 1 && parent2 != PARENT_NONE) {
+            /* an octopus merge: its other parents are listed in EDGE,
+               the last one marked by the top bit */
+            unsigned int i = parent2 & ~EXTRA_EDGES, edge;
+            do {
+                if (i >= layer->nedges) {
+                    ok = 0;
+                    break;
+                }
+                edge = get_be32(layer->edges + (size_t) i++ * 4);
+                ok = visit_parent(graph, flags, &queue, edge & ~EDGE_LAST,
+                                  from, &nonstale);
+            } while (ok == 1 && !(edge & EDGE_LAST));
+        }
+        if (ok != 1) {
+            debug("commit-graph: unusable at commit %u", pos);
+            status = 0;
+            goto done;
+        }
+    }
+    debug("commit-graph: %d ahead, %d behind, %zu commits visited",
+          *ahead, *behind, visited);
+
+ done:
+    free(queue.items);
+    free(flags);
+    return status;
+}
+
+int
+gitgraph_commit_tree(const gitgraph_t *graph, const char *oid, char *tree)
+{
+    const unsigned char *data;
+    unsigned int pos;
+
+    if (!find_commit(graph, oid, &pos))
+        return 0;
+    data = commit_data(graph, find_layer(graph, pos), pos);
+    dump_hex(tree, (const char *) data, graph->hashlen);
+    debug("commit-graph: %s has tree %s", oid, tree);
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITGRAPH_H
+#define GITGRAPH_H
+
+#include <stddef.h>
+
+#include "gitrepo.h"
+
+/* most layers of a split commit-graph we look at (git merges them
+ * long before there are this many) */
+#define GITGRAPH_MAX_LAYERS 64
+
+/* One commit-graph file, mapped read-only. */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    const unsigned char *fanout;        /* OIDF: 256 counts */
+    const unsigned char *oids;          /* OIDL: sorted object IDs */
+    const unsigned char *commits;       /* CDAT: tree, parents, level */
+    const unsigned char *edges;         /* EDGE: octopus parents, or NULL */
+    unsigned int nedges;
+    unsigned int ncommits;
+    unsigned int base;                  /* commits in the layers below */
+} gitgraph_layer_t;
+
+/* The commit-graph of a repository: objects/info/commit-graph, or
+ * else the chain of layers in objects/info/commit-graphs written by
+ * "git commit-graph write --split".  Commits are numbered across the
+ * whole chain, base layer first, just like git numbers them.
+ */
+typedef struct {
+    int hashlen;
+    int nlayers;
+    unsigned int ncommits;
+    gitgraph_layer_t layers[GITGRAPH_MAX_LAYERS];
+} gitgraph_t;
+
+/* Map the commit-graph of repo.  Return 1 on success, 0 if there is
+ * none or it cannot be used (errors are reported with debug()).
+ * Caller must release it with gitgraph_close().
+ */
+int
+gitgraph_open(gitgraph_t *graph, const gitrepo_t *repo);
+
+void
+gitgraph_close(gitgraph_t *graph);
+
+/* Count the commits reachable from oid but not from upstream (*ahead)
+ * and the other way round (*behind), like "git rev-list --count
+ * --left-right oid...upstream", both in hex.  Walks back from both at
+ * once, newest generation first, and stops as soon as everything left
+ * to visit is reachable from both, so the cost depends on how far
+ * they have diverged, not on the length of history.  Return 1 on
+ * success, 0 if the graph cannot answer (a commit missing from it,
+ * e.g. one made since it was written, or no generation numbers), and
+ * -1 if the -t timeout expires.
+ */
+int
+gitgraph_ahead_behind(const gitgraph_t *graph,
+                      const char *oid, const char *upstream,
+                      int *ahead, int *behind);
+
+/* Copy the ID of the root tree of commit oid to tree, both in hex
+ * (tree must hold 2 * hashlen + 1 chars).  Return 1 on success, 0 if
+ * the commit is not in the graph.
+ */
+int
+gitgraph_commit_tree(const gitgraph_t *graph, const char *oid, char *tree);
+
+#endif
@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitignore.h"
+#include "sha1.h"
+
+/* pattern flags (same meaning as PATTERN_FLAG_* in git's dir.h) */
+#define PAT_NODIR      0x01             /* no slash: match basename only */
+#define PAT_ENDSWITH   0x04             /* "*literal": match suffix */
+#define PAT_MUSTBEDIR  0x08             /* trailing slash */
+#define PAT_NEGATIVE   0x10             /* leading "!" */
+
+typedef struct {
+    const char *pattern;                /* NUL-terminated, in list->buf */
+    int len;
+    int nowildcardlen;                  /* length of literal prefix */
+    int flags;
+} pattern_t;
+
+struct gitignore_list {
+    gitignore_list_t *prev;             /* enclosing directory */
+    char *buf;                          /* file contents */
+    pattern_t *patterns;
+    int npatterns;
+    char *base;                         /* dir of .gitignore, e.g. "a/b/" */
+    int baselen;
+    gitignore_file_t file;
+};
+
+/* length of the leading part of pattern that has no glob specials */
+static int
+simple_length(const char *pattern)
+{
+    return strcspn(pattern, "*?[\\");
+}
+
+/* Parse buf (the contents of an exclude file, NUL-terminated, modified
+ * in place) into list.  Return 1 on success, 0 if out of memory.
+ */
+static int
+parse_patterns(gitignore_list_t *list, char *buf)
+{
+    int alloc = 0;
+    char *line, *next;
+
+    list->buf = buf;
+    for (line = buf; *line != '\0'; line = next) {
+        char *eol = strchr(line, '\n');
+        if (eol != NULL) {
+            *eol = '\0';
+            next = eol + 1;
+        }
+        else {
+            next = line + strlen(line);
+        }
+
+        /* trailing whitespace is ignored unless escaped */
+        int len = strlen(line);
+        if (len > 0 && line[len - 1] == '\r')
+            line[--len] = '\0';
+        while (len > 0 && (line[len - 1] == ' ' || line[len - 1] == '\t') &&
+               !(len > 1 && line[len - 2] == '\\'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        pattern_t pat;
+        pat.flags = 0;
+        if (line[0] == '!') {
+            pat.flags |= PAT_NEGATIVE;
+            line++;
+            len--;
+        }
+        if (len > 0 && line[len - 1] == '/') {
+            pat.flags |= PAT_MUSTBEDIR;
+            line[--len] = '\0';
+        }
+        if (len == 0)
+            continue;
+        if (memchr(line, '/', len) == NULL)
+            pat.flags |= PAT_NODIR;
+        else if (line[0] == '/') {
+            /* anchored: leading slash is implied for pathname patterns */
+            line++;
+            len--;
+        }
+        pat.pattern = line;
+        pat.len = len;
+        pat.nowildcardlen = simple_length(line);
+        if (line[0] == '*' && simple_length(line + 1) == len - 1)
+            pat.flags |= PAT_ENDSWITH;
+
+        if (list->npatterns == alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            pattern_t *p = realloc(list->patterns, alloc * sizeof(pattern_t));
+            if (p == NULL)
+                return 0;
+            list->patterns = p;
+        }
+        list->patterns[list->npatterns++] = pat;
+    }
+    return 1;
+}
+
+/* Compute both object IDs of an exclude file: git records the ID of
+ * the blob in the index if the file is tracked and unmodified, and
+ * otherwise hashes the contents with an extra newline appended (the
+ * way it reads them).  Empty files are not padded.
+ */
+static void
+hash_file(gitignore_file_t *file, const void *data, size_t size)
+{
+    sha1_t ctx;
+    char header[32];
+    int n;
+
+    sha1_git_blob(data != NULL ? data : "", size, file->oid);
+    if (data == NULL || size == 0) {
+        memcpy(file->oid_eol, file->oid, SHA1_LEN);
+        return;
+    }
+    n = snprintf(header, sizeof(header), "blob %zu", size + 1);
+    sha1_init(&ctx);
+    sha1_update(&ctx, header, n + 1);
+    sha1_update(&ctx, data, size);
+    sha1_update(&ctx, "\n", 1);
+    sha1_final(&ctx, file->oid_eol);
+}
+
+/* Read exclude file filename (relative to dirfd) into a new list with
+ * the given base, and compute its object ID if hash is true.  A missing
+ * file yields an empty list.  Return NULL only if out of memory.
+ */
+static gitignore_list_t *
+load_list(int dirfd, const char *filename, const char *base, int baselen,
+          int hash)
+{
+    gitignore_list_t *list = calloc(1, sizeof(gitignore_list_t));
+    char *buf = NULL;
+    size_t size = 0;
+
+    if (list == NULL)
+        return NULL;
+    list->base = malloc(baselen + 1);
+    if (list->base == NULL)
+        goto err;
+    memcpy(list->base, base, baselen);
+    list->base[baselen] = '\0';
+    list->baselen = baselen;
+
+    if (filename != NULL && faccessat(dirfd, filename, F_OK, 0) == 0) {
+        void *data = map_file(dirfd, filename, &size, NULL);
+        list->file.exists = 1;
+        if (hash)
+            hash_file(&list->file, data, size);
+        if (data != NULL) {
+            buf = malloc(size + 1);
+            if (buf != NULL) {
+                memcpy(buf, data, size);
+                buf[size] = '\0';
+            }
+            unmap_file(data, size);
+            if (buf == NULL)
+                goto err;
+            debug("read exclude patterns from %s%s", base, filename);
+        }
+    }
+    if (buf == NULL && (buf = calloc(1, 1)) == NULL)
+        goto err;
+    if (!parse_patterns(list, buf))
+        goto err;
+    return list;
+
+ err:
+    if (list->buf == NULL)
+        free(buf);
+    free(list->buf);
+    free(list->patterns);
+    free(list->base);
+    free(list);
+    return NULL;
+}
+
+static void
+free_list(gitignore_list_t *list)
+{
+    if (list != NULL) {
+        free(list->buf);
+        free(list->patterns);
+        free(list->base);
+        free(list);
+    }
+}
+
+int
+gitignore_init(gitignore_t *ignore, const gitrepo_t *repo, int hash)
+{
+    char value[PATH_MAX];
+    char path[PATH_MAX];
+    const char *home = getenv("HOME");
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+
+    ignore->global = ignore->info = ignore->top = NULL;
+    ignore->hash = hash;
+
+    /* core.excludesFile, defaulting to $XDG_CONFIG_HOME/git/ignore */
+    path[0] = '\0';
+    if (gitrepo_config(repo, "core.excludesfile", value, sizeof(value))) {
+        if (strncmp(value, "~/", 2) == 0 && home != NULL)
+            snprintf(path, sizeof(path), "%s/%s", home, value + 2);
+        else
+            snprintf(path, sizeof(path), "%s", value);
+    }
+    else if (xdg != NULL && *xdg)
+        snprintf(path, sizeof(path), "%s/git/ignore", xdg);
+    else if (home != NULL)
+        snprintf(path, sizeof(path), "%s/.config/git/ignore", home);
+
+    ignore->global = load_list(AT_FDCWD, path[0] ? path : NULL, "", 0, hash);
+    ignore->info = load_list(repo->commonfd, "info/exclude", "", 0, hash);
+    if (ignore->global == NULL || ignore->info == NULL) {
+        gitignore_free(ignore);
+        return 0;
+    }
+    return 1;
+}
+
+void
+gitignore_free(gitignore_t *ignore)
+{
+    while (ignore->top != NULL)
+        gitignore_pop(ignore);
+    free_list(ignore->global);
+    free_list(ignore->info);
+    ignore->global = ignore->info = NULL;
+}
+
+int
+gitignore_push(gitignore_t *ignore, int dirfd, const char *base, int baselen)
+{
+    gitignore_list_t *list = load_list(dirfd, ".gitignore", base, baselen,
+                                       ignore->hash);
+    if (list == NULL)
+        return 0;
+    list->prev = ignore->top;
+    ignore->top = list;
+    return 1;
+}
+
+void
+gitignore_pop(gitignore_t *ignore)
+{
+    gitignore_list_t *list = ignore->top;
+    if (list != NULL) {
+        ignore->top = list->prev;
+        free_list(list);
+    }
+}
+
+const gitignore_file_t *
+gitignore_file(const gitignore_t *ignore, int which)
+{
+    switch (which) {
+    case GITIGNORE_GLOBAL:
+        return &ignore->global->file;
+    case GITIGNORE_INFO:
+        return &ignore->info->file;
+    default:
+        return &ignore->top->file;
+    }
+}
+
+int
+gitignore_file_matches(const gitignore_file_t *file, const unsigned char *oid)
+{
+    if (!file->exists || oid == NULL)
+        return !file->exists && oid == NULL;
+    return (memcmp(oid, file->oid, SHA1_LEN) == 0 ||
+            memcmp(oid, file->oid_eol, SHA1_LEN) == 0);
+}
+
+/* p points at '['.  Return true if c matches the bracket expression,
+ * and point *endp at its closing ']' (or set it to NULL if there is
+ * none, in which case '[' is just a literal char).
+ */
+static int
+match_class(const char *p, unsigned char c, const char **endp)
+{
+    int negate = 0;
+    int matched = 0;
+    const char *start;
+
+    p++;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    for (start = p; *p != '\0' && (*p != ']' || p == start); p++) {
+        unsigned char lo = *p;
+        if (lo == '\\' && p[1] != '\0')
+            lo = *++p;
+        if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+            unsigned char hi = p[2];
+            p += 2;
+            if (hi == '\\' && p[1] != '\0')
+                hi = *++p;
+            if (lo <= c && c <= hi)
+                matched = 1;
+        }
+        else if (lo == c) {
+            matched = 1;
+        }
+    }
+    if (*p != ']') {
+        *endp = NULL;
+        return 0;
+    }
+    *endp = p;
+    return matched != negate;
+}
+
+static int
+wildmatch(const char *p, const char *text, const char *pstart)
+{
+    for (; *p != '\0'; p++, text++) {
+        const char *end;
+        const char *q;
+
+        switch (*p) {
+        case '\\':
+            if (p[1] != '\0')
+                p++;
+            if (*text != *p)
+                return 0;
+            break;
+        case '?':
+            if (*text == '\0' || *text == '/')
+                return 0;
+            break;
+        case '[':
+            if (*text == '\0' || *text == '/')
+                return 0;
+            if (match_class(p, *text, &end))
+                p = end;
+            else if (end != NULL || *text != '[')
+                return 0;
+            break;
+        case '*':
+            for (q = p; *q == '*'; q++)
+                ;
+            if (q - p > 1 && (p == pstart || p[-1] == '/') &&
+                (*q == '\0' || *q == '/')) {
+                /* "**" as a whole path component */
+                if (*q == '\0')
+                    return 1;
+                for (;;) {
+                    if (wildmatch(q + 1, text, pstart))
+                        return 1;
+                    text = strchr(text, '/');
+                    if (text == NULL)
+                        return 0;
+                    text++;
+                }
+            }
+            /* any run of chars other than "/" */
+            if (*q == '\0')
+                return strchr(text, '/') == NULL;
+            for (;; text++) {
+                if (wildmatch(q, text, pstart))
+                    return 1;
+                if (*text == '\0' || *text == '/')
+                    return 0;
+            }
+        default:
+            if (*text != *p)
+                return 0;
+        }
+    }
+    return *text == '\0';
+}
+
+int
+gitignore_wildmatch(const char *pattern, const char *text)
+{
+    return wildmatch(pattern, text, pattern);
+}
+
+/* Does pat (from a file in directory base) match path? */
+static int
+match_pattern(const pattern_t *pat, const gitignore_list_t *list,
+              const char *path, int pathlen, const char *basename,
+              int isdir)
+{
+    if ((pat->flags & PAT_MUSTBEDIR) && !isdir)
+        return 0;
+
+    if (pat->flags & PAT_NODIR) {
+        int namelen = pathlen - (basename - path);
+        if (pat->nowildcardlen == pat->len)
+            return (namelen == pat->len &&
+                    memcmp(basename, pat->pattern, namelen) == 0);
+        if (pat->flags & PAT_ENDSWITH)
+            return (namelen >= pat->len - 1 &&
+                    memcmp(basename + namelen - (pat->len - 1),
+                           pat->pattern + 1, pat->len - 1) == 0);
+        return wildmatch(pat->pattern, basename, pat->pattern);
+    }
+
+    /* pathname pattern: relative to the dir containing the file */
+    if (pathlen < list->baselen ||
+        memcmp(path, list->base, list->baselen) != 0)
+        return 0;
+    path += list->baselen;
+    pathlen -= list->baselen;
+    if (pat->nowildcardlen > 0) {
+        if (pathlen < pat->nowildcardlen ||
+            memcmp(path, pat->pattern, pat->nowildcardlen) != 0)
+            return 0;
+        if (pat->nowildcardlen == pat->len)
+            return pathlen == pat->len;
+    }
+    return wildmatch(pat->pattern, path, pat->pattern);
+}
+
+/* Return 1 if the last pattern in list matching path excludes it, -1 if
+ * it is negated (i.e. path is explicitly not excluded), 0 if no match.
+ */
+static int
+match_list(const gitignore_list_t *list,
+           const char *path, int pathlen, const char *basename, int isdir)
+{
+    int i;
+    for (i = list->npatterns - 1; i >= 0; i--) {
+        const pattern_t *pat = &list->patterns[i];
+        if (match_pattern(pat, list, path, pathlen, basename, isdir))
+            return (pat->flags & PAT_NEGATIVE) ? -1 : 1;
+    }
+    return 0;
+}
+
+int
+gitignore_excluded(const gitignore_t *ignore,
+                   const char *path, int pathlen, int isdir)
+{
+    const gitignore_list_t *list;
+    const char *basename = path + pathlen;
+    int match;
+
+    while (basename > path && basename[-1] != '/')
+        basename--;
+
+    /* innermost .gitignore wins, then info/exclude, then the global
+       excludes file */
+    for (list = ignore->top; list != NULL; list = list->prev) {
+        if ((match = match_list(list, path, pathlen, basename, isdir)) != 0)
+            return match > 0;
+    }
+    if ((match = match_list(ignore->info, path, pathlen, basename, isdir)))
+        return match > 0;
+    match = match_list(ignore->global, path, pathlen, basename, isdir);
+    return match > 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITIGNORE_H
+#define GITIGNORE_H
+
+#include "gitrepo.h"
+#include "sha1.h"
+
+/* A matcher for git's exclude patterns (see gitignore(5)), built from
+ * core.excludesFile, $GIT_DIR/info/exclude, and a stack of per-dir
+ * .gitignore files that follows a depth-first walk of the working dir.
+ * Patterns are pre-compiled so that the common cases (literal names,
+ * "*.ext") are matched with a plain memcmp() instead of wildmatch().
+ */
+typedef struct gitignore_list gitignore_list_t;
+
+typedef struct {
+    gitignore_list_t *global;           /* core.excludesFile */
+    gitignore_list_t *info;             /* $GIT_DIR/info/exclude */
+    gitignore_list_t *top;              /* innermost .gitignore */
+    int hash;                           /* compute gitignore_file_t.oid */
+} gitignore_t;
+
+/* Identity of an exclude file, used to check that git's untracked
+ * cache was built with the same patterns that are in effect now.
+ */
+typedef struct {
+    int exists;
+    unsigned char oid[SHA1_LEN];        /* object ID of the file as a blob */
+    unsigned char oid_eol[SHA1_LEN];    /* ditto with "\n" appended */
+} gitignore_file_t;
+
+/* which file for gitignore_file() */
+#define GITIGNORE_GLOBAL 0
+#define GITIGNORE_INFO   1
+#define GITIGNORE_TOP    2
+
+/* Load the repository-wide exclude files.  If hash is true, compute
+ * the object ID of every exclude file read (see gitignore_file()).
+ * Return 1 on success, 0 on error (out of memory).  Caller must call
+ * gitignore_free().
+ */
+int
+gitignore_init(gitignore_t *ignore, const gitrepo_t *repo, int hash);
+
+void
+gitignore_free(gitignore_t *ignore);
+
+/* Enter directory base (relative to the top of the working dir, with
+ * a trailing slash, or "" for the top itself), open on dirfd: read its
+ * .gitignore (if any) so it applies to everything below base.  Every
+ * call must be matched by a call to gitignore_pop().  Return 1 on
+ * success, 0 on error.
+ */
+int
+gitignore_push(gitignore_t *ignore, int dirfd, const char *base, int baselen);
+
+void
+gitignore_pop(gitignore_t *ignore);
+
+/* Return the identity of the global excludes file, info/exclude, or the
+ * .gitignore of the innermost directory pushed so far.
+ */
+const gitignore_file_t *
+gitignore_file(const gitignore_t *ignore, int which);
+
+/* Return true if oid, as recorded by git for an exclude file (NULL if
+ * the file did not exist), matches file.
+ */
+int
+gitignore_file_matches(const gitignore_file_t *file, const unsigned char *oid);
+
+/* Return true if path (relative to the top of the working dir) is
+ * excluded by the patterns in effect.  Does not check whether a
+ * parent directory of path is excluded: callers are expected to not
+ * descend into excluded directories.
+ */
+int
+gitignore_excluded(const gitignore_t *ignore,
+                   const char *path, int pathlen, int isdir);
+
+/* Match text against a glob pattern with git's wildmatch() semantics
+ * in WM_PATHNAME mode: "*" and "?" do not match "/", but "**" matches
+ * any number of leading, trailing or intermediate directories.
+ */
+int
+gitignore_wildmatch(const char *pattern, const char *text);
+
+#endif
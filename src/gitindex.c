@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gitindex.h"
+
+#define HEADER_LEN 12
+
+/* offset of the hash in an on-disk entry: ctime, mtime (8 bytes each)
+ * and dev, ino, mode, uid, gid, size (4 bytes each) */
+#define ENTRY_OID_OFS 40
+
+/* gitindex_iter_t.ownok/sharedok before the next entry is read */
+#define NOT_READ 2
+
+/* The "link" extension of a split index: the hash of the shared index
+ * (all zeros if there is none), optionally followed by the bitmaps of
+ * the shared entries that are deleted and that are replaced by the
+ * first entries of this index, in order.
+ */
+static int
+open_shared(gitindex_t *index, int dirfd)
+{
+    const unsigned char *p, *end;
+    char filename[sizeof("sharedindex.") + 2 * 32];   /* up to SHA-256 */
+    size_t size;
+    unsigned int i, ndeleted = 0;
+    int hashlen = index->hashlen;
+
+    if ((p = gitindex_extension(index, "link", &size)) == NULL)
+        return 1;
+    end = p + size;
+    if (size < (size_t) hashlen)
+        goto corrupt;
+    for (i = 0; i < (unsigned int) hashlen && p[i] == 0; i++)
+        ;
+    if (i == (unsigned int) hashlen)
+        return 1;
+
+    strcpy(filename, "sharedindex.");
+    dump_hex(filename + strlen(filename), (const char *) p, hashlen);
+    p += hashlen;
+    if ((index->shared = malloc(sizeof(gitindex_t))) == NULL)
+        return 0;
+    if (!gitindex_open(index->shared, dirfd, filename, hashlen)) {
+        free(index->shared);
+        index->shared = NULL;
+        return 0;
+    }
+    if (index->shared->shared != NULL) {
+        debug("%s: shared index is split itself", filename);
+        return 0;
+    }
+
+    /* calloc(0) may be NULL: make room for at least one flag */
+    index->deleted = calloc(2 * index->shared->nentries + 1, 1);
+    if (index->deleted == NULL)
+        return 0;
+    index->replaced = index->deleted + index->shared->nentries;
+    if (p < end &&
+        (!gitindex_read_ewah(&p, end, index->deleted,
+                             index->shared->nentries) ||
+         !gitindex_read_ewah(&p, end, index->replaced,
+                             index->shared->nentries)))
+        goto corrupt;
+    for (i = 0; i < index->shared->nentries; i++) {
+        if (index->deleted[i] && index->replaced[i])
+            goto corrupt;
+        ndeleted += index->deleted[i];
+        index->nreplaced += index->replaced[i];
+    }
+    if (index->nreplaced > index->nstored)
+        goto corrupt;
+    index->nentries = (index->shared->nentries - ndeleted +
+                       index->nstored - index->nreplaced);
+    debug("split index: %u shared entries, %u deleted, %u replaced",
+          index->shared->nentries, ndeleted, index->nreplaced);
+    return 1;
+
+ corrupt:
+    debug("index extension link is corrupt");
+    return 0;
+}
+
+int
+gitindex_open(gitindex_t *index, int dirfd, const char *filename, int hashlen)
+{
+    memset(index, 0, sizeof(*index));
+    index->data = map_file(dirfd, filename, &index->size, &index->st);
+    if (index->data == NULL)
+        return 0;
+    index->hashlen = hashlen;
+
+    if (index->size < (size_t) (HEADER_LEN + hashlen) ||
+        memcmp(index->data, "DIRC", 4) != 0) {
+        debug("%s: bad index signature", filename);
+        goto err;
+    }
+    index->version = get_be32(index->data + 4);
+    if (index->version < 2 || index->version > 4) {
+        debug("%s: unsupported index version %u", filename, index->version);
+        goto err;
+    }
+    index->nentries = index->nstored = get_be32(index->data + 8);
+    debug("read index %s: version %u, %u entries",
+          filename, index->version, index->nentries);
+    if (!open_shared(index, dirfd))
+        goto err;
+    return 1;
+
+ err:
+    gitindex_close(index);
+    return 0;
+}
+
+void
+gitindex_close(gitindex_t *index)
+{
+    if (index->shared != NULL) {
+        gitindex_close(index->shared);
+        free(index->shared);
+        index->shared = NULL;
+    }
+    free(index->deleted);
+    index->deleted = index->replaced = NULL;
+    unmap_file((void *) index->data, index->size);
+    index->data = NULL;
+    index->size = 0;
+}
+
+static void
+cursor_init(gitindex_cursor_t *cursor, const gitindex_t *index)
+{
+    cursor->index = index;
+    cursor->offset = HEADER_LEN;
+    cursor->pos = 0;
+    cursor->name[0] = '\0';
+    cursor->namelen = 0;
+}
+
+int
+gitindex_decode_varint(const unsigned char **p, const unsigned char *end,
+                       size_t *value)
+{
+    const unsigned char *buf = *p;
+    size_t val;
+    unsigned char c;
+
+    if (buf >= end)
+        return 0;
+    c = *buf++;
+    val = c & 0x7f;
+    while (c & 0x80) {
+        if (buf >= end || val > ((size_t) -1 >> 8))
+            return 0;
+        c = *buf++;
+        val = ((val + 1) << 7) | (c & 0x7f);
+    }
+    *p = buf;
+    *value = val;
+    return 1;
+}
+
+/* Decode the next entry stored in the index file of cursor. */
+static int
+cursor_next(gitindex_cursor_t *cursor, gitindex_entry_t *entry)
+{
+    const gitindex_t *index = cursor->index;
+    const unsigned char *end = index->data + index->size - index->hashlen;
+    const unsigned char *p = index->data + cursor->offset;
+    size_t fixedlen = ENTRY_OID_OFS + index->hashlen + 2;
+
+    if (cursor->pos >= index->nstored)
+        return 0;
+    if (p + fixedlen > end)
+        goto corrupt;
+
+    entry->ctime_sec = get_be32(p);
+    entry->ctime_nsec = get_be32(p + 4);
+    entry->mtime_sec = get_be32(p + 8);
+    entry->mtime_nsec = get_be32(p + 12);
+    entry->dev = get_be32(p + 16);
+    entry->ino = get_be32(p + 20);
+    entry->mode = get_be32(p + 24);
+    entry->uid = get_be32(p + 28);
+    entry->gid = get_be32(p + 32);
+    entry->size = get_be32(p + 36);
+    entry->oid = p + ENTRY_OID_OFS;
+    entry->flags = get_be16(p + ENTRY_OID_OFS + index->hashlen);
+    if (entry->flags & GITINDEX_EXTENDED) {
+        if (index->version < 3 || p + fixedlen + 2 > end)
+            goto corrupt;
+        entry->flags |= get_be16(p + fixedlen) << 16;
+        fixedlen += 2;
+    }
+    p += fixedlen;
+
+    const unsigned char *nul;
+    if (index->version == 4) {
+        /* path is prefix-compressed against the previous entry:
+           strip N bytes from the previous name, then append the
+           NUL-terminated suffix */
+        size_t strip;
+        if (!gitindex_decode_varint(&p, end, &strip) ||
+            strip > cursor->namelen)
+            goto corrupt;
+        nul = memchr(p, '\0', end - p);
+        if (nul == NULL)
+            goto corrupt;
+        size_t keep = cursor->namelen - strip;
+        size_t suffixlen = nul - p;
+        if (keep + suffixlen >= sizeof(cursor->name))
+            goto corrupt;
+        memcpy(cursor->name + keep, p, suffixlen + 1);
+        cursor->namelen = keep + suffixlen;
+        cursor->offset = (nul + 1) - index->data;
+    }
+    else {
+        /* path is NUL-terminated and the whole entry is padded with
+           1-8 NULs to a multiple of 8 bytes */
+        nul = memchr(p, '\0', end - p);
+        if (nul == NULL)
+            goto corrupt;
+        size_t namelen = nul - p;
+        if (namelen >= sizeof(cursor->name))
+            goto corrupt;
+        memcpy(cursor->name, p, namelen + 1);
+        cursor->namelen = namelen;
+        cursor->offset += (fixedlen + namelen + 8) & ~7;
+        if (index->data + cursor->offset > end)
+            goto corrupt;
+    }
+    entry->name = cursor->name;
+    entry->namelen = cursor->namelen;
+    cursor->pos++;
+    return 1;
+
+ corrupt:
+    debug("index entry %u is corrupt", cursor->pos);
+    return -1;
+}
+
+void
+gitindex_iter_init(gitindex_iter_t *iter, const gitindex_t *index)
+{
+    gitindex_entry_t entry;
+    unsigned int i;
+
+    iter->index = index;
+    iter->pos = 0;
+    cursor_init(&iter->own, index);
+    if (index->shared == NULL)
+        return;
+
+    /* the entries that replace shared ones come first: the rest are
+       new, to be merged with the shared entries */
+    cursor_init(&iter->shared, index->shared);
+    cursor_init(&iter->replace, index);
+    iter->ownok = iter->sharedok = NOT_READ;
+    for (i = 0; i < index->nreplaced; i++) {
+        if (cursor_next(&iter->own, &entry) <= 0) {
+            iter->ownok = -1;
+            break;
+        }
+    }
+}
+
+/* Read the next entry of the shared index that survives the split
+ * index: skip the deleted ones, and take the replaced ones from the
+ * split index (where they have an empty name).
+ */
+static int
+shared_next(gitindex_iter_t *iter, gitindex_entry_t *entry)
+{
+    const gitindex_t *index = iter->index;
+    gitindex_entry_t replacement;
+    int ok;
+
+    while ((ok = cursor_next(&iter->shared, entry)) > 0) {
+        unsigned int i = iter->shared.pos - 1;
+        if (index->deleted[i])
+            continue;
+        if (index->replaced[i]) {
+            if (cursor_next(&iter->replace, &replacement) <= 0 ||
+                replacement.namelen != 0) {
+                debug("split index: bad replacement for shared entry %u", i);
+                return -1;
+            }
+            replacement.name = entry->name;
+            replacement.namelen = entry->namelen;
+            *entry = replacement;
+        }
+        break;
+    }
+    return ok;
+}
+
+/* Order two entries like git does: by name, then by stage. */
+static int
+cmp_entries(const gitindex_entry_t *a, const gitindex_entry_t *b)
+{
+    int cmp = strcmp(a->name, b->name);
+    if (cmp != 0)
+        return cmp;
+    return (int) (a->flags & GITINDEX_STAGEMASK) -
+        (int) (b->flags & GITINDEX_STAGEMASK);
+}
+
+int
+gitindex_next(gitindex_iter_t *iter, gitindex_entry_t *entry)
+{
+    int ok;
+
+    if (iter->index->shared == NULL) {
+        if ((ok = cursor_next(&iter->own, entry)) > 0)
+            iter->pos++;
+        return ok;
+    }
+
+    /* split index: merge the new entries into the shared ones */
+    if (iter->ownok == NOT_READ)
+        iter->ownok = cursor_next(&iter->own, &iter->ownentry);
+    if (iter->sharedok == NOT_READ)
+        iter->sharedok = shared_next(iter, &iter->sharedentry);
+    if (iter->ownok < 0 || iter->sharedok < 0)
+        return -1;
+    if (iter->ownok == 0 && iter->sharedok == 0)
+        return 0;
+
+    int cmp = (iter->ownok == 0) ? 1
+        : (iter->sharedok == 0) ? -1
+        : cmp_entries(&iter->ownentry, &iter->sharedentry);
+    if (cmp == 0) {
+        /* git never adds an entry that is still in the shared index */
+        debug("split index: %s is both shared and new",
+              iter->ownentry.name);
+        return -1;
+    }
+    if (cmp < 0) {
+        *entry = iter->ownentry;
+        iter->ownok = NOT_READ;
+    }
+    else {
+        *entry = iter->sharedentry;
+        iter->sharedok = NOT_READ;
+    }
+    iter->pos++;
+    return 1;
+}
+
+int
+gitindex_load_names(const gitindex_t *index, gitindex_names_t *names)
+{
+    gitindex_iter_t iter;
+    gitindex_entry_t entry;
+    size_t *offsets = NULL;
+    size_t used = 0, alloc = 0;
+    unsigned int i;
+    int ok;
+
+    names->names = NULL;
+    names->n = 0;
+    names->pool = NULL;
+    if (index->nentries == 0)
+        return 1;
+
+    offsets = malloc(index->nentries * sizeof(size_t));
+    names->names = malloc(index->nentries * sizeof(char *));
+    if (offsets == NULL || names->names == NULL)
+        goto err;
+
+    gitindex_iter_init(&iter, index);
+    while ((ok = gitindex_next(&iter, &entry)) > 0) {
+        if (used + entry.namelen + 1 > alloc) {
+            /* the names of a split index are mostly in the shared one */
+            size_t newalloc = alloc ? alloc * 2 : index->size +
+                (index->shared != NULL ? index->shared->size : 0);
+            while (used + entry.namelen + 1 > newalloc)
+                newalloc *= 2;
+            char *pool = realloc(names->pool, newalloc);
+            if (pool == NULL)
+                goto err;
+            names->pool = pool;
+            alloc = newalloc;
+        }
+        memcpy(names->pool + used, entry.name, entry.namelen + 1);
+        offsets[names->n++] = used;
+        used += entry.namelen + 1;
+    }
+    if (ok < 0)
+        goto err;
+
+    /* only now that the pool has stopped moving */
+    for (i = 0; i < names->n; i++)
+        names->names[i] = names->pool + offsets[i];
+    free(offsets);
+    return 1;
+
+ err:
+    free(offsets);
+    gitindex_free_names(names);
+    return 0;
+}
+
+void
+gitindex_free_names(gitindex_names_t *names)
+{
+    free(names->names);
+    free(names->pool);
+    names->names = NULL;
+    names->pool = NULL;
+    names->n = 0;
+}
+
+/* strcmp() name against the first len chars of path */
+static int
+cmp_name(const char *name, const char *path, size_t len)
+{
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (name[i] != path[i])
+            return (unsigned char) name[i] - (unsigned char) path[i];
+    }
+    return (name[i] == '\0') ? 0 : 1;
+}
+
+unsigned int
+gitindex_lower_bound(const gitindex_names_t *names,
+                     const char *path, size_t len)
+{
+    unsigned int lo = 0, hi = names->n;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (cmp_name(names->names[mid], path, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the offset of the first extension, i.e. the end of the
+ * entries, or 0 if the index is corrupt.  git records it in the EOIE
+ * extension (the last one) when index.recordEndOfIndexEntries is set;
+ * otherwise we have to decode every entry to get there.
+ */
+static size_t
+extensions_offset(const gitindex_t *index)
+{
+    size_t eoielen = 8 + 4 + index->hashlen;
+    size_t end = index->size - index->hashlen;
+    gitindex_cursor_t cursor;
+    gitindex_entry_t entry;
+    int ok;
+
+    if (end >= HEADER_LEN + eoielen) {
+        const unsigned char *eoie = index->data + end - eoielen;
+        if (memcmp(eoie, "EOIE", 4) == 0 &&
+            get_be32(eoie + 4) == 4 + (unsigned int) index->hashlen) {
+            size_t offset = get_be32(eoie + 8);
+            if (offset >= HEADER_LEN && offset <= end - eoielen)
+                return offset;
+        }
+    }
+
+    cursor_init(&cursor, index);
+    while ((ok = cursor_next(&cursor, &entry)) > 0)
+        ;
+    return (ok < 0) ? 0 : cursor.offset;
+}
+
+const unsigned char *
+gitindex_extension(gitindex_t *index, const char *sig, size_t *size)
+{
+    size_t end = index->size - index->hashlen;
+    size_t offset;
+
+    if (index->extoffset == 0)
+        index->extoffset = extensions_offset(index);
+    if ((offset = index->extoffset) == 0)
+        return NULL;
+    while (offset + 8 <= end) {
+        const unsigned char *ext = index->data + offset;
+        size_t extsize = get_be32(ext + 4);
+        if (extsize > end - offset - 8) {
+            debug("index extension %.4s is corrupt", (const char *) ext);
+            return NULL;
+        }
+        if (memcmp(ext, sig, 4) == 0) {
+            *size = extsize;
+            return ext + 8;
+        }
+        offset += 8 + extsize;
+    }
+    return NULL;
+}
+
+/* The TREE extension is the cache-tree: one record per directory,
+ * root first, each "<path>\0<entries> <subtrees>\n" followed by the
+ * directory's tree ID, unless <entries> is -1 because a change to the
+ * index has invalidated it.
+ */
+int
+gitindex_cache_tree(gitindex_t *index, char *oid)
+{
+    const unsigned char *p, *end;
+    size_t size;
+    char *stop;
+    long entries;
+
+    if ((p = gitindex_extension(index, "TREE", &size)) == NULL)
+        return 0;
+    end = p + size;
+    if (size < 1 || *p != '\0')         /* the root's path is empty */
+        return 0;
+    p++;
+    /* the count is ASCII, terminated by a space well within size */
+    if (memchr(p, ' ', end - p) == NULL)
+        return 0;
+    entries = strtol((const char *) p, &stop, 10);
+    if (*stop != ' ' || entries < 0)
+        return 0;
+    p = memchr(p, '\n', end - p);
+    if (p == NULL || end - p - 1 < index->hashlen)
+        return 0;
+    dump_hex(oid, (const char *) p + 1, index->hashlen);
+    return 1;
+}
+
+/* The bitmap is a sequence of "marker" words, each followed by some
+ * literal words: the marker says how many all-zero or all-one words
+ * come first (bit 0 says which, bits 1-32 say how many) and how many
+ * literal words follow it (bits 33-63).
+ */
+int
+gitindex_read_ewah(const unsigned char **p, const unsigned char *end,
+                   unsigned char *flags, unsigned int nbits)
+{
+    unsigned int nwords, w;
+    unsigned long long pos = 0;
+
+    if (end - *p < 12)
+        return 0;
+    nwords = get_be32(*p + 4);
+    if ((size_t) (end - *p - 12) / 8 < nwords)
+        return 0;
+    const unsigned char *words = *p + 8;
+    *p += 12 + (size_t) nwords * 8;
+    if (flags == NULL)
+        return 1;
+
+    for (w = 0; w < nwords; ) {
+        unsigned long long marker = get_be64(words + 8 * w++);
+        unsigned long long run = (marker >> 1) & 0xffffffffULL;
+        unsigned int nlit = marker >> 33;
+
+        if (marker & 1) {
+            unsigned long long bit;
+            for (bit = pos; bit < pos + run * 64 && bit < nbits; bit++)
+                flags[bit] = 1;
+        }
+        pos += run * 64;
+        if (nlit > nwords - w)
+            return 0;
+        for (; nlit > 0; nlit--, pos += 64) {
+            unsigned long long lit = get_be64(words + 8 * w++);
+            int b;
+            for (b = 0; b < 64; b++) {
+                if ((lit >> b & 1) && pos + b < nbits)
+                    flags[pos + b] = 1;
+            }
+        }
+    }
+    return 1;
+}
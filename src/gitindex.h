@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITINDEX_H
+#define GITINDEX_H
+
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* Reader for git's index file (.git/index), versions 2, 3 and 4.  See
+ * Documentation/gitformat-index.txt in the git source for the gory
+ * details.  The whole file is mmap()ed and entries are decoded on the
+ * fly, so opening even a huge index costs next to nothing.
+ *
+ * A split index (core.splitIndex) keeps most entries in a shared index
+ * (sharedindex.<hash>), and only the changes to it in .git/index: the
+ * two are merged on the fly as well.
+ */
+
+/* entry flags: the low 16 bits are the on-disk flags, the high 16 bits
+ * are the extended flags (index version >= 3) */
+#define GITINDEX_ASSUME_VALID   0x8000
+#define GITINDEX_EXTENDED       0x4000
+#define GITINDEX_STAGEMASK      0x3000
+#define GITINDEX_SKIP_WORKTREE  (0x4000 << 16)
+#define GITINDEX_INTENT_TO_ADD  (0x2000 << 16)
+
+/* file type bits of an index entry's mode */
+#define GITINDEX_S_IFGITLINK    0160000
+
+typedef struct gitindex {
+    const unsigned char *data;          /* mmap()ed index file */
+    size_t size;
+    struct stat st;                     /* stat() info of the index file */
+    unsigned int version;
+    unsigned int nentries;              /* including the shared index's */
+    int hashlen;                        /* 20 for SHA-1, 32 for SHA-256 */
+    size_t extoffset;                   /* of extensions (0: not known yet) */
+
+    /* split index only: the shared index, and which of its entries
+       the ones stored here delete or replace */
+    struct gitindex *shared;            /* NULL if not split */
+    unsigned int nstored;               /* entries stored in this file */
+    unsigned int nreplaced;
+    unsigned char *deleted;             /* one flag per shared entry */
+    unsigned char *replaced;            /* ditto */
+} gitindex_t;
+
+typedef struct {
+    unsigned int ctime_sec, ctime_nsec;
+    unsigned int mtime_sec, mtime_nsec;
+    unsigned int dev, ino, mode, uid, gid, size;
+    const unsigned char *oid;
+    unsigned int flags;                 /* GITINDEX_* flags */
+    const char *name;                   /* NUL-terminated path */
+    size_t namelen;
+} gitindex_entry_t;
+
+/* position in the entries stored in one index file */
+typedef struct {
+    const gitindex_t *index;
+    size_t offset;                      /* of the next entry */
+    unsigned int pos;                   /* number of entries read so far */
+    char name[PATH_MAX];                /* previous name (needed for v4) */
+    size_t namelen;
+} gitindex_cursor_t;
+
+typedef struct {
+    const gitindex_t *index;
+    unsigned int pos;                   /* number of entries read so far */
+    gitindex_cursor_t own;              /* entries stored in index */
+
+    /* split index only: the shared index's entries, the entries that
+       replace some of them (stored first), and the next entry of
+       each stream that is still to be merged (ok: 1 if there is one,
+       0 at the end, -1 if corrupt, 2 if not read yet) */
+    gitindex_cursor_t shared, replace;
+    gitindex_entry_t ownentry, sharedentry;
+    int ownok, sharedok;
+} gitindex_iter_t;
+
+/* Open and mmap() the index file filename (relative to dirfd) and
+ * check its header, along with the shared index in the same directory
+ * if it is a split index.  hashlen is the length of the repository's
+ * object IDs in bytes.  Return 1 on success, 0 on any error (with
+ * debug() messages).  Caller must release the index with
+ * gitindex_close().
+ */
+int
+gitindex_open(gitindex_t *index, int dirfd, const char *filename, int hashlen);
+
+void
+gitindex_close(gitindex_t *index);
+
+/* Prepare iter to walk over the entries of index in order. */
+void
+gitindex_iter_init(gitindex_iter_t *iter, const gitindex_t *index);
+
+/* Decode the next entry of the index into entry.  entry->name points
+ * into iter, so it is only valid until the next call.  Return 1 if an
+ * entry was read, 0 at the end of the entries, and -1 if the index is
+ * corrupt.
+ */
+int
+gitindex_next(gitindex_iter_t *iter, gitindex_entry_t *entry);
+
+/* The paths of all entries of an index, in index (i.e. strcmp()) order.
+ * Unmerged paths appear once per stage.
+ */
+typedef struct {
+    const char **names;
+    unsigned int n;
+    char *pool;                         /* storage for the names */
+} gitindex_names_t;
+
+/* Load the paths of all entries of index into names.  Return 1 on
+ * success, 0 on error (corrupt index or out of memory).  Caller must
+ * call gitindex_free_names().
+ */
+int
+gitindex_load_names(const gitindex_t *index, gitindex_names_t *names);
+
+void
+gitindex_free_names(gitindex_names_t *names);
+
+/* Return the position of the first path in names that sorts at or
+ * after the first len chars of path (i.e. names->n if there is none).
+ */
+unsigned int
+gitindex_lower_bound(const gitindex_names_t *names,
+                     const char *path, size_t len);
+
+/* Find the extension with 4-byte signature sig (e.g. "TREE") in index.
+ * Return a pointer to its data (in the mmap()ed index) and store its
+ * length in *size, or return NULL if there is no such extension.
+ */
+const unsigned char *
+gitindex_extension(gitindex_t *index, const char *sig, size_t *size);
+
+/* If the cache-tree (TREE extension) of index is valid for the whole
+ * tree, copy the ID of the root tree it records to oid, in hex (which
+ * must hold 2 * hashlen + 1 chars), and return 1.  That is the tree
+ * "git write-tree" would write for the index right now.  Return 0 if
+ * there is no cache-tree, or it has been invalidated since.
+ */
+int
+gitindex_cache_tree(gitindex_t *index, char *oid);
+
+/* Decode one of git's variable-width integers (the same encoding as
+ * ofs-delta offsets in packfiles, used by index v4 and some index
+ * extensions) at *p, not reading past end.  Advance *p past it and
+ * return 1, or return 0 on malformed input.
+ */
+int
+gitindex_decode_varint(const unsigned char **p, const unsigned char *end,
+                       size_t *value);
+
+/* Read an EWAH-compressed bitmap (git's ewah/ewah_io.c format, used by
+ * several index extensions) at *p, not reading past end, and advance
+ * *p past it.  Set flags[i] for each bit i < nbits set in the bitmap;
+ * flags may be NULL to just skip it.  Return 0 if it is corrupt.
+ */
+int
+gitindex_read_ewah(const unsigned char **p, const unsigned char *end,
+                   unsigned char *flags, unsigned int nbits);
+
+#endif
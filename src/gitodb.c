@@ -0,0 +1,551 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "common.h"
+#include "gitodb.h"
+
+#define FANOUT_LEN (256 * 4)
+#define IDX_V2_HEADER_LEN 8
+#define MIDX_HEADER_LEN 12
+#define CHUNK_TOC_ENTRY_LEN 12
+
+/* The start of a commit object, as far as its tree: "commit <size>\0"
+ * (loose objects only), then "tree <hex>\n".  Inflating that much
+ * never takes more than COMMIT_READ_LEN bytes of compressed data.
+ */
+#define COMMIT_HEAD_LEN (32 + 5 + GIT_MAX_HEXSZ + 1)
+#define COMMIT_READ_LEN 512
+#define OBJ_COMMIT 1                    /* object type in a pack */
+
+/* One sorted list of object IDs: from the multi-pack-index, or from
+ * a pack .idx file.
+ */
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    const unsigned char *fanout;
+    const unsigned char *oids;
+    size_t stride;                      /* from one object ID to the next */
+    unsigned int nobjects;
+    const char *packnames;              /* midx only: the .idx files it */
+    size_t packnameslen;                /* covers, NUL-terminated */
+} oidlist_t;
+
+/* What we know so far about abbreviating one object ID. */
+typedef struct {
+    unsigned char oid[GIT_MAX_RAWSZ];
+    int hashlen;
+    int common;                 /* most leading hex digits another
+                                   object shares with oid */
+} abbrev_t;
+
+static void
+close_list(oidlist_t *list)
+{
+    unmap_file((void *) list->data, list->size);
+    list->data = NULL;
+}
+
+/* Map objects/pack/multi-pack-index (packfd is objects/pack) and find
+ * its chunks.  Return 1 on success, 0 if there is none or it cannot
+ * be used.
+ */
+static int
+open_midx(oidlist_t *list, int packfd, int hashlen)
+{
+    const unsigned char *p, *end;
+    int hashver = (hashlen == 32) ? 2 : 1;
+
+    memset(list, 0, sizeof(*list));
+    if (faccessat(packfd, "multi-pack-index", F_OK, 0) < 0)
+        return 0;
+    list->data = map_file(packfd, "multi-pack-index", &list->size, NULL);
+    if (list->data == NULL)
+        return 0;
+
+    p = list->data;
+    if (list->size < (size_t) (MIDX_HEADER_LEN + hashlen) ||
+        memcmp(p, "MIDX", 4) != 0 || (p[4] != 1 && p[4] != 2) ||
+        p[5] != hashver || p[7] != 0) {
+        debug("multi-pack-index: unsupported format");
+        goto err;
+    }
+    unsigned int nchunks = p[6];
+    end = list->data + list->size - hashlen;
+    if (MIDX_HEADER_LEN + (nchunks + 1) * CHUNK_TOC_ENTRY_LEN > list->size)
+        goto err;
+    for (unsigned int i = 0; i < nchunks; i++) {
+        const unsigned char *entry =
+            p + MIDX_HEADER_LEN + i * CHUNK_TOC_ENTRY_LEN;
+        unsigned long long start = get_be64(entry + 4);
+        unsigned long long stop = get_be64(entry + CHUNK_TOC_ENTRY_LEN + 4);
+        if (start > stop || stop > (unsigned long long) (end - p))
+            goto err;
+        if (memcmp(entry, "OIDF", 4) == 0 && stop - start == FANOUT_LEN)
+            list->fanout = p + start;
+        else if (memcmp(entry, "OIDL", 4) == 0)
+            list->oids = p + start;
+        else if (memcmp(entry, "PNAM", 4) == 0) {
+            list->packnames = (const char *) p + start;
+            list->packnameslen = stop - start;
+        }
+    }
+    if (list->fanout == NULL || list->oids == NULL || list->packnames == NULL)
+        goto err;
+    list->stride = hashlen;
+    list->nobjects = get_be32(list->fanout + FANOUT_LEN - 4);
+    if ((size_t) (end - list->oids) / hashlen < list->nobjects)
+        goto err;
+    debug("read multi-pack-index: %u objects", list->nobjects);
+    return 1;
+
+ err:
+    debug("multi-pack-index: unusable");
+    close_list(list);
+    return 0;
+}
+
+/* Return true if the multi-pack-index covers the pack with this .idx. */
+static int
+midx_has_pack(const oidlist_t *midx, const char *idxname)
+{
+    const char *p = midx->packnames, *end = p + midx->packnameslen;
+    size_t len = strlen(idxname);
+
+    while (p < end && *p != '\0') {
+        size_t namelen = strnlen(p, end - p);
+        if (namelen == len && memcmp(p, idxname, len) == 0)
+            return 1;
+        p += namelen + 1;
+    }
+    return 0;
+}
+
+/* Map a pack .idx file (version 1 or 2) in packfd.  Return 1 on
+ * success, 0 if it cannot be used.
+ */
+static int
+open_idx(oidlist_t *list, int packfd, const char *name, int hashlen)
+{
+    const unsigned char *p;
+
+    memset(list, 0, sizeof(*list));
+    list->data = map_file(packfd, name, &list->size, NULL);
+    if (list->data == NULL)
+        return 0;
+
+    p = list->data;
+    if (list->size >= IDX_V2_HEADER_LEN && memcmp(p, "\377tOc", 4) == 0) {
+        if (get_be32(p + 4) != 2) {
+            debug("%s: unsupported pack index version", name);
+            goto err;
+        }
+        list->fanout = p + IDX_V2_HEADER_LEN;
+        list->oids = list->fanout + FANOUT_LEN;
+        list->stride = hashlen;
+    }
+    else if (hashlen == 20) {
+        /* version 1: (offset, object ID) pairs after the fanout */
+        list->fanout = p;
+        list->oids = p + FANOUT_LEN + 4;
+        list->stride = 4 + hashlen;
+    }
+    else
+        goto err;
+    if ((size_t) (list->oids - p) > list->size)
+        goto err;
+    list->nobjects = get_be32(list->fanout + FANOUT_LEN - 4);
+    if ((list->size - (list->oids - p)) / list->stride < list->nobjects)
+        goto err;
+    return 1;
+
+ err:
+    debug("%s: corrupt pack index", name);
+    close_list(list);
+    return 0;
+}
+
+/* Note how many leading hex digits other (raw) shares with ab->oid. */
+static void
+extend_with(abbrev_t *ab, const unsigned char *other)
+{
+    int common = 0;
+
+    for (int i = 0; i < ab->hashlen; i++) {
+        if (other[i] != ab->oid[i]) {
+            if ((other[i] & 0xf0) == (ab->oid[i] & 0xf0))
+                common++;
+            break;
+        }
+        common += 2;
+    }
+    if (common < 2 * ab->hashlen && common > ab->common)
+        ab->common = common;
+}
+
+/* Find where oid (raw) is, or would be, in a sorted list, with the
+ * fanout table and a binary search: return its position, and store in
+ * *start and *end the range of object IDs with the same first byte.
+ * Return -1 if the fanout table is corrupt.
+ */
+static long
+search_list(const oidlist_t *list, const unsigned char *oid, int hashlen,
+            unsigned int *start, unsigned int *end)
+{
+    unsigned int first = oid[0];
+    unsigned int lo, hi;
+
+    *start = first ? get_be32(list->fanout + (first - 1) * 4) : 0;
+    *end = get_be32(list->fanout + first * 4);
+    if (*start > *end || *end > list->nobjects)
+        return -1;
+    lo = *start;
+    hi = *end;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (memcmp(list->oids + mid * list->stride, oid, hashlen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* The closest object IDs to ab->oid in a sorted list are the only ones
+ * that can share more digits with it than the rest.
+ */
+static void
+extend_from_list(abbrev_t *ab, const oidlist_t *list)
+{
+    unsigned int start, end, lo;
+    long pos = search_list(list, ab->oid, ab->hashlen, &start, &end);
+
+    if (pos < 0)
+        return;
+    lo = pos;
+    if (lo > start)
+        extend_with(ab, list->oids + (lo - 1) * list->stride);
+    if (lo < end &&
+        memcmp(list->oids + lo * list->stride, ab->oid, ab->hashlen) == 0)
+        lo++;
+    if (lo < end)
+        extend_with(ab, list->oids + lo * list->stride);
+}
+
+/* Compare ab->oid (hex) with the loose objects in its fanout dir. */
+static void
+extend_from_loose(abbrev_t *ab, int commonfd, const char *hex)
+{
+    char path[sizeof("objects/xx")];
+    size_t hexlen = 2 * ab->hashlen;
+    struct dirent *ent;
+    DIR *dir;
+    int fd;
+
+    snprintf(path, sizeof(path), "objects/%.2s", hex);
+    if ((fd = openat(commonfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return;
+    if ((dir = fdopendir(fd)) == NULL) {
+        close(fd);
+        return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        unsigned char other[GIT_MAX_RAWSZ];
+        if (strlen(ent->d_name) != hexlen - 2)
+            continue;
+        other[0] = ab->oid[0];
+        if (parse_hex(other + 1, ent->d_name, ab->hashlen - 1))
+            extend_with(ab, other);
+    }
+    closedir(dir);
+}
+
+int
+gitodb_abbrev_len(const gitrepo_t *repo, const char *oid, int minlen)
+{
+    abbrev_t ab;
+    oidlist_t midx, list;
+    unsigned long count = 0;
+    int have_midx, packfd, len;
+    struct dirent *ent;
+    DIR *dir;
+
+    ab.hashlen = repo->hashlen;
+    ab.common = 0;
+    if (!parse_hex(ab.oid, oid, ab.hashlen))
+        return (minlen > 0) ? minlen : GITODB_DEFAULT_ABBREV;
+
+    packfd = openat(repo->commonfd, "objects/pack",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (packfd >= 0) {
+        if ((have_midx = open_midx(&midx, packfd, ab.hashlen))) {
+            extend_from_list(&ab, &midx);
+            count += midx.nobjects;
+        }
+        if ((dir = fdopendir(dup(packfd))) != NULL) {
+            while ((ent = readdir(dir)) != NULL) {
+                char packname[NAME_MAX + 1];
+                size_t namelen = strlen(ent->d_name);
+                if (namelen < 5 || strcmp(ent->d_name + namelen - 4, ".idx"))
+                    continue;
+                if (have_midx && midx_has_pack(&midx, ent->d_name))
+                    continue;
+                /* like git, ignore an index without its pack */
+                snprintf(packname, sizeof(packname), "%.*s.pack",
+                         (int) namelen - 4, ent->d_name);
+                if (faccessat(packfd, packname, F_OK, 0) < 0 ||
+                    !open_idx(&list, packfd, ent->d_name, ab.hashlen))
+                    continue;
+                extend_from_list(&ab, &list);
+                count += list.nobjects;
+                close_list(&list);
+            }
+            closedir(dir);
+        }
+        if (have_midx)
+            close_list(&midx);
+        close(packfd);
+    }
+    extend_from_loose(&ab, repo->commonfd, oid);
+
+    if (minlen < 0) {
+        /* as many hex digits as half the bits of the object count,
+           rounded up: where collisions start to be likely */
+        int bits = 0;
+        while (count >> bits > 1)
+            bits++;
+        minlen = (bits + 2) / 2;
+        if (minlen < GITODB_DEFAULT_ABBREV)
+            minlen = GITODB_DEFAULT_ABBREV;
+    }
+    len = (ab.common + 1 > minlen) ? ab.common + 1 : minlen;
+    if (len > 2 * ab.hashlen)
+        len = 2 * ab.hashlen;
+    debug("abbreviating %s to %d digits (%lu packed objects)",
+          oid, len, count);
+    return len;
+}
+
+#if HAVE_ZLIB
+/* Inflate the start of the zlib stream in (inlen bytes), up to outlen
+ * bytes, to out.  Return the number of bytes inflated, -1 on error.
+ */
+static int
+inflate_head(const unsigned char *in, size_t inlen, char *out, size_t outlen)
+{
+    z_stream zs;
+    int status;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK)
+        return -1;
+    zs.next_in = (unsigned char *) in;
+    zs.avail_in = inlen;
+    zs.next_out = (unsigned char *) out;
+    zs.avail_out = outlen;
+    status = inflate(&zs, Z_SYNC_FLUSH);
+    inflateEnd(&zs);
+    /* Z_BUF_ERROR: stopped short of the end, which is the idea */
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+        return -1;
+    return outlen - zs.avail_out;
+}
+
+/* Copy the tree ID from the "tree <hex>\n" line that starts the data
+ * of a commit (len bytes of it) to tree.  Return 1 on success.
+ */
+static int
+parse_commit_tree(const char *data, int len, int hashlen, char *tree)
+{
+    unsigned char raw[GIT_MAX_RAWSZ];
+    int hexlen = 2 * hashlen;
+
+    if (len < 5 + hexlen + 1 || memcmp(data, "tree ", 5) != 0 ||
+        data[5 + hexlen] != '\n' || !parse_hex(raw, data + 5, hashlen))
+        return 0;
+    memcpy(tree, data + 5, hexlen);
+    tree[hexlen] = '\0';
+    return 1;
+}
+
+/* Look for commit oid (in hex) among the loose objects.  Return 1 if
+ * found (with its tree ID in tree), 0 if not, -1 if it is unreadable.
+ */
+static int
+loose_commit_tree(const gitrepo_t *repo, const char *oid, char *tree)
+{
+    char path[sizeof("objects/xx/") + GIT_MAX_HEXSZ];
+    unsigned char in[COMMIT_READ_LEN];
+    char out[COMMIT_HEAD_LEN];
+    const char *nul;
+    int inlen, len;
+
+    snprintf(path, sizeof(path), "objects/%.2s/%s", oid, oid + 2);
+    if (faccessat(repo->commonfd, path, F_OK, 0) < 0)
+        return 0;
+    inlen = read_file_at(repo->commonfd, path, (char *) in, sizeof(in));
+    len = inflate_head(in, inlen, out, sizeof(out));
+    if (len <= 0 || strncmp(out, "commit ", 7) != 0 ||
+        (nul = memchr(out, '\0', len)) == NULL ||
+        !parse_commit_tree(nul + 1, len - (nul + 1 - out),
+                           repo->hashlen, tree)) {
+        debug("%s: not a readable commit", path);
+        return -1;
+    }
+    return 1;
+}
+
+/* The offset in its pack of the object at pos in a pack .idx, or 0 if
+ * the index is corrupt.
+ */
+static unsigned long long
+idx_offset(const oidlist_t *list, unsigned int pos, int hashlen)
+{
+    const unsigned char *offsets, *end = list->data + list->size;
+    unsigned int offset;
+
+    if (list->stride != (size_t) hashlen)        /* version 1 */
+        return get_be32(list->oids + pos * list->stride - 4);
+
+    /* version 2: object IDs, then CRCs, then offsets, with the top bit
+       set for one of the 64-bit offsets after them */
+    offsets = list->oids + (size_t) list->nobjects * (hashlen + 4);
+    if (offsets + (size_t) (pos + 1) * 4 > end)
+        return 0;
+    offset = get_be32(offsets + pos * 4);
+    if (!(offset & 0x80000000))
+        return offset;
+    offsets += (size_t) list->nobjects * 4 + (offset & 0x7fffffff) * 8ULL;
+    if (offsets + 8 > end)
+        return 0;
+    return get_be64(offsets);
+}
+
+/* Read the commit at offset in the pack file packname (in packfd).
+ * Return 1 on success (with its tree ID in tree), -1 if it is not a
+ * commit we can read: a delta, for instance.
+ */
+static int
+pack_commit_tree(int packfd, const char *packname, unsigned long long offset,
+                 int hashlen, char *tree)
+{
+    unsigned char in[16 + COMMIT_READ_LEN];
+    char out[COMMIT_HEAD_LEN];
+    ssize_t inlen;
+    int fd, len, i;
+
+    if ((fd = openat(packfd, packname, O_RDONLY | O_CLOEXEC)) < 0) {
+        debug("%s: %s", packname, strerror(errno));
+        return -1;
+    }
+    inlen = pread(fd, in, sizeof(in), offset);
+    close(fd);
+    if (inlen <= 0)
+        return -1;
+
+    /* object header: type in bits 4-6 of the first byte, then the
+       size, 7 bits a byte while the top bit is set */
+    if (((in[0] >> 4) & 7) != OBJ_COMMIT) {
+        debug("%s: object at %llu is not a plain commit", packname, offset);
+        return -1;
+    }
+    for (i = 1; in[i - 1] & 0x80; i++) {
+        if (i >= 10 || i >= inlen)
+            return -1;
+    }
+    len = inflate_head(in + i, inlen - i, out, sizeof(out));
+    if (!parse_commit_tree(out, len, hashlen, tree)) {
+        debug("%s: corrupt commit at %llu", packname, offset);
+        return -1;
+    }
+    return 1;
+}
+
+/* Look for commit oid (raw and in hex) in the pack files.  Return as
+ * loose_commit_tree() does.
+ */
+static int
+packed_commit_tree(const gitrepo_t *repo, const unsigned char *raw,
+                   const char *oid, char *tree)
+{
+    oidlist_t list;
+    struct dirent *ent;
+    DIR *dir;
+    int packfd, status = 0;
+
+    packfd = openat(repo->commonfd, "objects/pack",
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (packfd < 0)
+        return 0;
+    if ((dir = fdopendir(dup(packfd))) == NULL) {
+        close(packfd);
+        return 0;
+    }
+    while (status == 0 && (ent = readdir(dir)) != NULL) {
+        char packname[NAME_MAX + 1];
+        unsigned int start, end;
+        long pos;
+        size_t namelen = strlen(ent->d_name);
+        if (namelen < 5 || strcmp(ent->d_name + namelen - 4, ".idx"))
+            continue;
+        snprintf(packname, sizeof(packname), "%.*s.pack",
+                 (int) namelen - 4, ent->d_name);
+        if (faccessat(packfd, packname, F_OK, 0) < 0 ||
+            !open_idx(&list, packfd, ent->d_name, repo->hashlen))
+            continue;
+        pos = search_list(&list, raw, repo->hashlen, &start, &end);
+        if (pos >= 0 && (unsigned long) pos < end &&
+            memcmp(list.oids + pos * list.stride, raw, repo->hashlen) == 0) {
+            unsigned long long offset =
+                idx_offset(&list, pos, repo->hashlen);
+            status = (offset > 0)
+                ? pack_commit_tree(packfd, packname, offset,
+                                   repo->hashlen, tree)
+                : -1;
+        }
+        close_list(&list);
+    }
+    closedir(dir);
+    close(packfd);
+    return status;
+}
+#endif
+
+int
+gitodb_commit_tree(const gitrepo_t *repo, const char *oid, char *tree)
+{
+#if HAVE_ZLIB
+    unsigned char raw[GIT_MAX_RAWSZ];
+    int status;
+
+    if (!parse_hex(raw, oid, repo->hashlen))
+        return 0;
+    if ((status = loose_commit_tree(repo, oid, tree)) == 0)
+        status = packed_commit_tree(repo, raw, oid, tree);
+    if (status > 0)
+        debug("commit %s has tree %s", oid, tree);
+    return status > 0;
+#else
+    debug("built without zlib: cannot read commit %s", oid);
+    return 0;
+#endif
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITODB_H
+#define GITODB_H
+
+#include "gitrepo.h"
+
+/* shortest abbreviation git allows, and its default for small repos */
+#define GITODB_MINIMUM_ABBREV 4
+#define GITODB_DEFAULT_ABBREV 7
+
+/* Work out how many hex digits of oid (in hex) "git rev-parse --short"
+ * would print: the fewest that no other object in the repository
+ * starts with, but at least minlen.  If minlen is negative, start from
+ * git's default instead (core.abbrev=auto), which grows with the
+ * number of packed objects.  Looks only at the sorted object IDs of
+ * the multi-pack-index and of the pack .idx files it does not cover,
+ * mapped read-only, and at the loose objects sharing oid's first byte.
+ * Alternate object dirs are not searched.
+ */
+int
+gitodb_abbrev_len(const gitrepo_t *repo, const char *oid, int minlen);
+
+/* Copy the ID of the root tree of commit oid to tree, both in hex
+ * (tree must hold 2 * hashlen + 1 chars), reading the commit from the
+ * loose objects or the packs.  Only as much of the commit as it takes
+ * to get to its tree is inflated.  Return 1 on success, 0 if there is
+ * no such commit, or it cannot be read natively: e.g. it is stored as
+ * a delta, or vcprompt was built without zlib.
+ */
+int
+gitodb_commit_tree(const gitrepo_t *repo, const char *oid, char *tree);
+
+#endif
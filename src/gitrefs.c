@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "gitreftable.h"
+#include "gitrefs.h"
+
+/* same limit as git's resolve_ref_unsafe() */
+#define MAX_SYMREF_DEPTH 5
+
+static int
+is_hex_oid(const char *s, int hexlen)
+{
+    int i;
+    for (i = 0; i < hexlen; i++) {
+        if (!isxdigit((unsigned char) s[i]))
+            return 0;
+    }
+    return (s[i] == '\0' || isspace((unsigned char) s[i]));
+}
+
+/* HEAD, other pseudo-refs like MERGE_HEAD, and a few special
+ * hierarchies are private to each worktree; all other refs are shared
+ * through the common dir.
+ */
+static int
+is_per_worktree_ref(const char *refname)
+{
+    return (strncmp(refname, "refs/", 5) != 0 ||
+            strncmp(refname, "refs/bisect/", 12) == 0 ||
+            strncmp(refname, "refs/worktree/", 14) == 0 ||
+            strncmp(refname, "refs/rewritten/", 15) == 0);
+}
+
+/* packed-refs records are "<oid> SP <refname> LF", each optionally
+ * followed by a "^<peeled oid> LF" line.  These walk back/forward to
+ * the start of the record containing p (cf. git's refs/packed-backend.c).
+ */
+static const char *
+find_start_of_record(const char *buf, const char *p)
+{
+    while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+        p--;
+    return p;
+}
+
+static const char *
+find_end_of_record(const char *p, const char *end)
+{
+    while (++p < end && (p[-1] != '\n' || p[0] == '^'))
+        ;
+    return p;
+}
+
+/* compare the refname of the record at rec with refname, strcmp()-style */
+static int
+cmp_record(const char *rec, const char *end, int hexlen, const char *refname)
+{
+    const char *p = rec + hexlen + 1;
+    for (; p < end && *p != '\n'; p++, refname++) {
+        if (*refname == '\0')
+            return 1;
+        if (*p != *refname)
+            return (unsigned char) *p - (unsigned char) *refname;
+    }
+    return (*refname == '\0') ? 0 : -1;
+}
+
+/* Is there nothing at filename (or just a directory, which holds
+ * other refs)?  Then the loose ref stored there is missing, rather
+ * than unreadable.
+ */
+static int
+is_missing(int dirfd, const char *filename)
+{
+    struct stat st;
+    if (fstatat(dirfd, filename, &st, 0) < 0)
+        return (errno == ENOENT || errno == ENOTDIR);
+    return S_ISDIR(st.st_mode);
+}
+
+/* Look up refname in packed-refs: binary search if the file says it is
+ * sorted (any git since 2.15), linear scan otherwise.  Return 1 if
+ * found, 0 if not, -1 if packed-refs cannot be read.
+ */
+static int
+packed_refs_lookup(const gitrepo_t *repo, const char *refname, char *oid)
+{
+    int hexlen = 2 * repo->hashlen;
+    size_t size;
+    const char *data = map_file(repo->commonfd, "packed-refs", &size, NULL);
+    const char *p, *end, *found = NULL;
+    int sorted = 0;
+
+    if (data == NULL) {
+        /* no packed-refs, or an empty one: nothing is packed */
+        struct stat st;
+        if (fstatat(repo->commonfd, "packed-refs", &st, 0) < 0)
+            return (errno == ENOENT) ? 0 : -1;
+        return (st.st_size == 0) ? 0 : -1;
+    }
+    p = data;
+    end = data + size;
+
+    if (*p == '#') {
+        const char *eol = memchr(p, '\n', size);
+        if (eol == NULL)
+            goto done;
+        /* "# pack-refs with: peeled fully-peeled sorted " */
+        for (const char *t = p; t + 7 <= eol; t++) {
+            if (memcmp(t, " sorted", 7) == 0 &&
+                (t[7] == ' ' || t + 7 == eol)) {
+                sorted = 1;
+                break;
+            }
+        }
+        p = eol + 1;
+    }
+
+    if (sorted) {
+        const char *lo = p, *hi = end;
+        while (lo < hi) {
+            const char *mid = lo + (hi - lo) / 2;
+            const char *rec = find_start_of_record(lo, mid);
+            int cmp;
+            if (rec + hexlen + 1 >= end)
+                break;
+            cmp = cmp_record(rec, end, hexlen, refname);
+            if (cmp < 0)
+                lo = find_end_of_record(mid, end);
+            else if (cmp > 0)
+                hi = rec;
+            else {
+                found = rec;
+                break;
+            }
+        }
+    }
+    else {
+        for (; p < end; p = find_end_of_record(p, end)) {
+            if (*p != '^' && p + hexlen + 1 < end &&
+                cmp_record(p, end, hexlen, refname) == 0) {
+                found = p;
+                break;
+            }
+        }
+    }
+
+    if (found != NULL) {
+        memcpy(oid, found, hexlen);
+        oid[hexlen] = '\0';
+        debug("found %s in packed-refs%s: %s",
+              refname, sorted ? " (binary search)" : "", oid);
+    }
+
+ done:
+    unmap_file((void *) data, size);
+    if (found == NULL)
+        return 0;
+    if (!is_hex_oid(oid, hexlen)) {
+        debug("packed-refs: bad object ID for %s", refname);
+        return -1;
+    }
+    return 1;
+}
+
+int
+gitrefs_resolve(const gitrepo_t *repo, const char *refname,
+                char *oid, char *target)
+{
+    int hexlen = 2 * repo->hashlen;
+    char name[GITREFS_MAXNAME];
+    char buf[GITREFS_MAXNAME];
+    int depth;
+
+    if (target != NULL)
+        target[0] = '\0';
+    snprintf(name, sizeof(name), "%s", refname);
+
+    for (depth = 0; depth <= MAX_SYMREF_DEPTH; depth++) {
+        if (strstr(name, "..") != NULL || name[0] == '/') {
+            debug("refusing suspicious ref name '%s'", name);
+            return -1;
+        }
+        int fd = is_per_worktree_ref(name) ? repo->gitfd : repo->commonfd;
+        if (repo->reftable && (strcmp(name, "HEAD") == 0 ||
+                               strncmp(name, "refs/", 5) == 0)) {
+            /* .git/HEAD is just a placeholder for older gits */
+            switch (gitreftable_lookup(fd, repo->hashlen, name,
+                                       oid, buf, sizeof(buf))) {
+            case GITREFTABLE_OID:
+                return 1;
+            case GITREFTABLE_SYMREF:
+                if (depth == 0 && target != NULL)
+                    snprintf(target, GITREFS_MAXNAME, "%s", buf);
+                snprintf(name, sizeof(name), "%s", buf);
+                continue;
+            case GITREFTABLE_NONE:
+                return 0;
+            default:
+                return -1;
+            }
+        }
+        if (!read_first_line_at(fd, name, buf, sizeof(buf))) {
+            if (!is_missing(fd, name)) {
+                debug("%s: unable to read ref", name);
+                return -1;
+            }
+            /* not a loose ref: maybe it has been packed */
+            if (strncmp(name, "refs/", 5) != 0)
+                return 0;
+            return packed_refs_lookup(repo, name, oid);
+        }
+        if (strncmp(buf, "ref:", 4) == 0) {
+            char *p = buf + 4;
+            while (isspace((unsigned char) *p))
+                p++;
+            debug("%s is a symbolic ref to '%s'", name, p);
+            if (depth == 0 && target != NULL)
+                snprintf(target, GITREFS_MAXNAME, "%s", p);
+            snprintf(name, sizeof(name), "%s", p);
+            continue;
+        }
+        if (!is_hex_oid(buf, hexlen)) {
+            debug("%s: not a ref: '%s'", name, buf);
+            return -1;
+        }
+        memcpy(oid, buf, hexlen);
+        oid[hexlen] = '\0';
+        return 1;
+    }
+    debug("symbolic ref %s nested too deeply", refname);
+    return -1;
+}
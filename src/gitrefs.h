@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITREFS_H
+#define GITREFS_H
+
+#include "gitrepo.h"
+
+/* longest ref name we handle */
+#define GITREFS_MAXNAME 1024
+
+/* Resolve refname (e.g. "HEAD" or "refs/heads/master") to an object
+ * ID, following symbolic refs, without running git.  Looks for loose
+ * refs in the git dir (HEAD, refs/bisect/..., etc.) or common dir (all
+ * other refs) and then in packed-refs; or, if the repository uses the
+ * reftable format, in the reftable stack of the same dir (pseudo-refs
+ * like MERGE_HEAD are files even then).
+ *
+ * If target is not NULL and refname is a symbolic ref, copy the name
+ * of the ref it points to (just one level) to target, which must hold
+ * GITREFS_MAXNAME chars; otherwise set target to "".  Copy the object
+ * ID in hex to oid, which must hold GIT_MAX_HEXSZ+1 chars.  Return 1
+ * if refname resolved to an object ID, 0 if there is no such ref
+ * (e.g. HEAD points to an unborn branch, in which case target is
+ * still valid), and -1 if some ref could not be read or is corrupt.
+ */
+int
+gitrefs_resolve(const gitrepo_t *repo, const char *refname,
+                char *oid, char *target);
+
+#endif
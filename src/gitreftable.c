@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitindex.h"
+#include "gitreftable.h"
+#include "gitrefs.h"
+#include "gitrepo.h"
+
+/* file header (version 1; version 2 adds a 4-byte hash ID) and footer
+ * (a copy of the header, five 64-bit positions, CRC-32) */
+#define HEADER_LEN_V1 24
+#define HEADER_LEN_V2 28
+#define FOOTER_EXTRA_LEN (5 * 8 + 4)
+
+/* block header: type and 24-bit length; block trailer: 16-bit count
+ * of 24-bit restart offsets */
+#define BLOCK_HEADER_LEN 4
+#define RESTART_LEN 3
+
+#define BLOCK_TYPE_REF   'r'
+#define BLOCK_TYPE_INDEX 'i'
+
+/* value types of ref records */
+#define VALUE_DELETION 0
+#define VALUE_OID      1
+#define VALUE_PEELED   2
+#define VALUE_SYMREF   3
+
+/* how many index levels we are prepared to go down */
+#define MAX_INDEX_DEPTH 8
+
+/* One table of the stack, mapped read-only.  Blocks lie between the
+ * start of the file and the footer; the first one starts with the
+ * file header.
+ */
+typedef struct {
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+    size_t end;                         /* where the footer starts */
+    int headerlen;
+    unsigned int block_size;            /* 0: blocks are not aligned */
+    unsigned long long ref_index;       /* 0: no ref index */
+} table_t;
+
+/* One block: records from recs to restarts, then the restart table. */
+typedef struct {
+    const table_t *table;
+    size_t off;                         /* where the block starts */
+    size_t len;                         /* including any file header */
+    int type;
+    const unsigned char *recs;
+    const unsigned char *restarts;      /* also where the records end */
+    unsigned int nrestarts;
+} block_t;
+
+/* A record as decoded by next_key(): key is not NUL-terminated. */
+typedef struct {
+    char key[GITREFS_MAXNAME];
+    size_t keylen;
+    int type;                           /* value type (low 3 bits) */
+    const unsigned char *value;
+} record_t;
+
+static int
+open_table(table_t *table, int dirfd, const char *name, int hashlen)
+{
+    const unsigned char *p, *footer;
+    int footerlen;
+
+    memset(table, 0, sizeof(*table));
+    table->name = name;
+    table->data = map_file(dirfd, name, &table->size, NULL);
+    if (table->data == NULL)
+        return 0;
+
+    p = table->data;
+    if (table->size < HEADER_LEN_V1 + HEADER_LEN_V1 + FOOTER_EXTRA_LEN ||
+        memcmp(p, "REFT", 4) != 0 || (p[4] != 1 && p[4] != 2)) {
+        debug("%s: not a reftable", name);
+        goto err;
+    }
+    table->headerlen = (p[4] == 1) ? HEADER_LEN_V1 : HEADER_LEN_V2;
+    footerlen = table->headerlen + FOOTER_EXTRA_LEN;
+    if (table->size < (size_t) (table->headerlen + footerlen))
+        goto corrupt;
+    if ((p[4] == 1 && hashlen != 20) ||
+        (p[4] == 2 &&
+         memcmp(p + HEADER_LEN_V1, hashlen == 32 ? "s256" : "sha1", 4) != 0)) {
+        debug("%s: wrong hash function", name);
+        goto err;
+    }
+    table->block_size = get_be24(p + 5);
+
+    table->end = table->size - footerlen;
+    footer = p + table->end;
+    if (memcmp(footer, p, table->headerlen) != 0)
+        goto corrupt;
+    table->ref_index = get_be64(footer + table->headerlen);
+    if (table->ref_index >= table->end)
+        goto corrupt;
+    return 1;
+
+ corrupt:
+    debug("%s: corrupt reftable", name);
+ err:
+    unmap_file((void *) table->data, table->size);
+    table->data = NULL;
+    return 0;
+}
+
+static void
+close_table(table_t *table)
+{
+    unmap_file((void *) table->data, table->size);
+    table->data = NULL;
+}
+
+/* Find the block that starts at off.  Return 1 on success, 0 if there
+ * is none (off is past the last block), or -1 if it is corrupt.
+ */
+static int
+read_block(const table_t *table, size_t off, block_t *block)
+{
+    const unsigned char *p = table->data;
+    size_t hoff = (off == 0) ? table->headerlen : 0;
+
+    if (off + hoff + BLOCK_HEADER_LEN > table->end)
+        return 0;
+    block->table = table;
+    block->off = off;
+    block->type = p[off + hoff];
+    block->len = get_be24(p + off + hoff + 1);
+    if (block->len < hoff + BLOCK_HEADER_LEN + 2 ||
+        block->len > table->end - off)
+        return -1;
+    block->nrestarts = get_be16(p + off + block->len - 2);
+    if (block->nrestarts == 0 ||
+        RESTART_LEN * block->nrestarts + 2 >
+        block->len - hoff - BLOCK_HEADER_LEN)
+        return -1;
+    block->recs = p + off + hoff + BLOCK_HEADER_LEN;
+    block->restarts =
+        p + off + block->len - 2 - RESTART_LEN * block->nrestarts;
+    return 1;
+}
+
+/* Where the block after block starts: blocks are padded with NULs to
+ * the block size, unless the table is not aligned.
+ */
+static size_t
+next_block(const block_t *block)
+{
+    const table_t *table = block->table;
+    size_t end = block->off + block->len;
+
+    if (table->block_size > block->len && end < table->end &&
+        table->data[end] == 0)
+        return block->off + table->block_size;
+    return end;
+}
+
+/* Decode the record at *p into rec, whose key holds the previous key
+ * (prefix compression), and advance *p to its value.
+ */
+static int
+next_key(const block_t *block, const unsigned char **p, record_t *rec)
+{
+    size_t prefixlen, suffix;
+
+    if (!gitindex_decode_varint(p, block->restarts, &prefixlen) ||
+        !gitindex_decode_varint(p, block->restarts, &suffix) ||
+        prefixlen > rec->keylen ||
+        prefixlen + (suffix >> 3) > sizeof(rec->key) ||
+        (size_t) (block->restarts - *p) < (suffix >> 3))
+        return 0;
+    memcpy(rec->key + prefixlen, *p, suffix >> 3);
+    rec->keylen = prefixlen + (suffix >> 3);
+    rec->type = suffix & 7;
+    *p += suffix >> 3;
+    rec->value = *p;
+    return 1;
+}
+
+/* Skip the value of the record just decoded by next_key(). */
+static int
+skip_value(const block_t *block, const unsigned char **p,
+           const record_t *rec, int hashlen)
+{
+    size_t n;
+
+    /* update index, or block position for an index record */
+    if (!gitindex_decode_varint(p, block->restarts, &n))
+        return 0;
+    if (block->type == BLOCK_TYPE_INDEX)
+        return 1;
+    switch (rec->type) {
+    case VALUE_DELETION:
+        n = 0;
+        break;
+    case VALUE_OID:
+        n = hashlen;
+        break;
+    case VALUE_PEELED:
+        n = 2 * hashlen;
+        break;
+    case VALUE_SYMREF:
+        if (!gitindex_decode_varint(p, block->restarts, &n))
+            return 0;
+        break;
+    default:
+        return 0;
+    }
+    if ((size_t) (block->restarts - *p) < n)
+        return 0;
+    *p += n;
+    return 1;
+}
+
+static int
+cmp_key(const record_t *rec, const char *refname, size_t len)
+{
+    size_t n = (rec->keylen < len) ? rec->keylen : len;
+    int cmp = memcmp(rec->key, refname, n);
+    if (cmp != 0)
+        return cmp;
+    return (rec->keylen > len) - (rec->keylen < len);
+}
+
+/* Search block for the first record whose key is >= refname: binary
+ * search over the restart points (whose keys are not prefix
+ * compressed), then a scan from the last one that is not past it.
+ * Return 1 and leave that record in rec, 0 if every key in the block
+ * is smaller, or -1 if the block is corrupt.
+ */
+static int
+seek_block(const block_t *block, const char *refname, record_t *rec,
+           int hashlen)
+{
+    const unsigned char *base = block->table->data + block->off;
+    size_t len = strlen(refname);
+    unsigned int lo = 0, hi = block->nrestarts;
+    const unsigned char *p;
+
+    while (hi - lo > 1) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        p = base + get_be24(block->restarts + RESTART_LEN * mid);
+        rec->keylen = 0;
+        if (p < block->recs || p >= block->restarts ||
+            !next_key(block, &p, rec))
+            return -1;
+        if (cmp_key(rec, refname, len) <= 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    p = base + get_be24(block->restarts + RESTART_LEN * lo);
+    if (p < block->recs || p >= block->restarts)
+        return -1;
+    rec->keylen = 0;
+    while (p < block->restarts) {
+        if (!next_key(block, &p, rec))
+            return -1;
+        if (cmp_key(rec, refname, len) >= 0)
+            return 1;
+        if (!skip_value(block, &p, rec, hashlen))
+            return -1;
+    }
+    return 0;
+}
+
+/* Find the ref block that may hold refname.  Return its offset in
+ * *off and 1, 0 if no block of the table can hold it, or -1 on error.
+ */
+static int
+find_ref_block(const table_t *table, const char *refname, size_t *off,
+               int hashlen)
+{
+    block_t block;
+    record_t rec;
+    size_t pos;
+    int ret;
+
+    if (table->ref_index == 0) {
+        /* no index: try each block in turn */
+        for (pos = 0; (ret = read_block(table, pos, &block)) > 0;
+             pos = next_block(&block)) {
+            if (block.type != BLOCK_TYPE_REF)
+                return 0;
+            if ((ret = seek_block(&block, refname, &rec, hashlen)) != 0) {
+                *off = pos;
+                return ret;
+            }
+        }
+        return ret;
+    }
+
+    /* the index has the last key of each block it points to; an index
+       that is too big for one block is itself indexed */
+    pos = table->ref_index;
+    for (int depth = 0; depth < MAX_INDEX_DEPTH; depth++) {
+        if (read_block(table, pos, &block) <= 0)
+            return -1;
+        if (block.type == BLOCK_TYPE_REF) {
+            *off = pos;
+            return 1;
+        }
+        if (block.type != BLOCK_TYPE_INDEX)
+            return -1;
+        if ((ret = seek_block(&block, refname, &rec, hashlen)) <= 0)
+            return ret;
+        const unsigned char *p = rec.value;
+        if (!gitindex_decode_varint(&p, block.restarts, &pos) ||
+            pos >= table->end)
+            return -1;
+    }
+    return -1;
+}
+
+/* Look refname up in one table: see gitreftable_lookup().  Return -2
+ * if the table has no record for it at all.
+ */
+static int
+table_lookup(const table_t *table, int hashlen, const char *refname,
+             char *oid, char *target, int size)
+{
+    block_t block;
+    record_t rec;
+    size_t off, n;
+    int ret;
+
+    if ((ret = find_ref_block(table, refname, &off, hashlen)) <= 0)
+        return (ret < 0) ? -1 : -2;
+    if (read_block(table, off, &block) <= 0 || block.type != BLOCK_TYPE_REF ||
+        (ret = seek_block(&block, refname, &rec, hashlen)) < 0)
+        return -1;
+    if (ret == 0 || cmp_key(&rec, refname, strlen(refname)) != 0)
+        return -2;
+
+    const unsigned char *p = rec.value;
+    if (!gitindex_decode_varint(&p, block.restarts, &n))
+        return -1;
+    switch (rec.type) {
+    case VALUE_DELETION:
+        debug("%s: %s deleted", table->name, refname);
+        return GITREFTABLE_NONE;
+    case VALUE_OID:
+    case VALUE_PEELED:
+        if ((size_t) (block.restarts - p) < (size_t) hashlen)
+            return -1;
+        dump_hex(oid, (const char *) p, hashlen);
+        debug("%s: %s is %s", table->name, refname, oid);
+        return GITREFTABLE_OID;
+    case VALUE_SYMREF:
+        if (!gitindex_decode_varint(&p, block.restarts, &n) ||
+            (size_t) (block.restarts - p) < n || n >= (size_t) size)
+            return -1;
+        memcpy(target, p, n);
+        target[n] = '\0';
+        debug("%s: %s is a symbolic ref to '%s'",
+              table->name, refname, target);
+        return GITREFTABLE_SYMREF;
+    }
+    return -1;
+}
+
+int
+gitreftable_lookup(int dirfd, int hashlen, const char *refname,
+                   char *oid, char *target, int size)
+{
+    char name[NAME_MAX + 1];
+    const char *list, *p, *eol;
+    size_t listsize;
+    table_t table;
+    int fd, ret = GITREFTABLE_NONE;
+
+    if ((fd = openat(dirfd, "reftable", O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+        < 0) {
+        debug("unable to open reftable dir: %s", strerror(errno));
+        return -1;
+    }
+    list = map_file(fd, "tables.list", &listsize, NULL);
+    if (list == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    /* newest table last */
+    for (eol = list + listsize; eol > list; eol = p) {
+        if (eol[-1] == '\n')
+            eol--;
+        for (p = eol; p > list && p[-1] != '\n'; p--)
+            ;
+        if (eol - p == 0 || eol - p > NAME_MAX || memchr(p, '/', eol - p)) {
+            debug("tables.list: bad table name");
+            ret = -1;
+            break;
+        }
+        memcpy(name, p, eol - p);
+        name[eol - p] = '\0';
+        if (!open_table(&table, fd, name, hashlen)) {
+            ret = -1;
+            break;
+        }
+        ret = table_lookup(&table, hashlen, refname, oid, target, size);
+        close_table(&table);
+        if (ret != -2)
+            break;
+        ret = GITREFTABLE_NONE;
+    }
+    unmap_file((void *) list, listsize);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITREFTABLE_H
+#define GITREFTABLE_H
+
+/* what gitreftable_lookup() found */
+#define GITREFTABLE_NONE   0            /* no such ref, or deleted */
+#define GITREFTABLE_OID    1            /* a ref to an object */
+#define GITREFTABLE_SYMREF 2            /* a symbolic ref */
+
+/* Look refname up in the reftable stack of the git dir open on dirfd:
+ * the tables listed in reftable/tables.list, newest (last) first, so
+ * that the first table with a record for refname decides.  Each table
+ * is mapped read-only and searched by binary search over the restart
+ * points of its ref index (or of each ref block, if it has no index),
+ * so only a few blocks of even a huge table are read.
+ *
+ * For a ref to an object, copy its ID in hex to oid (which must hold
+ * 2 * hashlen + 1 chars); for a symbolic ref, copy the name of the
+ * ref it points to to target (size chars at most).  Return one of the
+ * GITREFTABLE_* values, or -1 on error (e.g. a corrupt table).
+ */
+int
+gitreftable_lookup(int dirfd, int hashlen, const char *refname,
+                   char *oid, char *target, int size);
+
+#endif
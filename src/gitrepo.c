@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitrepo.h"
+
+#define GITFILE_PREFIX "gitdir: "
+
+int
+gitrepo_probe(int dirfd)
+{
+    struct stat st;
+    char buf[PATH_MAX];
+
+    if (fstatat(dirfd, ".git", &st, 0) < 0)
+        return 0;
+    if (S_ISDIR(st.st_mode))
+        return 1;
+    return (S_ISREG(st.st_mode) &&
+            read_first_line_at(dirfd, ".git", buf, sizeof(buf)) &&
+            strncmp(buf, GITFILE_PREFIX, strlen(GITFILE_PREFIX)) == 0);
+}
+
+static int
+open_dir(int dirfd, const char *path)
+{
+    int fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        debug("unable to open directory '%s': %s", path, strerror(errno));
+    return fd;
+}
+
+int
+gitrepo_open(gitrepo_t *repo, int wtfd, const char *worktree)
+{
+    char buf[PATH_MAX];
+    struct stat st;
+
+    repo->gitfd = repo->commonfd = -1;
+    repo->hashlen = 20;
+    repo->reftable = 0;
+    repo->worktree = worktree;
+
+    if (fstatat(wtfd, ".git", &st, 0) < 0) {
+        debug("failed to stat() '.git': %s", strerror(errno));
+        return 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        repo->gitfd = open_dir(wtfd, ".git");
+        strcpy(repo->gitdir, ".git");
+    }
+    else if (read_first_line_at(wtfd, ".git", buf, sizeof(buf)) &&
+             strncmp(buf, GITFILE_PREFIX, strlen(GITFILE_PREFIX)) == 0) {
+        /* relative paths are relative to the dir containing .git */
+        debug("following .git file to '%s'", buf + strlen(GITFILE_PREFIX));
+        repo->gitfd = open_dir(wtfd, buf + strlen(GITFILE_PREFIX));
+        strcpy(repo->gitdir, buf + strlen(GITFILE_PREFIX));
+    }
+    if (repo->gitfd < 0)
+        goto err;
+
+    if (read_first_line_at(repo->gitfd, "commondir", buf, sizeof(buf))) {
+        debug("git dir has commondir '%s'", buf);
+        repo->commonfd = open_dir(repo->gitfd, buf);
+    }
+    else {
+        repo->commonfd = dup(repo->gitfd);
+    }
+    if (repo->commonfd < 0)
+        goto err;
+
+    if (gitrepo_config(repo, "extensions.objectformat", buf, sizeof(buf)) &&
+        strcmp(buf, "sha256") == 0)
+        repo->hashlen = 32;
+    repo->reftable =
+        (gitrepo_config(repo, "extensions.refstorage", buf, sizeof(buf)) &&
+         strcmp(buf, "reftable") == 0);
+    return 1;
+
+ err:
+    gitrepo_close(repo);
+    return 0;
+}
+
+void
+gitrepo_close(gitrepo_t *repo)
+{
+    if (repo->gitfd >= 0)
+        close(repo->gitfd);
+    if (repo->commonfd >= 0)
+        close(repo->commonfd);
+    repo->gitfd = repo->commonfd = -1;
+}
+
+/* Parse the value part of a "name = value" config line (p points just
+ * after the '='): strip whitespace and comments, handle quotes and
+ * backslash escapes.
+ */
+static void
+parse_config_value(const char *p, char *value, int size)
+{
+    int quoted = 0;
+    int len = 0;
+    int trailing = 0;           /* length before unquoted whitespace */
+
+    while (isspace((unsigned char) *p))
+        p++;
+    for (; *p && *p != '\n' && len < size - 1; p++) {
+        if (*p == '"') {
+            quoted = !quoted;
+            continue;
+        }
+        if (!quoted && (*p == ';' || *p == '#'))
+            break;
+        if (*p == '\\' && p[1] != '\0') {
+            p++;
+            switch (*p) {
+            case 'n': value[len++] = '\n'; break;
+            case 't': value[len++] = '\t'; break;
+            case 'b': if (len > 0) len--; break;
+            default: value[len++] = *p;
+            }
+            trailing = len;
+            continue;
+        }
+        value[len++] = *p;
+        if (quoted || !isspace((unsigned char) *p))
+            trailing = len;
+    }
+    value[trailing] = '\0';
+}
+
+/* Scan one config file for section[.subsection].name, calling fn with
+ * each value in turn until it returns nonzero.  Return 1 if fn asked
+ * to stop, else 0.
+ */
+static int
+config_from_file(int dirfd, const char *filename,
+                 const char *section, const char *subsection,
+                 const char *name, gitrepo_config_fn_t fn, void *arg)
+{
+    char line[4096];
+    char value[sizeof(line)];
+    char cur_section[256] = "";
+    char cur_subsection[1024] = "";
+    int have_subsection = 0;
+    int stop = 0;
+    FILE *fp;
+    int fd;
+
+    fd = openat(dirfd, filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    fp = fdopen(fd, "r");
+    if (fp == NULL) {
+        close(fd);
+        return 0;
+    }
+
+    while (!stop && fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        while (isspace((unsigned char) *p))
+            p++;
+        if (*p == '\0' || *p == '#' || *p == ';')
+            continue;
+
+        if (*p == '[') {
+            /* section header: [section], [section "sub"] or the
+               deprecated [section.sub] */
+            size_t n = 0;
+            p++;
+            have_subsection = 0;
+            while (*p && *p != ']' && *p != '.' &&
+                   !isspace((unsigned char) *p) &&
+                   n < sizeof(cur_section) - 1)
+                cur_section[n++] = tolower((unsigned char) *p++);
+            cur_section[n] = '\0';
+            n = 0;
+            if (*p == '.') {
+                p++;
+                while (*p && *p != ']' && n < sizeof(cur_subsection) - 1)
+                    cur_subsection[n++] = tolower((unsigned char) *p++);
+                have_subsection = 1;
+            }
+            else {
+                while (isspace((unsigned char) *p))
+                    p++;
+                if (*p == '"') {
+                    p++;
+                    while (*p && *p != '"' &&
+                           n < sizeof(cur_subsection) - 1) {
+                        if (*p == '\\' && p[1] != '\0')
+                            p++;
+                        cur_subsection[n++] = *p++;
+                    }
+                    have_subsection = 1;
+                }
+            }
+            cur_subsection[n] = '\0';
+            /* "[section] name = value" on one line is legal */
+            p = strchr(p, ']');
+            if (p == NULL)
+                continue;
+            p++;
+            while (isspace((unsigned char) *p))
+                p++;
+            if (*p == '\0' || *p == '#' || *p == ';')
+                continue;
+        }
+
+        if (strcmp(cur_section, section) != 0 ||
+            have_subsection != (subsection != NULL) ||
+            (subsection != NULL && strcmp(cur_subsection, subsection) != 0))
+            continue;
+
+        size_t namelen = 0;
+        while (isalnum((unsigned char) p[namelen]) || p[namelen] == '-')
+            namelen++;
+        if (namelen != strlen(name) || strncasecmp(p, name, namelen) != 0)
+            continue;
+        p += namelen;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '=') {
+            parse_config_value(p + 1, value, sizeof(value));
+        }
+        else if (*p == '\0' || *p == '\n' || *p == '#' || *p == ';') {
+            /* "name" on its own is boolean true */
+            strcpy(value, "true");
+        }
+        else {
+            continue;
+        }
+        debug("read config %s.%s%s%s from %s: '%s'",
+              section, subsection ? subsection : "", subsection ? "." : "",
+              name, filename, value);
+        stop = fn(value, arg);
+    }
+    fclose(fp);
+    return stop;
+}
+
+int
+gitrepo_config_each(const gitrepo_t *repo, const char *key,
+                    gitrepo_config_fn_t fn, void *arg)
+{
+    char section[256];
+    char subsection[1024];
+    const char *dot = strchr(key, '.');
+    const char *lastdot = strrchr(key, '.');
+    const char *name;
+
+    if (dot == NULL || (size_t) (dot - key) >= sizeof(section))
+        return 0;
+    memcpy(section, key, dot - key);
+    section[dot - key] = '\0';
+    for (char *s = section; *s; s++)
+        *s = tolower((unsigned char) *s);
+    name = lastdot + 1;
+    if (lastdot != dot) {
+        size_t sublen = lastdot - dot - 1;
+        if (sublen >= sizeof(subsection))
+            return 0;
+        memcpy(subsection, dot + 1, sublen);
+        subsection[sublen] = '\0';
+    }
+
+    const char *sub = (lastdot != dot) ? subsection : NULL;
+    const char *env;
+    char path[PATH_MAX];
+
+    /* system, then global, then repository config */
+    if (getenv("GIT_CONFIG_NOSYSTEM") == NULL &&
+        config_from_file(AT_FDCWD, "/etc/gitconfig",
+                         section, sub, name, fn, arg))
+        return 1;
+    if ((env = getenv("GIT_CONFIG_GLOBAL")) != NULL) {
+        if (config_from_file(AT_FDCWD, env, section, sub, name, fn, arg))
+            return 1;
+    }
+    else {
+        const char *home = getenv("HOME");
+        if ((env = getenv("XDG_CONFIG_HOME")) != NULL && *env)
+            snprintf(path, sizeof(path), "%s/git/config", env);
+        else if (home != NULL)
+            snprintf(path, sizeof(path), "%s/.config/git/config", home);
+        else
+            path[0] = '\0';
+        if (path[0] &&
+            config_from_file(AT_FDCWD, path, section, sub, name, fn, arg))
+            return 1;
+        if (home != NULL) {
+            snprintf(path, sizeof(path), "%s/.gitconfig", home);
+            if (config_from_file(AT_FDCWD, path,
+                                 section, sub, name, fn, arg))
+                return 1;
+        }
+    }
+    return config_from_file(repo->commonfd, "config",
+                            section, sub, name, fn, arg);
+}
+
+/* For gitrepo_config(): keep the last value seen. */
+typedef struct {
+    char *value;
+    int size;
+    int found;
+} config_last_t;
+
+static int
+config_keep_last(const char *value, void *arg)
+{
+    config_last_t *last = arg;
+    snprintf(last->value, last->size, "%s", value);
+    last->found = 1;
+    return 0;
+}
+
+int
+gitrepo_config(const gitrepo_t *repo, const char *key, char *value, int size)
+{
+    config_last_t last = {value, size, 0};
+    gitrepo_config_each(repo, key, config_keep_last, &last);
+    return last.found;
+}
+
+int
+gitrepo_config_bool(const char *value)
+{
+    return (strcasecmp(value, "true") == 0 ||
+            strcasecmp(value, "yes") == 0 ||
+            strcasecmp(value, "on") == 0 ||
+            strtol(value, NULL, 10) != 0);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITREPO_H
+#define GITREPO_H
+
+#include <limits.h>
+
+/* longest object ID we support (SHA-256), in bytes and in hex */
+#define GIT_MAX_RAWSZ 32
+#define GIT_MAX_HEXSZ (2 * GIT_MAX_RAWSZ)
+
+/* Where the metadata of a git working dir lives.  In a plain repo,
+ * both directories are .git.  In a linked worktree (or a submodule),
+ * .git is a file pointing to the real git dir, which in turn may point
+ * to a "common dir" shared by all worktrees of the repository.
+ */
+typedef struct {
+    int gitfd;                  /* $GIT_DIR: HEAD, index, ... */
+    int commonfd;               /* $GIT_COMMON_DIR: refs, objects, config */
+    int hashlen;                /* 20 for SHA-1, 32 for SHA-256 */
+    int reftable;               /* refs in reftable/, not files? */
+    char gitdir[PATH_MAX];      /* $GIT_DIR, relative to the working dir
+                                   (unless absolute) */
+    const char *worktree;       /* absolute path of the working dir */
+} gitrepo_t;
+
+/* Return true if dirfd is the top of a git working dir: i.e. it
+ * contains a .git directory, or a .git file starting with "gitdir:".
+ */
+int
+gitrepo_probe(int dirfd);
+
+/* Locate the git dir and common dir of the working dir open on wtfd,
+ * whose absolute path is worktree (which must outlive repo).  Return 1
+ * on success, 0 on failure.  Caller must release the resources with
+ * gitrepo_close().
+ */
+int
+gitrepo_open(gitrepo_t *repo, int wtfd, const char *worktree);
+
+void
+gitrepo_close(gitrepo_t *repo);
+
+/* Look up a config variable, e.g. "core.excludesfile" or
+ * "branch.master.merge", in the system, global and repository config
+ * files.  Section and variable names are case-insensitive, subsection
+ * names are not.  The last value found wins, just like with git.
+ * Copy it to value (up to size-1 chars) and return 1 if found, else 0.
+ * include.path directives are not supported.
+ */
+int
+gitrepo_config(const gitrepo_t *repo, const char *key, char *value, int size);
+
+/* Call fn with every value of a (possibly multi-valued) config
+ * variable, in the order git reads them, until it returns nonzero.
+ * Return 1 if fn stopped early, else 0.
+ */
+typedef int (*gitrepo_config_fn_t)(const char *value, void *arg);
+
+int
+gitrepo_config_each(const gitrepo_t *repo, const char *key,
+                    gitrepo_config_fn_t fn, void *arg);
+
+/* Interpret a config value as a boolean the way git does. */
+int
+gitrepo_config_bool(const char *value);
+
+#endif
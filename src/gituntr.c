@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gitindex.h"
+#include "gituntr.h"
+
+/* on-disk stat data: ctime, mtime (sec + nsec), dev, ino, uid, gid,
+ * size, all 32-bit big-endian */
+#define STAT_LEN 36
+
+/* fixed header after the ident: stat data of info/exclude and
+ * core.excludesFile, then dir_flags */
+#define HEADER_LEN (2 * STAT_LEN + 4)
+
+/* Are all hashlen bytes of oid zero (git's "null" object ID)? */
+static int
+is_null_oid(const unsigned char *oid, int hashlen)
+{
+    int i;
+    for (i = 0; i < hashlen; i++) {
+        if (oid[i] != 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Read one directory block and, recursively, those of its
+ * subdirectories (they are stored depth-first).
+ */
+static int
+read_dir(gituntr_t *uc, const unsigned char **p, const unsigned char *end,
+         unsigned int *n, int depth)
+{
+    gituntr_dir_t *dir;
+    const unsigned char *nul;
+    size_t nuntracked, ndirs, i;
+
+    if (*n >= uc->ndirs || depth > PATH_MAX / 2)
+        return 0;
+    dir = &uc->dirs[(*n)++];
+    if (!gitindex_decode_varint(p, end, &nuntracked) ||
+        !gitindex_decode_varint(p, end, &ndirs) ||
+        (nul = memchr(*p, '\0', end - *p)) == NULL)
+        return 0;
+    dir->name = (const char *) *p;
+    dir->nuntracked = nuntracked;
+    dir->ndirs = ndirs;
+    *p = nul + 1;
+
+    dir->untracked = (const char *) *p;
+    for (i = 0; i < nuntracked; i++) {
+        if ((nul = memchr(*p, '\0', end - *p)) == NULL)
+            return 0;
+        *p = nul + 1;
+    }
+    for (i = 0; i < ndirs; i++) {
+        if (!read_dir(uc, p, end, n, depth + 1))
+            return 0;
+    }
+    dir->end = *n;
+    return 1;
+}
+
+int
+gituntr_parse(gituntr_t *uc, const unsigned char *data, size_t size,
+              int hashlen)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = data + size;
+    const unsigned char *nul;
+    unsigned char *valid = NULL, *hashed = NULL;
+    size_t identlen, ndirs;
+    unsigned int i, n = 0;
+
+    memset(uc, 0, sizeof(*uc));
+
+    /* the extension ends with a NUL that we need not look at again */
+    if (size <= 1 || end[-1] != '\0')
+        goto corrupt;
+    end--;
+
+    if (!gitindex_decode_varint(&p, end, &identlen) ||
+        identlen == 0 || identlen > (size_t) (end - p) ||
+        p[identlen - 1] != '\0')
+        goto corrupt;
+    uc->ident = (const char *) p;
+    p += identlen;
+
+    if ((size_t) (end - p) < HEADER_LEN + 2 * (size_t) hashlen + 1)
+        goto corrupt;
+    uc->dir_flags = get_be32(p + 2 * STAT_LEN);
+    p += HEADER_LEN;
+    if (!is_null_oid(p, hashlen))
+        uc->info_exclude_oid = p;
+    if (!is_null_oid(p + hashlen, hashlen))
+        uc->excludes_file_oid = p + hashlen;
+    p += 2 * hashlen;
+    if ((nul = memchr(p, '\0', end - p)) == NULL)
+        goto corrupt;
+    uc->exclude_per_dir = (const char *) p;
+    p = nul + 1;
+
+    if (!gitindex_decode_varint(&p, end, &ndirs) ||
+        ndirs == 0 || ndirs > (size_t) (end - p)) {
+        debug("untracked cache is empty");
+        return 0;
+    }
+    uc->ndirs = ndirs;
+    uc->dirs = calloc(ndirs, sizeof(gituntr_dir_t));
+    valid = calloc(ndirs, 1);
+    hashed = calloc(ndirs, 1);
+    if (uc->dirs == NULL || valid == NULL || hashed == NULL)
+        goto err;
+    if (!read_dir(uc, &p, end, &n, 0) || n != ndirs)
+        goto corrupt;
+
+    /* bitmaps: valid, check-only (not needed here), has .gitignore */
+    if (!gitindex_read_ewah(&p, end, valid, ndirs) ||
+        !gitindex_read_ewah(&p, end, NULL, 0) ||
+        !gitindex_read_ewah(&p, end, hashed, ndirs))
+        goto corrupt;
+    for (i = 0; i < ndirs; i++) {
+        if (valid[i]) {
+            if (end - p < STAT_LEN)
+                goto corrupt;
+            uc->dirs[i].stat = p;
+            p += STAT_LEN;
+        }
+    }
+    for (i = 0; i < ndirs; i++) {
+        if (hashed[i]) {
+            if (end - p < hashlen)
+                goto corrupt;
+            uc->dirs[i].exclude_oid = p;
+            p += hashlen;
+        }
+    }
+    free(valid);
+    free(hashed);
+    debug("read untracked cache: %u dirs", uc->ndirs);
+    return 1;
+
+ corrupt:
+    debug("untracked cache is corrupt");
+ err:
+    free(valid);
+    free(hashed);
+    gituntr_free(uc);
+    return 0;
+}
+
+void
+gituntr_free(gituntr_t *uc)
+{
+    free(uc->dirs);
+    uc->dirs = NULL;
+    uc->ndirs = 0;
+}
+
+int
+gituntr_stat_matches(const gituntr_dir_t *dir, const struct stat *st)
+{
+    const unsigned char *sd = dir->stat;
+    unsigned int ctime_nsec = get_be32(sd + 4);
+    unsigned int mtime_nsec = get_be32(sd + 12);
+
+    /* like git, ignore nanoseconds if they were not recorded, and
+       ignore st_dev */
+    return (get_be32(sd) == (unsigned int) st->st_ctim.tv_sec &&
+            get_be32(sd + 8) == (unsigned int) st->st_mtim.tv_sec &&
+            (ctime_nsec == 0 ||
+             ctime_nsec == (unsigned int) st->st_ctim.tv_nsec) &&
+            (mtime_nsec == 0 ||
+             mtime_nsec == (unsigned int) st->st_mtim.tv_nsec) &&
+            get_be32(sd + 20) == (unsigned int) st->st_ino &&
+            get_be32(sd + 24) == (unsigned int) st->st_uid &&
+            get_be32(sd + 28) == (unsigned int) st->st_gid &&
+            get_be32(sd + 32) == (unsigned int) st->st_size);
+}
+
+void
+gituntr_mtime(const gituntr_dir_t *dir,
+              unsigned int *sec, unsigned int *nsec)
+{
+    *sec = get_be32(dir->stat + 8);
+    *nsec = get_be32(dir->stat + 12);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITUNTR_H
+#define GITUNTR_H
+
+#include <sys/stat.h>
+
+/* Reader for the untracked cache (the "UNTR" index extension, written
+ * when core.untrackedCache is true).  For every directory git has
+ * looked at, it records the stat() info of the directory, the object
+ * ID of its .gitignore, and the untracked names in it; as long as the
+ * directory's mtime has not changed, that list is still accurate.
+ * Everything points into the index data passed to gituntr_parse().
+ */
+
+/* dir_flags of "git status": DIR_SHOW_OTHER_DIRECTORIES |
+ * DIR_HIDE_EMPTY_DIRECTORIES.  Cached lists then contain the untracked
+ * files in a directory, plus "name/" for untracked subdirectories that
+ * contain at least one file that is not ignored. */
+#define GITUNTR_STATUS_FLAGS 6
+
+typedef struct {
+    const char *name;                   /* "" for the top */
+    const char *untracked;              /* nuntracked NUL-terminated names */
+    unsigned int nuntracked;
+    unsigned int ndirs;                 /* number of subdirectories */
+    unsigned int end;                   /* index of the next non-descendant */
+    const unsigned char *stat;          /* on-disk stat data; NULL if invalid */
+    const unsigned char *exclude_oid;   /* of .gitignore; NULL if none */
+} gituntr_dir_t;
+
+typedef struct {
+    const char *ident;                  /* "Location <worktree>, system <os>" */
+    const unsigned char *info_exclude_oid;      /* NULL if no such file */
+    const unsigned char *excludes_file_oid;
+    unsigned int dir_flags;
+    const char *exclude_per_dir;        /* normally ".gitignore" */
+    gituntr_dir_t *dirs;                /* in depth-first order */
+    unsigned int ndirs;
+} gituntr_t;
+
+/* Parse the UNTR extension (data, size bytes long) of an index whose
+ * object IDs are hashlen bytes.  The subdirectories of dirs[i] start at
+ * dirs[i + 1]; each one's siblings follow at dirs[dirs[j].end].  Return
+ * 1 on success, 0 if the extension is corrupt or empty.  Caller must
+ * call gituntr_free().
+ */
+int
+gituntr_parse(gituntr_t *uc, const unsigned char *data, size_t size,
+              int hashlen);
+
+void
+gituntr_free(gituntr_t *uc);
+
+/* Return true if st matches the stat() info cached for dir (which must
+ * be valid), comparing the same fields git does.
+ */
+int
+gituntr_stat_matches(const gituntr_dir_t *dir, const struct stat *st);
+
+/* Return the cached mtime of dir (which must be valid). */
+void
+gituntr_mtime(const gituntr_dir_t *dir,
+              unsigned int *sec, unsigned int *nsec);
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "gitignore.h"
+#include "fsmonitor.h"
+#include "gitindex.h"
+#include "gituntr.h"
+#include "gitwalk.h"
+
+typedef struct {
+    gitignore_t ignore;
+    gitindex_t *index;                  /* NULL if there is none */
+    const fsmonitor_t *fsm;             /* NULL if not in use */
+    gitindex_names_t tracked;
+    const unsigned char *untr;          /* UNTR extension of index */
+    size_t untrsize;
+    gituntr_t uc;                       /* git's untracked cache */
+    char path[PATH_MAX];                /* current path, relative to top */
+} walker_t;
+
+/* Is w->path (len chars) exactly the path of an index entry? */
+static int
+is_tracked(const walker_t *w, size_t len)
+{
+    unsigned int pos = gitindex_lower_bound(&w->tracked, w->path, len);
+    return (pos < w->tracked.n && strcmp(w->tracked.names[pos], w->path) == 0);
+}
+
+/* Is there any index entry below directory w->path (len chars)? */
+static int
+has_tracked_below(walker_t *w, size_t len)
+{
+    unsigned int pos;
+    w->path[len] = '/';
+    pos = gitindex_lower_bound(&w->tracked, w->path, len + 1);
+    w->path[len] = '\0';
+    return (pos < w->tracked.n &&
+            strncmp(w->tracked.names[pos], w->path, len) == 0 &&
+            w->tracked.names[pos][len] == '/');
+}
+
+static int
+entry_type(int dirfd, const struct dirent *de)
+{
+    struct stat st;
+
+    if (de->d_type != DT_UNKNOWN)
+        return de->d_type;
+    if (fstatat(dirfd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+        return DT_UNKNOWN;
+    if (S_ISDIR(st.st_mode))
+        return DT_DIR;
+    if (S_ISREG(st.st_mode))
+        return DT_REG;
+    if (S_ISLNK(st.st_mode))
+        return DT_LNK;
+    return DT_UNKNOWN;
+}
+
+static int
+walk_dir(walker_t *w, int fd, size_t pathlen, int has_tracked,
+         const gituntr_dir_t *cache);
+
+/* Descend into subdirectory name of the directory open on fd (whose
+ * path is w->path, pathlen chars), unless it is excluded or a
+ * submodule.  cache is its entry in the untracked cache, if any.
+ */
+static int
+walk_subdir(walker_t *w, int fd, size_t pathlen, int has_tracked,
+            const char *name, const gituntr_dir_t *cache)
+{
+    size_t namelen = strlen(name);
+    size_t len = pathlen + namelen;
+    int tracked_below = 0;
+    int subfd;
+
+    if (len + 2 > sizeof(w->path))
+        return -1;
+    memcpy(w->path + pathlen, name, namelen + 1);
+    if (has_tracked) {
+        if (is_tracked(w, len))         /* submodule */
+            return 0;
+        tracked_below = has_tracked_below(w, len);
+    }
+    if (gitignore_excluded(&w->ignore, w->path, len, 1))
+        return 0;
+
+    subfd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (subfd < 0) {
+        debug("unable to open directory '%s': %s", w->path, strerror(errno));
+        return -1;
+    }
+    if (!tracked_below &&
+        faccessat(subfd, ".git", F_OK, AT_SYMLINK_NOFOLLOW) == 0) {
+        /* untracked nested repository: git lists it as "name/" */
+        debug("found untracked repository '%s'", w->path);
+        close(subfd);
+        return 1;
+    }
+    w->path[len] = '/';
+    w->path[len + 1] = '\0';
+    return walk_dir(w, subfd, len + 1, tracked_below, cache);
+}
+
+/* Find the untracked cache entry for subdirectory name of cache. */
+static const gituntr_dir_t *
+find_cached_subdir(const walker_t *w, const gituntr_dir_t *cache,
+                   const char *name)
+{
+    unsigned int i, j;
+
+    if (cache == NULL)
+        return NULL;
+    j = (cache - w->uc.dirs) + 1;
+    for (i = 0; i < cache->ndirs; i++, j = w->uc.dirs[j].end) {
+        if (strcmp(w->uc.dirs[j].name, name) == 0)
+            return &w->uc.dirs[j];
+    }
+    return NULL;
+}
+
+/* Search the directory open on fd, whose path is w->path (pathlen
+ * chars: "" for the top, else ending in '/'), for untracked files by
+ * reading it.  Files in the directory itself are checked before
+ * descending into subdirectories.  has_tracked is false if we know the
+ * whole directory is untracked.  cache is the directory's (stale)
+ * entry in the untracked cache, which may still be valid for its
+ * subdirectories.  Takes ownership of fd.  Return 1/0/-1 as for
+ * gitwalk_untracked().
+ */
+static int
+scan_dir(walker_t *w, int fd, size_t pathlen, int has_tracked,
+         const gituntr_dir_t *cache)
+{
+    DIR *dir;
+    struct dirent *de;
+    char *subdirs = NULL;               /* NUL-separated names */
+    size_t sublen = 0, suballoc = 0;
+    int result = 0;
+
+    if ((dir = fdopendir(fd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    errno = 0;
+    while ((de = readdir(dir)) != NULL) {
+        const char *name = de->d_name;
+        size_t namelen = strlen(name);
+        int type;
+
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strcmp(name, ".git") == 0)
+            continue;
+        if (pathlen + namelen + 2 > sizeof(w->path)) {
+            result = -1;
+            break;
+        }
+        type = entry_type(fd, de);
+        if (type == DT_DIR) {
+            if (sublen + namelen + 1 > suballoc) {
+                size_t newalloc = suballoc ? suballoc * 2 : 1024;
+                while (sublen + namelen + 1 > newalloc)
+                    newalloc *= 2;
+                char *p = realloc(subdirs, newalloc);
+                if (p == NULL) {
+                    result = -1;
+                    break;
+                }
+                subdirs = p;
+                suballoc = newalloc;
+            }
+            memcpy(subdirs + sublen, name, namelen + 1);
+            sublen += namelen + 1;
+            continue;
+        }
+        if (type != DT_REG && type != DT_LNK)
+            continue;
+
+        memcpy(w->path + pathlen, name, namelen + 1);
+        if (has_tracked && is_tracked(w, pathlen + namelen))
+            continue;
+        if (gitignore_excluded(&w->ignore, w->path, pathlen + namelen, 0))
+            continue;
+        debug("found untracked file '%s'", w->path);
+        result = 1;
+        break;
+    }
+    if (de == NULL && errno != 0)
+        result = -1;
+
+    for (size_t i = 0; result == 0 && i < sublen; ) {
+        const char *name = subdirs + i;
+        i += strlen(name) + 1;
+        result = walk_subdir(w, fd, pathlen, has_tracked, name,
+                             find_cached_subdir(w, cache, name));
+    }
+
+    closedir(dir);
+    free(subdirs);
+    return result;
+}
+
+/* Like scan_dir(), but for a directory that has not changed since git
+ * recorded its untracked files in cache: use that list instead of
+ * reading the directory, and only visit the subdirectories that git
+ * visited.
+ */
+static int
+walk_cached_dir(walker_t *w, int fd, size_t pathlen, int has_tracked,
+                const gituntr_dir_t *cache)
+{
+    const char *name = cache->untracked;
+    unsigned int i, j;
+    int result = 0;
+
+    for (i = 0; i < cache->nuntracked; i++, name += strlen(name) + 1) {
+        size_t namelen = strlen(name);
+        if (pathlen + namelen + 1 > sizeof(w->path)) {
+            result = -1;
+            break;
+        }
+        memcpy(w->path + pathlen, name, namelen + 1);
+        /* git updates the cache when files are added to the index,
+           but let's not rely on that */
+        if (has_tracked && name[namelen - 1] != '/' &&
+            is_tracked(w, pathlen + namelen))
+            continue;
+        debug("found untracked %s '%s' in untracked cache",
+              name[namelen - 1] == '/' ? "dir" : "file", w->path);
+        result = 1;
+        break;
+    }
+
+    j = (cache - w->uc.dirs) + 1;
+    for (i = 0; result == 0 && i < cache->ndirs; i++) {
+        const gituntr_dir_t *sub = &w->uc.dirs[j];
+        j = sub->end;
+        result = walk_subdir(w, fd, pathlen, has_tracked, sub->name, sub);
+    }
+    close(fd);
+    return result;
+}
+
+/* Can we trust cache, the untracked cache entry for the directory open
+ * on fd (which has just been pushed onto w->ignore)?
+ */
+#define CACHE_NONE  0                   /* no: nor for anything below */
+#define CACHE_STALE 1                   /* no: but maybe for its subdirs */
+#define CACHE_VALID 2                   /* yes */
+
+static int
+check_cached_dir(walker_t *w, int fd, const gituntr_dir_t *cache)
+{
+    const gitignore_file_t *file;
+    struct stat st;
+    unsigned int sec, nsec;
+
+    if (cache == NULL)
+        return CACHE_NONE;
+    file = gitignore_file(&w->ignore, GITIGNORE_TOP);
+    if (!gitignore_file_matches(file, cache->exclude_oid)) {
+        debug("'%s.gitignore' changed: ignoring untracked cache below",
+              w->path);
+        return CACHE_NONE;
+    }
+    if (cache->stat == NULL || fstat(fd, &st) < 0 ||
+        !gituntr_stat_matches(cache, &st))
+        return CACHE_STALE;
+
+    /* racily clean, as for index entries */
+    gituntr_mtime(cache, &sec, &nsec);
+    if (sec > (unsigned int) w->index->st.st_mtim.tv_sec ||
+        (sec == (unsigned int) w->index->st.st_mtim.tv_sec &&
+         nsec >= (unsigned int) w->index->st.st_mtim.tv_nsec))
+        return CACHE_STALE;
+    return CACHE_VALID;
+}
+
+/* Does the untracked cache say that there is nothing untracked in
+ * cache and all its subdirectories?
+ */
+static int
+cached_subtree_clean(const walker_t *w, const gituntr_dir_t *cache)
+{
+    unsigned int i;
+    for (i = cache - w->uc.dirs; i < cache->end; i++) {
+        if (w->uc.dirs[i].stat == NULL || w->uc.dirs[i].nuntracked > 0)
+            return 0;
+    }
+    return 1;
+}
+
+/* Search the directory open on fd, whose path is w->path (pathlen
+ * chars: "" for the top, else ending in '/'), and everything below it
+ * for untracked files, using cache (its entry in the untracked cache)
+ * where possible.  Takes ownership of fd.  Return 1/0/-1 as for
+ * gitwalk_untracked().
+ */
+static int
+walk_dir(walker_t *w, int fd, size_t pathlen, int has_tracked,
+         const gituntr_dir_t *cache)
+{
+    int result;
+
+    if (budget_remaining('u') == 0) {
+        debug("timed out looking for untracked files");
+        close(fd);
+        return -1;
+    }
+
+    /* if the filesystem monitor saw no changes here, the cache is
+       still valid for the whole subtree, .gitignore files included */
+    if (cache != NULL && w->fsm != NULL &&
+        !fsmonitor_dir_changed(w->fsm, w->path, pathlen) &&
+        cached_subtree_clean(w, cache)) {
+        close(fd);
+        return 0;
+    }
+
+    if (!gitignore_push(&w->ignore, fd, w->path, pathlen)) {
+        close(fd);
+        return -1;
+    }
+    switch (check_cached_dir(w, fd, cache)) {
+    case CACHE_VALID:
+        result = walk_cached_dir(w, fd, pathlen, has_tracked, cache);
+        break;
+    case CACHE_STALE:
+        debug("'%s' changed: reading it", pathlen ? w->path : ".");
+        result = scan_dir(w, fd, pathlen, has_tracked, cache);
+        break;
+    default:
+        result = scan_dir(w, fd, pathlen, has_tracked, NULL);
+    }
+    w->path[pathlen] = '\0';
+    gitignore_pop(&w->ignore);
+    return result;
+}
+
+/* Check that the untracked cache in w->index was built by
+ * "git status" for this working dir with the exclude files we have
+ * loaded.  Return 1 if it can be used.
+ */
+static int
+load_untracked_cache(walker_t *w, const gitrepo_t *repo)
+{
+    const gitignore_file_t *file;
+    char value[16];
+    char ident[PATH_MAX + 100];
+    struct utsname uts;
+
+    if (repo->hashlen != SHA1_LEN)
+        return 0;
+    if (gitrepo_config(repo, "core.untrackedcache", value, sizeof(value)) &&
+        strcmp(value, "keep") != 0 && !gitrepo_config_bool(value))
+        return 0;
+    if (!gituntr_parse(&w->uc, w->untr, w->untrsize, repo->hashlen))
+        return 0;
+
+    if (uname(&uts) < 0)
+        goto unusable;
+    snprintf(ident, sizeof(ident), "Location %s, system %s",
+             repo->worktree, uts.sysname);
+    if (strcmp(w->uc.ident, ident) != 0) {
+        debug("untracked cache is for another location: %s", w->uc.ident);
+        goto unusable;
+    }
+    if (w->uc.dir_flags != GITUNTR_STATUS_FLAGS ||
+        strcmp(w->uc.exclude_per_dir, ".gitignore") != 0) {
+        debug("untracked cache has unexpected flags");
+        goto unusable;
+    }
+    file = gitignore_file(&w->ignore, GITIGNORE_INFO);
+    if (!gitignore_file_matches(file, w->uc.info_exclude_oid)) {
+        debug("info/exclude changed since untracked cache was written");
+        goto unusable;
+    }
+    file = gitignore_file(&w->ignore, GITIGNORE_GLOBAL);
+    if (!gitignore_file_matches(file, w->uc.excludes_file_oid)) {
+        debug("core.excludesFile changed since untracked cache was written");
+        goto unusable;
+    }
+    return 1;
+
+ unusable:
+    gituntr_free(&w->uc);
+    return 0;
+}
+
+int
+gitwalk_untracked(const gitrepo_t *repo, gitindex_t *index,
+                  const fsmonitor_t *fsm, int wtfd)
+{
+    walker_t *w;
+    int result = -1;
+    int have_cache = 0;
+    int fd;
+
+    w = calloc(1, sizeof(walker_t));
+    if (w == NULL)
+        return -1;
+
+    /* no index (e.g. fresh "git init"): nothing is tracked */
+    w->index = index;
+    w->fsm = fsm;
+    if (index != NULL) {
+        if (!gitindex_load_names(index, &w->tracked))
+            goto done;
+        w->untr = gitindex_extension(index, "UNTR", &w->untrsize);
+    }
+    if (!gitignore_init(&w->ignore, repo, w->untr != NULL))
+        goto done;
+    have_cache = (w->untr != NULL && load_untracked_cache(w, repo));
+
+    fd = openat(wtfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+        result = walk_dir(w, fd, 0, w->tracked.n > 0,
+                          have_cache ? &w->uc.dirs[0] : NULL);
+    gitignore_free(&w->ignore);
+    gituntr_free(&w->uc);
+
+ done:
+    gitindex_free_names(&w->tracked);
+    free(w);
+    return result;
+}
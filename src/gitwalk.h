@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef GITWALK_H
+#define GITWALK_H
+
+#include "fsmonitor.h"
+#include "gitindex.h"
+#include "gitrepo.h"
+
+/* Walk the git working dir open on wtfd looking for an untracked file
+ * that is not ignored: i.e. the first line that "git ls-files --others
+ * --exclude-standard" would print.  Stops as soon as it finds one, so
+ * the cost depends on where the first untracked file is, not on how
+ * many there are.  index is the repository's index (NULL if there is
+ * none); if it has an untracked cache, only changed directories are
+ * read, and if fsm is not NULL, only those with changes reported by
+ * the filesystem monitor.  Return 1 if there is such a file, 0 if
+ * there is none, and -1 on error (e.g. unreadable directory) or if
+ * the -t timeout expires.
+ */
+int
+gitwalk_untracked(const gitrepo_t *repo, gitindex_t *index,
+                  const fsmonitor_t *fsm, int wtfd);
+
+#endif
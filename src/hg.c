@@ -8,6 +8,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,9 +29,9 @@
 #define NODEID_LEN 20
 
 static int
-hg_probe(vccontext_t *context)
+hg_probe(vccontext_t *context, int dirfd)
 {
-    return isdir(".hg");
+    return isdir_at(dirfd, ".hg");
 }
 
 /* return true if data contains any non-zero bytes */
@@ -68,19 +69,21 @@ typedef struct {
 
 //! get changeset info for the specified nodeid
 static csinfo_t
-get_csinfo(const char *nodeid)
+get_csinfo(int dirfd, const char *nodeid)
 {
     // only supports RevlogNG. See mercurial/parsers.c for details.
     const char *REVLOG_FILENAME = ".hg/store/00changelog.i";
     const size_t ENTRY_LEN = 64, COMP_LEN_OFS = 8, NODEID_OFS = 32;
 
     char buf[ENTRY_LEN];
-    FILE *rlfile;
+    FILE *rlfile = NULL;
     int inlined;
     csinfo_t csinfo = {"", -1, 0};
     int i;
 
-    rlfile = fopen(REVLOG_FILENAME, "rb");
+    int fd = openat(dirfd, REVLOG_FILENAME, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (rlfile = fdopen(fd, "rb")) == NULL)
+        close(fd);
     if (!rlfile) {
         debug("error opening '%s': %s", REVLOG_FILENAME, strerror(errno));
         return csinfo;
@@ -120,12 +123,12 @@ get_csinfo(const char *nodeid)
 }
 
 static size_t
-put_nodeid(char *dest, const char *nodeid)
+put_nodeid(char *dest, int dirfd, const char *nodeid)
 {
     const size_t SHORT_NODEID_LEN = 6;  // size in binary repr
     char *p = dest;
 
-    csinfo_t csinfo = get_csinfo(nodeid);
+    csinfo_t csinfo = get_csinfo(dirfd, nodeid);
     if (csinfo.rev >= 0) {
         p += sprintf(p, "%d", csinfo.rev);
     }
@@ -154,24 +157,24 @@ read_parents(vccontext_t *context, result_t *result)
 
     debug("reading first %d bytes of dirstate to parent_nodes (%p)",
           NODEID_LEN * 2, parent_nodes);
-    readsize = read_file(".hg/dirstate", parent_nodes, NODEID_LEN * 2);
+    readsize = read_file_at(context->dirfd, ".hg/dirstate",
+                            parent_nodes, NODEID_LEN * 2);
     if (readsize != NODEID_LEN * 2) {
         return;
     }
 
-    readsize = read_file(".hg/dirstate", parent_nodes, NODEID_LEN * 2);
     char destbuf[1024] = {'\0'};
     char *p = destbuf;
 
     // first parent
     if (non_zero((unsigned char *) parent_nodes, NODEID_LEN)) {
-        p += put_nodeid(p, parent_nodes);
+        p += put_nodeid(p, context->dirfd, parent_nodes);
     }
 
     // second parent
     if (non_zero((unsigned char *) parent_nodes + NODEID_LEN, NODEID_LEN)) {
         *p++ = ',';
-        p += put_nodeid(p, parent_nodes + NODEID_LEN);
+        p += put_nodeid(p, context->dirfd, parent_nodes + NODEID_LEN);
     }
 
     result_set_revision(result, destbuf, -1);
@@ -190,12 +193,13 @@ read_patch_name(vccontext_t *context, result_t *result)
     char *status_fn = NULL;
     char *last_line = NULL;
 
-    if (stat(".hg/patches.queues", &statbuf) == 0) {
+    if (fstatat(context->dirfd, ".hg/patches.queues", &statbuf, 0) == 0) {
         /* The name of the current patch queue cannot possibly be
            longer than the name of all patch queues concatenated. */
         size_t max_qname = (size_t) statbuf.st_size;
         char *qname = malloc(max_qname + 1);
-        int ok = read_first_line(".hg/patches.queue", qname, max_qname);
+        int ok = read_first_line_at(context->dirfd, ".hg/patches.queue",
+                                    qname, max_qname);
         if (ok && strlen(qname) > 0) {
             debug("read queue name from .hg/patches.queue: '%s'", qname);
             status_fn = malloc(strlen(default_status) + 1 + strlen(qname) + 1);
@@ -210,7 +214,7 @@ read_patch_name(vccontext_t *context, result_t *result)
         status_fn = strdup(default_status);
     }
 
-    if (stat(status_fn, &statbuf) < 0) {
+    if (fstatat(context->dirfd, status_fn, &statbuf, 0) < 0) {
         debug("failed to stat %s: assuming no patch applied", status_fn);
         goto done;
     }
@@ -223,7 +227,8 @@ read_patch_name(vccontext_t *context, result_t *result)
        file */
     size_t max_line = (size_t) statbuf.st_size;
     last_line = malloc(max_line + 1);
-    if (!read_last_line(status_fn, last_line, max_line + 1)) {
+    if (!read_last_line_at(context->dirfd, status_fn,
+                           last_line, max_line + 1)) {
         debug("failed to read from %s: assuming no mq patch applied", status_fn);
         goto done;
     }
@@ -241,6 +246,40 @@ read_patch_name(vccontext_t *context, result_t *result)
     free(last_line);
 }
 
+typedef struct {
+    options_t *options;
+    result_t *result;
+    int at_bol;                 /* next char starts a line */
+} hg_status_t;
+
+/* Scan a chunk of "hg status" output; stop hg once we know all we
+ * need to know.
+ */
+static int
+hg_status_consume(const char *chunk, size_t len, void *arg)
+{
+    hg_status_t *status = arg;
+    options_t *options = status->options;
+    result_t *result = status->result;
+
+    for (size_t i = 0; i < len; i++) {
+        char ch = chunk[i];
+        if (status->at_bol) {
+            // at start of output or start of line: look for ?, M, etc.
+            if (options->show_unknown && ch == '?') {
+                result->unknown = 1;
+            }
+            if (options->show_modified &&
+                (ch == 'M' || ch == 'A' || ch == 'R')) {
+                result->modified = 1;
+            }
+        }
+        status->at_bol = (ch == '\n');
+    }
+    return ((!options->show_unknown || result->unknown) &&
+            (!options->show_modified || result->modified));
+}
+
 static void
 read_modified_unknown(vccontext_t *context, result_t *result)
 {
@@ -249,7 +288,8 @@ read_modified_unknown(vccontext_t *context, result_t *result)
     // if you ever figure it out.
     if (!context->options->show_modified && !context->options->show_unknown)
         return;
-    if (should_ignore_modified(".hg") || is_cwd_remote())
+    if (should_ignore_modified_at(context->dirfd, ".hg") ||
+        is_dir_remote(context->top))
         return;
 
     char *argv[] = {"hg", "--quiet", "status",
@@ -260,26 +300,34 @@ read_modified_unknown(vccontext_t *context, result_t *result)
         // skip it unless the user wants it
         argv[6] = NULL;
     }
-    capture_t *capture = capture_child("hg", argv);
-    if (capture == NULL) {
+
+    // one hg for both fields: it may run for as long as the more
+    // generous of their budgets
+    int budget = 0;
+    if (context->options->show_unknown)
+        budget = budget_remaining('u');
+    if (context->options->show_modified) {
+        int modified_budget = budget_remaining('m');
+        if (budget != -1 && (modified_budget == -1 || modified_budget > budget))
+            budget = modified_budget;
+    }
+    hg_status_t status = {context->options, result, 1};
+    capture_opts_t opts = {0, hg_status_consume, &status,
+                           budget > 0 ? budget : 0, context->top};
+    capture_t *capture = (budget != 0)
+        ? capture_child_opts("hg", argv, &opts)
+        : NULL;
+    if (capture == NULL && budget != 0) {
         debug("unable to execute 'hg status'");
         return;
     }
-    char *cstdout = capture->childout.buf;
-    for (char *ch = cstdout; *ch != 0; ch++) {
-        if (ch == cstdout || *(ch-1) == '\n') {
-            // at start of output or start of line: look for ?, M, etc.
-            if (context->options->show_unknown && *ch == '?') {
-                result->unknown = 1;
-            }
-            if (context->options->show_modified &&
-                (*ch == 'M' || *ch == 'A' || *ch == 'R')) {
-                result->modified = 1;
-            }
-        }
+    if (capture == NULL || capture->timedout) {
+        // whatever hg did not get round to is unknown
+        if (context->options->show_unknown && !result->unknown)
+            result->unknown = -1;
+        if (context->options->show_modified && !result->modified)
+            result->modified = -1;
     }
-
-    cstdout = NULL;
     free_capture(capture);
 }
 
@@ -290,11 +338,12 @@ hg_get_info(vccontext_t *context)
     char buf[1024];
 
     // prefer bookmark because it tends to be more informative
-    if (read_first_line(".hg/bookmarks.current", buf, 1024) && buf[0]) {
+    if (read_first_line_at(context->dirfd, ".hg/bookmarks.current",
+                           buf, 1024) && buf[0]) {
         debug("read first line from .hg/bookmarks.current: '%s'", buf);
         result_set_branch(result, buf);
     }
-    else if (read_first_line(".hg/branch", buf, 1024)) {
+    else if (read_first_line_at(context->dirfd, ".hg/branch", buf, 1024)) {
         debug("read first line from .hg/branch: '%s'", buf);
         result_set_branch(result, buf);
     }
@@ -313,5 +362,12 @@ hg_get_info(vccontext_t *context)
 vccontext_t*
 get_hg_context(options_t *options)
 {
-    return init_context("hg", options, hg_probe, hg_get_info);
+    static const char *const markers[] = {".hg", NULL};
+    static const char *const stamps[] = {
+        ".hg/dirstate", ".hg/branch", ".hg/bookmarks.current",
+        ".hg/store/00changelog.i", ".hg/patches.queue", ".hg/patches/status",
+        NULL,
+    };
+    return init_context("hg", options, markers, stamps,
+                        hg_probe, hg_get_info);
 }
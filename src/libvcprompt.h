@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/* libvcprompt: what vcprompt prints, for programs (shells, editors,
+ * prompt engines) that would rather keep it loaded than run it for
+ * every prompt.  It never changes the current dir, keeps no global
+ * state beyond the result cache of -c, and may be called from any
+ * number of threads at once, on one session or several.
+ */
+
+#ifndef LIBVCPROMPT_H
+#define LIBVCPROMPT_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define VCPROMPT_API __attribute__((visibility("default")))
+#else
+#define VCPROMPT_API
+#endif
+
+/* The same things the command line options say.  Zero means the
+ * default for every field.
+ */
+typedef struct {
+    const char *format;                 /* like -f (NULL: "[%n:%b] ") */
+    unsigned int timeout;               /* like -t, for each query */
+    unsigned int cache_ttl;             /* like -c */
+    int debug;                          /* like -d: debug output on stdout */
+    unsigned int unknown_budget;        /* like --budget u= */
+    unsigned int modified_budget;       /* like --budget m= */
+    const char *placeholder;            /* like --placeholder */
+} vcprompt_options_t;
+
+/* Where the strings returned by vcprompt_query(), and the session
+ * itself, come from.  Memory only needed while a query runs comes
+ * from malloc() regardless.
+ */
+typedef struct {
+    void *(*alloc)(size_t size, void *arg);
+    void (*free)(void *ptr, void *arg);
+    void *arg;                          /* passed to both */
+} vcprompt_allocator_t;
+
+typedef struct vcprompt_session vcprompt_session_t;
+
+/* Start a session for the dirs under root (NULL: the current dir),
+ * which stays open for the life of the session.  options and
+ * allocator are copied; either may be NULL for the defaults (malloc()
+ * and free()).  Return NULL, with errno set, if root cannot be opened
+ * or the format is invalid.
+ */
+VCPROMPT_API vcprompt_session_t*
+vcprompt_session_new(const char *root,
+                     const vcprompt_options_t *options,
+                     const vcprompt_allocator_t *allocator);
+
+VCPROMPT_API void
+vcprompt_session_free(vcprompt_session_t *session);
+
+/* Return what vcprompt would print in dir (relative to the root of
+ * session, or absolute; NULL means the root itself): "" if dir is not
+ * under version control.  Return NULL, with errno set, if dir cannot
+ * be opened.  Free the string with vcprompt_free().
+ */
+VCPROMPT_API char*
+vcprompt_query(vcprompt_session_t *session, const char *dir);
+
+VCPROMPT_API void
+vcprompt_free(vcprompt_session_t *session, char *output);
+
+#endif
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2009-2013, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "../config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "common.h"
+#include "daemon.h"
+#include "vcprompt.h"
+
+static char* features[] = {
+    /* Some version control systems don't change their working copy
+       format every couple of versions (or they are just
+       unmaintained), so we don't need versioned feature strings. */
+    "cvs",
+    "hg",
+    "git",
+    "fossil",
+
+    /* Support for Subversion up to 1.6 is unconditional, because those
+       versions don't require any additional libraries. Subversion >= 1.7
+       requires SQLite, so it's conditional. */
+    "svn-1.3",
+    "svn-1.4",
+    "svn-1.5",
+    "svn-1.6",
+#if HAVE_SQLITE3
+    "svn-1.7",
+    "svn-1.8",
+#endif
+
+    /* reading git commits (for %s) needs zlib */
+#if HAVE_ZLIB
+    "git-objects",
+#endif
+    0,
+};
+
+/* long options without a short equivalent */
+enum {
+    OPT_BATCH = 256,
+    OPT_JOBS,
+    OPT_SERVE_STDIO,
+    OPT_WATCH,
+    OPT_BUDGET,
+    OPT_PLACEHOLDER,
+};
+
+static const struct option long_options[] = {
+    {"batch", no_argument, NULL, OPT_BATCH},
+    {"jobs", required_argument, NULL, OPT_JOBS},
+    {"serve-stdio", no_argument, NULL, OPT_SERVE_STDIO},
+    {"watch", no_argument, NULL, OPT_WATCH},
+    {"budget", required_argument, NULL, OPT_BUDGET},
+    {"placeholder", required_argument, NULL, OPT_PLACEHOLDER},
+    {NULL, 0, NULL, 0},
+};
+
+void
+parse_args(int argc, char** argv, options_t *options)
+{
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hf:dt:FDc:s",
+                              long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+                options->format = optarg;
+                break;
+            case 'd':
+                options->debug = 1;
+                break;
+            case 't':
+                options->timeout = strtol(optarg, NULL, 10);
+                break;
+            case 'F':
+                options->show_features = 1;
+                break;
+            case 'D':
+                options->daemon = 1;
+                break;
+            case 'c':
+                options->cache_ttl = strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                options->stale_ok = 1;
+                break;
+            case OPT_BATCH:
+                options->batch = 1;
+                break;
+            case OPT_JOBS:
+                options->jobs = strtol(optarg, NULL, 10);
+                break;
+            case OPT_SERVE_STDIO:
+                options->serve_stdio = 1;
+                break;
+            case OPT_WATCH:
+                options->watch = 1;
+                break;
+            case OPT_BUDGET:
+                /* "u=ms" or "m=ms" */
+                if (optarg[0] == 'u' && optarg[1] == '=')
+                    options->unknown_budget = strtol(optarg + 2, NULL, 10);
+                else if (optarg[0] == 'm' && optarg[1] == '=')
+                    options->modified_budget = strtol(optarg + 2, NULL, 10);
+                else
+                    fprintf(stderr,
+                            "error: invalid budget: %s (expected u=ms "
+                            "or m=ms)\n", optarg);
+                break;
+            case OPT_PLACEHOLDER:
+                options->placeholder = optarg;
+                break;
+            case 'h':
+            default:
+                printf("usage: %s [-h] [-d] [-D] [-c ttl] [-s] [-t timeout_ms] [-f FORMAT]\n"
+                       "           [--budget u=ms] [--budget m=ms] [--placeholder STR]\n"
+                       "       %s --batch [--jobs N] [-c ttl] [-t timeout_ms] [-f FORMAT]\n"
+                       "       %s --serve-stdio [-t timeout_ms] [-f FORMAT]\n"
+                       "       %s --watch [-t timeout_ms] [-f FORMAT]\n",
+                       argv[0], argv[0], argv[0], argv[0]);
+                printf("FORMAT (default=\"%s\") may contain:\n%s",
+                DEFAULT_FORMAT,
+                "  %n  show VC name\n"
+                "  %b  show branch\n"
+                "  %r  show revision\n"
+                "  %p  show patch name (MQ, guilt, ...)\n"
+                "  %u  indicate unknown (untracked) files\n"
+                "  %m  indicate uncommitted changes (modified/added/removed)\n"
+                "  %s  indicate changes staged for commit (git only)\n"
+                "  %>  show commits ahead of upstream, e.g. \">2\"\n"
+                "  %<  show commits behind upstream, e.g. \"<1\"\n"
+                "  %o  show operation in progress, e.g. \"MERGING\"\n"
+                "  %$  show number of stashes, e.g. \"$2\"\n"
+                "  %x  indicate an out-of-date result (with -s)\n"
+                "  %%  show '%'\n"
+                );
+                printf("Environment Variables:\n"
+                "  VCPROMPT_FORMAT\n"
+                "  VCPROMPT_CEILING_DIRS\n"
+                );
+                exit(1);
+        }
+    }
+}
+
+void
+show_features(void)
+{
+    for (char **f = features; *f != NULL; f++) {
+        puts(*f);
+    }
+}
+
+/* how long a background refresh (-s) may take */
+#define REFRESH_TIMEOUT_MS 60000
+
+/* Compute a fresh result for key in a detached, low-priority child,
+ * so that the next prompt finds it in the cache.  The child must let
+ * go of stdout at once, since the shell reads the prompt until EOF.
+ */
+static void
+refresh_in_background(vccontext_t *context, cache_key_t *key)
+{
+    options_t *options = context->options;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        debug("fork() failed: %s", strerror(errno));
+        return;
+    }
+    if (pid > 0) {
+        debug("refreshing the cache in process %d", (int) pid);
+        return;
+    }
+
+    int nullfd = open("/dev/null", O_RDWR);
+    if (nullfd >= 0) {
+        dup2(nullfd, STDIN_FILENO);
+        dup2(nullfd, STDOUT_FILENO);
+        dup2(nullfd, STDERR_FILENO);
+        if (nullfd > STDERR_FILENO)
+            close(nullfd);
+    }
+    setsid();
+    setpriority(PRIO_PROCESS, 0, 19);
+#ifdef SYS_ioprio_set
+    /* IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE */
+    syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+
+    /* if another refresh is already running, leave it to that one */
+    options->timeout = REFRESH_TIMEOUT_MS;
+    set_options(options);
+    result_t *result = cache_get_info(context, key, 0);
+    if (result != NULL)
+        free_result(result);
+    _exit(0);
+}
+
+int
+main(int argc, char** argv)
+{
+    int status = 0;
+
+    char *format = getenv("VCPROMPT_FORMAT");
+    if (format == NULL)
+        format = DEFAULT_FORMAT;
+    options_t options = {
+        .debug         = 0,
+        .format        = format,
+        .show_branch   = 0,
+        .show_revision = 0,
+        .show_unknown  = 0,
+        .show_modified = 0,
+        .show_features = 0,
+    };
+
+    parse_args(argc, argv, &options);
+    if (options.show_features) {
+        show_features();
+        return 0;
+    }
+
+    parse_format(&options);
+    set_options(&options);
+
+    if (options.timeout) {
+        debug("will timeout after %d ms", options.timeout);
+    } else {
+        debug("will never timeout");
+    }
+
+    if (options.daemon)
+        return daemon_main(&options);
+    if (options.batch)
+        return batch_main(&options);
+    if (options.serve_stdio)
+        return serve_stdio_main(&options);
+    if (options.watch)
+        return watch_main(&options);
+
+    vccontext_t *contexts[NUM_CONTEXTS];
+    int num_contexts = NUM_CONTEXTS;
+    init_contexts(&options, contexts);
+
+    result_t *result = NULL;
+    vccontext_t *context = NULL;
+
+    /* Starting in the current dir, walk up the directory tree until
+       someone claims that this is a working copy. */
+    context = probe_dirs(contexts, num_contexts, NULL);
+
+    /* Nobody claimed it: bail now without printing anything. */
+    if (context == NULL) {
+        goto done;
+    }
+
+    /* Analyze the working copy metadata (or reuse what another
+       vcprompt found, if it still applies) and print the result. */
+    cache_key_t key;
+    result = get_result(context, &key);
+    if (result != NULL) {
+        int stale = result->stale;
+        print_result(stdout, context, &options, result);
+        free_result(result);
+        if (options.debug)
+            putc('\n', stdout);
+        if (stale)
+            refresh_in_background(context, &key);
+    }
+
+ done:
+    for (int i = 0; i < num_contexts; i++) {
+        free_context(contexts[i]);
+    }
+    return status;
+}
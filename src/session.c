@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#define _GNU_SOURCE             /* for open_memstream() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "common.h"
+#include "libvcprompt.h"
+#include "vcprompt.h"
+
+struct vcprompt_session {
+    vcprompt_allocator_t allocator;
+    options_t options;                  /* shared by every query */
+    char *root;                         /* absolute path of rootfd */
+    int rootfd;
+};
+
+static void *
+default_alloc(size_t size, void *arg)
+{
+    (void) arg;
+    return malloc(size);
+}
+
+static void
+default_free(void *ptr, void *arg)
+{
+    (void) arg;
+    free(ptr);
+}
+
+/* Copy len bytes of s, plus a NUL, into memory from the allocator. */
+static char *
+session_strndup(vcprompt_session_t *session, const char *s, size_t len)
+{
+    char *copy = session->allocator.alloc(len + 1, session->allocator.arg);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+vcprompt_session_t*
+vcprompt_session_new(const char *root,
+                     const vcprompt_options_t *options,
+                     const vcprompt_allocator_t *allocator)
+{
+    vcprompt_allocator_t alloc = {default_alloc, default_free, NULL};
+    vcprompt_options_t defaults = {NULL, 0, 0, 0, 0, 0, NULL};
+    vcprompt_session_t *session;
+    const char *format;
+    char *path;
+    int err;
+
+    if (allocator != NULL)
+        alloc = *allocator;
+    if (options == NULL)
+        options = &defaults;
+    format = options->format ? options->format : DEFAULT_FORMAT;
+
+    session = alloc.alloc(sizeof(*session), alloc.arg);
+    if (session == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(session, 0, sizeof(*session));
+    session->allocator = alloc;
+    session->rootfd = -1;
+    session->options.debug = options->debug;
+    session->options.timeout = options->timeout;
+    session->options.cache_ttl = options->cache_ttl;
+    session->options.unknown_budget = options->unknown_budget;
+    session->options.modified_budget = options->modified_budget;
+    if (options->placeholder != NULL) {
+        session->options.placeholder = session_strndup(
+            session, options->placeholder, strlen(options->placeholder));
+        if (session->options.placeholder == NULL) {
+            err = ENOMEM;
+            goto fail;
+        }
+    }
+    session->options.format = session_strndup(session, format, strlen(format));
+    if (session->options.format == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    if (!parse_format(&session->options)) {
+        err = EINVAL;
+        goto fail;
+    }
+
+    if ((path = realpath(root ? root : ".", NULL)) == NULL) {
+        err = errno;
+        goto fail;
+    }
+    session->root = session_strndup(session, path, strlen(path));
+    free(path);
+    if (session->root == NULL) {
+        err = ENOMEM;
+        goto fail;
+    }
+    session->rootfd = open(session->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (session->rootfd < 0) {
+        err = errno;
+        goto fail;
+    }
+    return session;
+
+ fail:
+    vcprompt_session_free(session);
+    errno = err;
+    return NULL;
+}
+
+void
+vcprompt_session_free(vcprompt_session_t *session)
+{
+    if (session == NULL)
+        return;
+    if (session->rootfd >= 0)
+        close(session->rootfd);
+    if (session->root != NULL)
+        session->allocator.free(session->root, session->allocator.arg);
+    if (session->options.format != NULL)
+        session->allocator.free(session->options.format,
+                                session->allocator.arg);
+    if (session->options.placeholder != NULL)
+        session->allocator.free(session->options.placeholder,
+                                session->allocator.arg);
+    session->allocator.free(session, session->allocator.arg);
+}
+
+/* Open dir, relative to the root of session, and work out its absolute
+ * path with no symlinks into *path (a malloc()ed string).  Return the
+ * fd, or -1 with errno set.
+ */
+static int
+open_dir(vcprompt_session_t *session, const char *dir, char **path)
+{
+    char *joined = NULL;
+    int fd, err;
+
+    if (dir == NULL || *dir == '\0')
+        dir = ".";
+    if (dir[0] != '/') {
+        size_t len = strlen(session->root) + 1 + strlen(dir) + 1;
+        if ((joined = malloc(len)) == NULL)
+            return -1;
+        snprintf(joined, len, "%s/%s", session->root, dir);
+    }
+    if ((fd = openat(session->rootfd, dir,
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        err = errno;
+        debug("unable to open %s: %s", dir, strerror(errno));
+        free(joined);
+        errno = err;
+        return -1;
+    }
+    *path = realpath(joined ? joined : dir, NULL);
+    err = errno;
+    free(joined);
+    if (*path == NULL) {
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+char*
+vcprompt_query(vcprompt_session_t *session, const char *dir)
+{
+    vccontext_t *contexts[NUM_CONTEXTS];
+    char *path, *buf = NULL, *output;
+    size_t len = 0;
+    FILE *out;
+    int fd;
+
+    /* for this thread only: also starts the timeout */
+    set_options(&session->options);
+    if ((fd = open_dir(session, dir, &path)) < 0)
+        return NULL;
+    if ((out = open_memstream(&buf, &len)) == NULL) {
+        close(fd);
+        free(path);
+        return NULL;
+    }
+
+    /* Contexts are cheap next to probing, and having a set per query
+       is what lets any number of threads share the session. */
+    init_contexts(&session->options, contexts);
+    vccontext_t *context = probe_dir_at(contexts, NUM_CONTEXTS, fd, path);
+    if (context != NULL) {
+        cache_key_t key;
+        result_t *result = get_result(context, &key);
+        if (result != NULL) {
+            print_result(out, context, &session->options, result);
+            free_result(result);
+        }
+    }
+    for (int i = 0; i < NUM_CONTEXTS; i++)
+        free_context(contexts[i]);
+    free(path);
+
+    if (fclose(out) != 0) {
+        free(buf);
+        errno = ENOMEM;
+        return NULL;
+    }
+    output = session_strndup(session, buf, len);
+    free(buf);
+    if (output == NULL)
+        errno = ENOMEM;
+    return output;
+}
+
+void
+vcprompt_free(vcprompt_session_t *session, char *output)
+{
+    if (output != NULL)
+        session->allocator.free(output, session->allocator.arg);
+}
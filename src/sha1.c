@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sha1.h"
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block(sha1_t *ctx, const unsigned char *p)
+{
+    uint32_t w[80];
+    uint32_t a, b, c, d, e, t;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t) p[4*i] << 24) | ((uint32_t) p[4*i + 1] << 16) |
+               ((uint32_t) p[4*i + 2] << 8) | p[4*i + 3];
+    for (; i < 80; i++)
+        w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    a = ctx->h[0];
+    b = ctx->h[1];
+    c = ctx->h[2];
+    d = ctx->h[3];
+    e = ctx->h[4];
+    for (i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        t = ROL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROL(b, 30);
+        b = a;
+        a = t;
+    }
+    ctx->h[0] += a;
+    ctx->h[1] += b;
+    ctx->h[2] += c;
+    ctx->h[3] += d;
+    ctx->h[4] += e;
+}
+
+void
+sha1_init(sha1_t *ctx)
+{
+    ctx->h[0] = 0x67452301;
+    ctx->h[1] = 0xefcdab89;
+    ctx->h[2] = 0x98badcfe;
+    ctx->h[3] = 0x10325476;
+    ctx->h[4] = 0xc3d2e1f0;
+    ctx->len = 0;
+}
+
+void
+sha1_update(sha1_t *ctx, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t used = ctx->len % 64;
+
+    ctx->len += len;
+    if (used > 0) {
+        size_t n = 64 - used;
+        if (n > len)
+            n = len;
+        memcpy(ctx->block + used, p, n);
+        p += n;
+        len -= n;
+        if (used + n < 64)
+            return;
+        sha1_block(ctx, ctx->block);
+    }
+    for (; len >= 64; p += 64, len -= 64)
+        sha1_block(ctx, p);
+    memcpy(ctx->block, p, len);
+}
+
+void
+sha1_final(sha1_t *ctx, unsigned char *digest)
+{
+    uint64_t bits = ctx->len * 8;
+    unsigned char pad[72];
+    size_t padlen = 64 - (ctx->len + 8) % 64;
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++)
+        pad[padlen + i] = bits >> (56 - 8 * i);
+    sha1_update(ctx, pad, padlen + 8);
+
+    for (i = 0; i < 20; i++)
+        digest[i] = ctx->h[i / 4] >> (24 - 8 * (i % 4));
+}
+
+void
+sha1_git_blob(const void *data, size_t len, unsigned char *digest)
+{
+    sha1_t ctx;
+    char header[32];
+    int n = snprintf(header, sizeof(header), "blob %zu", len);
+
+    sha1_init(&ctx);
+    sha1_update(&ctx, header, n + 1);
+    sha1_update(&ctx, data, len);
+    sha1_final(&ctx, digest);
+}
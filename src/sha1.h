@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Plain SHA-1 (FIPS 180-4), enough to compute git object IDs of small
+ * files.  Not for anything security-related.
+ */
+
+#define SHA1_LEN 20
+
+typedef struct {
+    uint32_t h[5];
+    uint64_t len;                       /* bytes hashed so far */
+    unsigned char block[64];
+} sha1_t;
+
+void
+sha1_init(sha1_t *ctx);
+
+void
+sha1_update(sha1_t *ctx, const void *data, size_t len);
+
+void
+sha1_final(sha1_t *ctx, unsigned char *digest);
+
+/* Compute the git object ID of data as a blob, i.e. the SHA-1 of
+ * "blob <len>\0" followed by data.
+ */
+void
+sha1_git_blob(const void *data, size_t len, unsigned char *digest);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "sqlite.h"
+
+#if HAVE_SQLITE3
+
+#if SQLITE3_DLOPEN
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "common.h"
+
+/* where to look for libsqlite3, in order */
+static const char *const libnames[] = {
+#ifdef SQLITE3_LIBDIR
+    SQLITE3_LIBDIR "/libsqlite3.so.0",
+    SQLITE3_LIBDIR "/libsqlite3.dylib",
+#endif
+    "libsqlite3.so.0",
+    "libsqlite3.so",
+    "libsqlite3.dylib",
+    NULL,
+};
+
+static sqlite_api_t api;
+static int loaded = 0;
+static pthread_once_t load_once = PTHREAD_ONCE_INIT;
+
+/* Look up sqlite3_<name> in lib, into *fn (some function pointer). */
+static int
+load_symbol(void *lib, const char *name, void *fn)
+{
+    char symbol[64];
+    void *addr;
+
+    snprintf(symbol, sizeof(symbol), "sqlite3_%s", name);
+    if ((addr = dlsym(lib, symbol)) == NULL) {
+        debug("%s not found in libsqlite3", symbol);
+        return 0;
+    }
+    *(void **) fn = addr;
+    return 1;
+}
+
+static void
+load_sqlite(void)
+{
+    void *lib = NULL;
+
+    for (const char *const *name = libnames; lib == NULL && *name; name++)
+        lib = dlopen(*name, RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        debug("unable to load libsqlite3: %s", dlerror());
+        return;
+    }
+    loaded = (load_symbol(lib, "open_v2", &api.open_v2) &&
+              load_symbol(lib, "close", &api.close) &&
+              load_symbol(lib, "errmsg", &api.errmsg) &&
+              load_symbol(lib, "prepare_v2", &api.prepare_v2) &&
+              load_symbol(lib, "bind_text", &api.bind_text) &&
+              load_symbol(lib, "step", &api.step) &&
+              load_symbol(lib, "column_text", &api.column_text) &&
+              load_symbol(lib, "finalize", &api.finalize));
+    /* never dlclose(): connections kept in contexts may outlive us */
+}
+
+const sqlite_api_t*
+sqlite_api(void)
+{
+    pthread_once(&load_once, load_sqlite);
+    return loaded ? &api : NULL;
+}
+
+#else  /* linked with libsqlite3 */
+
+static const sqlite_api_t api = {
+    sqlite3_open_v2,
+    sqlite3_close,
+    sqlite3_errmsg,
+    sqlite3_prepare_v2,
+    sqlite3_bind_text,
+    sqlite3_step,
+    sqlite3_column_text,
+    sqlite3_finalize,
+};
+
+const sqlite_api_t*
+sqlite_api(void)
+{
+    return &api;
+}
+
+#endif
+#endif
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef SQLITE_H
+#define SQLITE_H
+
+#include "../config.h"
+
+#if HAVE_SQLITE3
+#include <sqlite3.h>
+
+/* The bits of SQLite that svn.c uses.  Unless configured with
+ * --disable-sqlite3-dlopen, vcprompt does not link with libsqlite3,
+ * which only svn >= 1.7 working copies need: it loads it the first
+ * time it meets one.
+ */
+typedef struct {
+    int (*open_v2)(const char *filename, sqlite3 **db, int flags,
+                   const char *vfs);
+    int (*close)(sqlite3 *db);
+    const char *(*errmsg)(sqlite3 *db);
+    int (*prepare_v2)(sqlite3 *db, const char *sql, int nbytes,
+                      sqlite3_stmt **stmt, const char **tail);
+    int (*bind_text)(sqlite3_stmt *stmt, int index, const char *value,
+                     int nbytes, void (*destructor)(void *));
+    int (*step)(sqlite3_stmt *stmt);
+    const unsigned char *(*column_text)(sqlite3_stmt *stmt, int col);
+    int (*finalize)(sqlite3_stmt *stmt);
+} sqlite_api_t;
+
+/* Return the SQLite functions, loading the library if need be, or
+ * NULL if it cannot be loaded.  Safe to call from any thread.
+ */
+const sqlite_api_t*
+sqlite_api(void);
+
+#endif
+
+#endif
@@ -9,25 +9,26 @@
 
 #include "../config.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
-#if HAVE_SQLITE3
-# include <sqlite3.h>
-#endif
 
+#include "capture.h"
 #include "common.h"
+#include "sqlite.h"
 #include "svn.h"
 
 #include <ctype.h>
 
 static int
-svn_probe(vccontext_t *context)
+svn_probe(vccontext_t *context, int dirfd)
 {
-    return isdir(".svn");
+    return isdir_at(dirfd, ".svn");
 }
 
 static void
@@ -103,63 +104,130 @@ get_branch_name(char *repos_path)
 
 
 #if HAVE_SQLITE3
+/* The connection to wc.db that the last svn_read_sqlite() on a
+ * context opened, kept open until wc.db is replaced or the context
+ * moves to another working copy.
+ */
+typedef struct {
+    sqlite3 *conn;
+    char path[PATH_MAX];
+    dev_t dev;
+    ino_t ino;
+} svn_state_t;
+
+static void
+svn_free_state(void *state)
+{
+    svn_state_t *s = state;
+    sqlite_api()->close(s->conn);
+    free(s);
+}
+
+static sqlite3*
+svn_open_wcdb(vccontext_t *context)
+{
+    const sqlite_api_t *sq = sqlite_api();
+    svn_state_t *s = context->state;
+    char path[PATH_MAX];
+    struct stat st;
+    int retval;
+
+    if (sq == NULL) {
+        debug("no sqlite3 here (cannot support svn >= 1.7)");
+        return NULL;
+    }
+
+    /* sqlite wants a path: make it absolute, so the current dir
+       does not matter */
+    if (snprintf(path, sizeof(path), "%s/.svn/wc.db", context->top)
+        >= (int) sizeof(path)) {
+        debug("path to .svn/wc.db too long");
+        return NULL;
+    }
+    if (fstatat(context->dirfd, ".svn/wc.db", &st, 0) < 0)
+        return NULL;
+    if (s != NULL && strcmp(s->path, path) == 0 &&
+        s->dev == st.st_dev && s->ino == st.st_ino) {
+        debug("reusing connection to %s", path);
+        return s->conn;
+    }
+
+    if (s != NULL) {
+        svn_free_state(s);
+        context->state = NULL;
+    }
+    if ((s = calloc(1, sizeof(svn_state_t))) == NULL)
+        return NULL;
+    retval = sq->open_v2(path, &s->conn, SQLITE_OPEN_READONLY, NULL);
+    if (retval != SQLITE_OK) {
+        debug("error opening database in .svn/wc.db: %s",
+              sq->errmsg(s->conn));
+        svn_free_state(s);
+        return NULL;
+    }
+    strcpy(s->path, path);
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+    context->state = s;
+    context->free_state = svn_free_state;
+    return s->conn;
+}
+
 static int
 svn_read_sqlite(vccontext_t *context, result_t *result)
 {
+    const sqlite_api_t *sq = sqlite_api();
     int ok = 0;
     int retval;
-    sqlite3 *conn = NULL;
+    sqlite3 *conn;
     sqlite3_stmt *res = NULL;
     const char *tail;
     char * repos_path = NULL;
 
-    retval = sqlite3_open_v2(".svn/wc.db", &conn, SQLITE_OPEN_READONLY, NULL);
-    if (retval != SQLITE_OK) {
-        debug("error opening database in .svn/wc.db: %s", sqlite3_errmsg(conn));
+    if ((conn = svn_open_wcdb(context)) == NULL)
         goto err;
-    }
     // unclear when wc_id is anything other than 1
     char *sql = ("select changed_revision from nodes "
                  "where wc_id = 1 and local_relpath = ''");
     const char *textval;
-    retval = sqlite3_prepare_v2(conn, sql, strlen(sql), &res, &tail);
+    retval = sq->prepare_v2(conn, sql, strlen(sql), &res, &tail);
     if (retval != SQLITE_OK) {
-        debug("error running query: %s", sqlite3_errmsg(conn));
+        debug("error running query: %s", sq->errmsg(conn));
         goto err;
     }
-    retval = sqlite3_step(res);
+    retval = sq->step(res);
     if (retval != SQLITE_DONE && retval != SQLITE_ROW) {
-        debug("error fetching result row: %s", sqlite3_errmsg(conn));
+        debug("error fetching result row: %s", sq->errmsg(conn));
         goto err;
     }
-    textval = (const char *) sqlite3_column_text(res, 0);
+    textval = (const char *) sq->column_text(res, 0);
     if (textval == NULL) {
         debug("could not retrieve value of nodes.changed_revision");
         goto err;
     }
     result->revision = strdup(textval);
-    sqlite3_finalize(res);
+    sq->finalize(res);
 
     sql = "select repos_path from nodes where local_relpath = ?";
-    retval = sqlite3_prepare_v2(conn, sql, strlen(sql), &res, &tail);
+    retval = sq->prepare_v2(conn, sql, strlen(sql), &res, &tail);
     if (retval != SQLITE_OK) {
-        debug("error querying for repos_path: %s", sqlite3_errmsg(conn));
+        debug("error querying for repos_path: %s", sq->errmsg(conn));
         goto err;
     }
-    retval = sqlite3_bind_text(res, 1,
-                               context->rel_path, strlen(context->rel_path),
-                               SQLITE_STATIC);
+    retval = sq->bind_text(res, 1,
+                           context->rel_path, strlen(context->rel_path),
+                           SQLITE_STATIC);
     if (retval != SQLITE_OK) {
-        debug("error binding parameter: %s", sqlite3_errmsg(conn));
+        debug("error binding parameter: %s", sq->errmsg(conn));
         goto err;
     }
-    retval = sqlite3_step(res);
+    retval = sq->step(res);
     if (retval != SQLITE_DONE && retval != SQLITE_ROW) {
-        debug("error fetching result row: %s", sqlite3_errmsg(conn));
+        debug("error fetching result row: %s", sq->errmsg(conn));
         goto err;
     }
 
-    textval = (const char *) sqlite3_column_text(res, 0);
+    textval = (const char *) sq->column_text(res, 0);
     if (textval == NULL) {
         debug("could not retrieve value of nodes.repos_path");
         goto err;
@@ -171,9 +239,7 @@ svn_read_sqlite(vccontext_t *context, result_t *result)
 
  err:
     if (res != NULL)
-        sqlite3_finalize(res);
-    if (conn != NULL)
-        sqlite3_close(conn);
+        sq->finalize(res);
     if (repos_path != NULL)
         free(repos_path);
     return ok;
@@ -262,30 +328,29 @@ svn_read_xml(FILE *fp, char line[], int size, int line_num, result_t *result)
     return 1;
 }
 
+/* Look for vcprompt-no-modified in the .svn dir of the dir open on
+ * dirfd and of each parent that is part of the same (pre-1.7) working
+ * copy.
+ */
 static int
-svn_should_ignore_modified(void)
+svn_should_ignore_modified(int dirfd)
 {
-    char initial_wd[BUFSIZ];
-    char *result = getcwd(initial_wd, sizeof(initial_wd));
+    int fd = dup(dirfd);
     int ignore_modified = 0;
     struct stat buf;
-    if (result == NULL)
-        return 0;
-    while (1) {
-        if (should_ignore_modified(".svn")) {
+    while (fd >= 0) {
+        if (should_ignore_modified_at(fd, ".svn")) {
             ignore_modified = 1;
             break;
         }
-        if (stat("../.svn", &buf) == 0 && S_ISDIR(buf.st_mode)) {
-            if (chdir("..") != 0)
-                break;
-        } else {
-            ignore_modified = should_ignore_modified(".svn");
+        if (fstatat(fd, "../.svn", &buf, 0) < 0 || !S_ISDIR(buf.st_mode))
             break;
-        }
+        int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = parent;
     }
-    if (chdir(initial_wd) == -1)
-        debug("error returning to %s", initial_wd);
+    if (fd >= 0)
+        close(fd);
     return ignore_modified;
 }
 
@@ -296,7 +361,7 @@ svn_get_info(vccontext_t *context)
     FILE *fp = NULL;
     int ok = 0;
 
-    if (access(".svn/wc.db", F_OK) == 0) {
+    if (faccessat(context->dirfd, ".svn/wc.db", F_OK, 0) == 0) {
         // SQLite file format (working copy created by svn >= 1.7)
         // Some repositories do not have the ".svn/entries" file anymore
         ok = svn_read_sqlite(context, result);
@@ -304,7 +369,9 @@ svn_get_info(vccontext_t *context)
     else {
         debug("cannot access() .svn/wc.db: not an svn >= 1.7 working copy");
 
-        fp = fopen(".svn/entries", "r");
+        int fd = openat(context->dirfd, ".svn/entries", O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 && (fp = fdopen(fd, "r")) == NULL)
+            close(fd);
         if (!fp) {
             debug("failed to open .svn/entries: not an svn < 1.7 working copy");
             goto err;
@@ -329,22 +396,27 @@ svn_get_info(vccontext_t *context)
         }
     }
     if (context->options->show_modified) {
-        int ignore_modified = svn_should_ignore_modified();
-        if (!ignore_modified && is_cwd_remote())
+        int ignore_modified = svn_should_ignore_modified(context->dirfd);
+        if (!ignore_modified && is_dir_remote(context->top))
             ignore_modified = 1;
-        if (!ignore_modified) {
+        int budget = budget_remaining('m');
+        if (!ignore_modified && budget == 0)
+            result->modified = -1;
+        else if (!ignore_modified) {
             debug("svn show modified");
-            FILE *version = popen("svnversion -n", "r");
-            if (version != NULL) {
-                char buffer[256];
-                char *gets_result = fgets(buffer, sizeof(buffer) - 1, version);
-                if (gets_result != NULL) {
-                    size_t len = strlen(buffer);
-                    debug("svn version result %s", buffer);
-                    result->modified = buffer[len - 1] == 'M';
-                }
-                pclose(version);
+            char *argv[] = {"svnversion", "-n", NULL};
+            capture_opts_t opts = {
+                0, NULL, NULL, budget > 0 ? budget : 0, context->top};
+            capture_t *capture = capture_child_opts("svnversion", argv, &opts);
+            if (capture != NULL && capture->timedout)
+                result->modified = -1;
+            else if (capture != NULL && capture->childout.len > 0) {
+                char *buffer = capture->childout.buf;
+                size_t len = capture->childout.len;
+                debug("svn version result %s", buffer);
+                result->modified = buffer[len - 1] == 'M';
             }
+            free_capture(capture);
         }
     }
 
@@ -362,5 +434,8 @@ svn_get_info(vccontext_t *context)
 vccontext_t*
 get_svn_context(options_t *options)
 {
-    return init_context("svn", options, svn_probe, svn_get_info);
+    static const char *const markers[] = {".svn", NULL};
+    static const char *const stamps[] = {".svn/wc.db", ".svn/entries", NULL};
+    return init_context("svn", options, markers, stamps,
+                        svn_probe, svn_get_info);
 }
@@ -14,104 +14,38 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/time.h>
+#include <fcntl.h>
 #include <unistd.h>
-#include <signal.h>
 #include <errno.h>
 #include <limits.h>
 
+#include "cache.h"
 #include "common.h"
 #include "cvs.h"
 #include "git.h"
 #include "hg.h"
 #include "svn.h"
 #include "fossil.h"
+#include "vcprompt.h"
 /*
 #include "bzr.h"
 */
 
-static char* features[] = {
-    /* Some version control systems don't change their working copy
-       format every couple of versions (or they are just
-       unmaintained), so we don't need versioned feature strings. */
-    "cvs",
-    "hg",
-    "git",
-    "fossil",
-
-    /* Support for Subversion up to 1.6 is unconditional, because those
-       versions don't require any additional libraries. Subversion >= 1.7
-       requires SQLite, so it's conditional. */
-    "svn-1.3",
-    "svn-1.4",
-    "svn-1.5",
-    "svn-1.6",
-#if HAVE_SQLITE3
-    "svn-1.7",
-    "svn-1.8",
-#endif
-    0,
-};
-
-#define DEFAULT_FORMAT "[%n:%b] "
-
-void
-parse_args(int argc, char** argv, options_t *options)
-{
-    int opt;
-    while ((opt = getopt(argc, argv, "hf:dt:F")) != -1) {
-        switch (opt) {
-            case 'f':
-                options->format = optarg;
-                break;
-            case 'd':
-                options->debug = 1;
-                break;
-            case 't':
-                options->timeout = strtol(optarg, NULL, 10);
-                break;
-            case 'F':
-                options->show_features = 1;
-                break;
-            case 'h':
-            default:
-                printf("usage: %s [-h] [-d] [-t timeout_ms] [-f FORMAT]\n", argv[0]);
-                printf("FORMAT (default=\"%s\") may contain:\n%s",
-                DEFAULT_FORMAT,
-                "  %n  show VC name\n"
-                "  %b  show branch\n"
-                "  %r  show revision\n"
-                "  %p  show patch name (MQ, guilt, ...)\n"
-                "  %u  indicate unknown (untracked) files\n"
-                "  %m  indicate uncommitted changes (modified/added/removed)\n"
-                "  %%  show '%'\n"
-                );
-                printf("Environment Variables:\n"
-                "  VCPROMPT_FORMAT\n"
-                );
-                exit(1);
-        }
-    }
-}
-
-void
-show_features(void)
-{
-    for (char **f = features; *f != NULL; f++) {
-        puts(*f);
-    }
-}
-
-void
+int
 parse_format(options_t *options)
 {
     size_t i;
+    int ok = 1;
 
     options->show_branch = 0;
     options->show_revision = 0;
     options->show_patch = 0;
     options->show_unknown = 0;
     options->show_modified = 0;
+    options->show_upstream = 0;
+    options->show_operation = 0;
+    options->show_stash = 0;
+    options->show_staged = 0;
 
     char *format = options->format;
     size_t len = strlen(format);
@@ -123,6 +57,8 @@ parse_format(options_t *options)
                     break;
                 case 'n':               /* name of VC system */
                     break;
+                case 'x':               /* stale result marker */
+                    break;
                 case 'b':
                     options->show_branch = 1;
                     break;
@@ -138,20 +74,36 @@ parse_format(options_t *options)
                 case 'm':
                     options->show_modified = 1;
                     break;
+                case 's':
+                    options->show_staged = 1;
+                    break;
+                case '>':
+                case '<':
+                    options->show_upstream = 1;
+                    break;
+                case 'o':
+                    options->show_operation = 1;
+                    break;
+                case '$':
+                    options->show_stash = 1;
+                    break;
                 case '%':
                     break;
                 default:
                     fprintf(stderr,
                             "error: invalid format string: %%%c\n",
                             format[i]);
+                    ok = 0;
                     break;
             }
         }
     }
+    return ok;
 }
 
 void
-print_result(vccontext_t *context, options_t *options, result_t *result)
+print_result(FILE *out, vccontext_t *context, options_t *options,
+             result_t *result)
 {
     size_t i;
     char *format = options->format;
@@ -164,186 +116,305 @@ print_result(vccontext_t *context, options_t *options, result_t *result)
                 case 0:               /* end of string */
                     break;
                 case 'n':
-                    fputs(context->name, stdout);
+                    fputs(context->name, out);
                     break;
                 case 'b':
                     if (result->branch != NULL)
-                        fputs(result->branch, stdout);
+                        fputs(result->branch, out);
                     break;
                 case 'r':
                     if (result->revision != NULL)
-                        fputs(result->revision, stdout);
+                        fputs(result->revision, out);
                     break;
                 case 'p':
                     if (result->patch != NULL)
-                        fputs(result->patch, stdout);
+                        fputs(result->patch, out);
                 case 'u':
-                    if (result->unknown)
-                        putc('?', stdout);
+                    if (result->unknown > 0)
+                        putc('?', out);
+                    else if (result->unknown < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
                     break;
                 case 'm':
-                    if (result->modified)
-                        putc('*', stdout);
+                    if (result->modified > 0)
+                        putc('+', out);
+                    else if (result->modified < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
+                    break;
+                case 's':
+                    if (result->staged > 0)
+                        putc('*', out);
+                    else if (result->staged < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
+                    break;
+                case '>':
+                    if (result->ahead > 0)
+                        fprintf(out, ">%d", result->ahead);
+                    else if (result->ahead < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
+                    break;
+                case '<':
+                    if (result->behind > 0)
+                        fprintf(out, "<%d", result->behind);
+                    else if (result->behind < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
+                    break;
+                case 'o':
+                    if (result->operation != NULL)
+                        fputs(result->operation, out);
+                    break;
+                case '$':
+                    if (result->stashes > 0)
+                        fprintf(out, "$%d", result->stashes);
+                    else if (result->stashes < 0 && options->placeholder)
+                        fputs(options->placeholder, out);
+                    break;
+                case 'x':
+                    if (result->stale)
+                        putc('~', out);
                     break;
                 case '%':               /* escaped % */
-                    putc('%', stdout);
+                    putc('%', out);
                     break;
                 default:                /* %x printed as x */
-                    putc(format[i], stdout);
+                    putc(format[i], out);
             }
         }
         else {
-            putc(format[i], stdout);
+            putc(format[i], out);
+        }
+    }
+}
+
+/* Directories that the upward search must not enter, from
+ * $VCPROMPT_CEILING_DIRS (colon-separated, like $GIT_CEILING_DIRECTORIES).
+ * Identified by device and inode, so symlinks do not matter.
+ */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+} ceiling_t;
+
+static int
+load_ceilings(ceiling_t **ceilings)
+{
+    char *env = getenv("VCPROMPT_CEILING_DIRS");
+    char *dirs, *dir, *save;
+    int n = 0, max = 1;
+
+    *ceilings = NULL;
+    if (env == NULL || *env == '\0')
+        return 0;
+    for (char *c = env; *c; c++) {
+        if (*c == ':')
+            max++;
+    }
+    *ceilings = malloc(max * sizeof(ceiling_t));
+    dirs = strdup(env);
+    if (*ceilings == NULL || dirs == NULL) {
+        free(dirs);
+        return 0;
+    }
+    for (dir = strtok_r(dirs, ":", &save); dir != NULL;
+         dir = strtok_r(NULL, ":", &save)) {
+        struct stat st;
+        if (stat(dir, &st) < 0) {
+            debug("ignoring ceiling dir %s: %s", dir, strerror(errno));
+            continue;
         }
+        (*ceilings)[n].dev = st.st_dev;
+        (*ceilings)[n].ino = st.st_ino;
+        n++;
     }
+    free(dirs);
+    return n;
+}
+
+static int
+is_ceiling(const ceiling_t *ceilings, int nceilings, const struct stat *st)
+{
+    for (int i = 0; i < nceilings; i++) {
+        if (ceilings[i].dev == st->st_dev && ceilings[i].ino == st->st_ino)
+            return 1;
+    }
+    return 0;
+}
+
+/* Look for the markers of each context in the directory open on
+ * dirfd, with one fstatat() per marker (never reading the directory,
+ * which may be huge), and return a bitmask of the contexts that have
+ * one there.  A marker that cannot be checked for some other reason
+ * than its absence (e.g. EACCES) counts as present: the probe will
+ * have to look for itself.
+ */
+static unsigned int
+find_markers(vccontext_t **contexts, int num_contexts, int dirfd)
+{
+    unsigned int found = 0;
+    struct stat st;
+
+    for (int idx = 0; idx < num_contexts; idx++) {
+        for (const char *const *m = contexts[idx]->markers; *m; m++) {
+            if (fstatat(dirfd, *m, &st, AT_SYMLINK_NOFOLLOW) == 0 ||
+                (errno != ENOENT && errno != ENOTDIR)) {
+                found |= 1U << idx;
+                break;
+            }
+        }
+    }
+    return found;
 }
 
 vccontext_t*
-probe_all(vccontext_t** contexts, int num_contexts)
+probe_all(vccontext_t** contexts, int num_contexts, int dirfd)
 {
+    unsigned int candidates = find_markers(contexts, num_contexts, dirfd);
     int idx;
     for (idx = 0; idx < num_contexts; idx++) {
         vccontext_t *ctx = contexts[idx];
-        if (ctx->probe(ctx)) {
+        if ((candidates & (1U << idx)) && ctx->probe(ctx, dirfd)) {
             return ctx;
         }
     }
     return NULL;
 }
 
-/* walk up the directory tree until the probes work or we hit / */
 vccontext_t*
-probe_dirs(vccontext_t** contexts, int num_contexts)
+probe_dirs(vccontext_t** contexts, int num_contexts, const char *start)
 {
     char *start_dir = malloc(PATH_MAX);
-    if (getcwd(start_dir, PATH_MAX) == NULL) {
+    if (start == NULL && getcwd(start_dir, PATH_MAX) == NULL) {
         debug("getcwd() failed: %s", strerror(errno));
         free(start_dir);
         return NULL;
     }
-    char *rel_path = start_dir + strlen(start_dir);
+    if (start != NULL && realpath(start, start_dir) == NULL) {
+        debug("%s: %s", start, strerror(errno));
+        free(start_dir);
+        return NULL;
+    }
+
+    vccontext_t *context = NULL;
+    int fd = open(start ? start_dir : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        debug("unable to open %s: %s", start_dir, strerror(errno));
+    else
+        context = probe_dir_at(contexts, num_contexts, fd, start_dir);
+    free(start_dir);
+    return context;
+}
 
+/* Walk up the directory tree until the probes work, using one
+ * directory fd per level rather than chdir().  Stop at the root, at a
+ * filesystem boundary, or before entering a ceiling dir.  On success,
+ * hand the fd of the dir that was claimed to the context, which is
+ * where get_info() will look.
+ */
+vccontext_t*
+probe_dir_at(vccontext_t** contexts, int num_contexts,
+             int fd, const char *start_dir)
+{
+    const char *rel_path = start_dir + strlen(start_dir);
+
+    ceiling_t *ceilings;
+    int nceilings = load_ceilings(&ceilings);
     vccontext_t *context = NULL;
+    struct stat st, parent_st;
+    if (fstat(fd, &st) < 0) {
+        debug("unable to stat %s: %s", start_dir, strerror(errno));
+        goto done;
+    }
+    dev_t start_dev = st.st_dev;
+
     while (1) {
-        context = probe_all(contexts, num_contexts);
+        context = probe_all(contexts, num_contexts, fd);
         if (context != NULL) {
             break;
         }
-        if (rel_path == start_dir + 1) {
+
+        int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (parent < 0 || fstat(parent, &parent_st) < 0) {
+            debug("unable to open parent dir: %s", strerror(errno));
+            if (parent >= 0)
+                close(parent);
+            break;
+        }
+        if (parent_st.st_dev == st.st_dev && parent_st.st_ino == st.st_ino) {
             debug("reached the root: %s not under version control", start_dir);
+            close(parent);
             break;
         }
-
-        debug("no context claimed current dir: walking up the tree");
-        if (-1 == chdir("..")) {
-            debug("chdir(\"..\") failed: %s", strerror(errno));
+        if (parent_st.st_dev != start_dev) {
+            debug("reached a filesystem boundary: %s not under version control",
+                  start_dir);
+            close(parent);
+            break;
+        }
+        if (is_ceiling(ceilings, nceilings, &parent_st)) {
+            debug("reached a ceiling dir: %s not under version control",
+                  start_dir);
+            close(parent);
             break;
         }
+
+        debug("no context claimed current dir: walking up the tree");
+        close(fd);
+        fd = parent;
+        st = parent_st;
         do {
             rel_path--;
         } while (rel_path > start_dir && rel_path[-1] != '/');
     }
     if (context != NULL) {
+        /* top is start_dir up to rel_path, minus the slash in between
+           (unless top is the root) */
+        size_t toplen = rel_path - start_dir;
+        if (*rel_path != '\0' && toplen > 1)
+            toplen--;
         debug("found a context: %s (rel_path=%s)", context->name, rel_path);
+        free(context->rel_path);
+        free(context->top);
         context->rel_path = strdup(rel_path);
+        context->top = strndup(start_dir, toplen);
+        if (context->dirfd >= 0)
+            close(context->dirfd);
+        context->dirfd = fd;
+        fd = -1;
     }
-    free(start_dir);
+
+ done:
+    if (fd >= 0)
+        close(fd);
+    free(ceilings);
     return context;
 }
 
-/* The signal handler just clears the flag and re-enables itself.  */
-void
-exit_on_alarm(int sig)
+result_t*
+get_result(vccontext_t *context, cache_key_t *key)
 {
-    printf("[timeout]");
-    exit(1);
-}
+    options_t *options = context->options;
+    result_t *result = NULL;
 
-unsigned int
-set_alarm(unsigned int milliseconds)
-{
-    struct itimerval old, new;
-    new.it_interval.tv_usec = 0;
-    new.it_interval.tv_sec = 0;
-    new.it_value.tv_usec = 1000 * (long int) milliseconds;
-    new.it_value.tv_sec =  0;
-    if (setitimer(ITIMER_REAL, &new, &old) < 0)
-        return 0;
-    else
-        return old.it_value.tv_sec;
+    /* Even without -c, the slow fields are worth sharing with any
+       other vcprompt working on the same thing right now. */
+    int use_cache = options->cache_ttl > 0 || options->stale_ok;
+    int slow = options->show_unknown || options->show_modified;
+    if (!(use_cache || slow) || !cache_make_key(key, context))
+        return context->get_info(context);
+    if (use_cache)
+        result = cache_lookup(key, options->cache_ttl, options->stale_ok);
+    if (result == NULL)
+        result = cache_get_info(context, key, 1);
+    return result;
 }
 
-int
-main(int argc, char** argv)
+void
+init_contexts(options_t *options, vccontext_t *contexts[NUM_CONTEXTS])
 {
-    int status = 0;
-
-    /* Establish a handler for SIGALRM signals.  */
-    signal(SIGALRM, exit_on_alarm);
-
-    char *format = getenv("VCPROMPT_FORMAT");
-    if (format == NULL)
-        format = DEFAULT_FORMAT;
-    options_t options = {
-        .debug         = 0,
-        .format        = format,
-        .show_branch   = 0,
-        .show_revision = 0,
-        .show_unknown  = 0,
-        .show_modified = 0,
-        .show_features = 0,
-    };
-
-    parse_args(argc, argv, &options);
-    if (options.show_features) {
-        show_features();
-        return 0;
-    }
-
-    parse_format(&options);
-    set_options(&options);
-
-    if (options.timeout) {
-        debug("will timeout after %d ms", options.timeout);
-        set_alarm(options.timeout);
-    } else {
-        debug("will never timeout");
-    }
-
-    vccontext_t *contexts[] = {
-        /* ordered by popularity, so the common case is fast */
-        get_git_context(&options),
-        get_hg_context(&options),
-        get_svn_context(&options),
-        get_cvs_context(&options),
-        get_fossil_context(&options),
-    };
-    int num_contexts = sizeof(contexts) / sizeof(vccontext_t*);
-
-    result_t *result = NULL;
-    vccontext_t *context = NULL;
-
-    /* Starting in the current dir, walk up the directory tree until
-       someone claims that this is a working copy. */
-    context = probe_dirs(contexts, num_contexts);
-
-    /* Nobody claimed it: bail now without printing anything. */
-    if (context == NULL) {
-        goto done;
-    }
-
-    /* Analyze the working copy metadata and print the result. */
-    result = context->get_info(context);
-    if (result != NULL) {
-        print_result(context, &options, result);
-        free_result(result);
-        if (options.debug)
-            putc('\n', stdout);
-    }
-
- done:
-    for (int i = 0; i < num_contexts; i++) {
-        free_context(contexts[i]);
-    }
-    return status;
+    /* ordered by popularity, so the common case is fast */
+    contexts[0] = get_git_context(options);
+    contexts[1] = get_hg_context(options);
+    contexts[2] = get_svn_context(options);
+    contexts[3] = get_cvs_context(options);
+    contexts[4] = get_fossil_context(options);
 }
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026, Gregory P. Ward and contributors.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef VCPROMPT_MAIN_H
+#define VCPROMPT_MAIN_H
+
+#include <stdio.h>
+
+#include "cache.h"
+#include "common.h"
+
+#define DEFAULT_FORMAT "[%n:%b] "
+
+/* number of supported VC systems, i.e. contexts */
+#define NUM_CONTEXTS 5
+
+/* Create one context for every supported VC system, all sharing
+ * options.  Free them with free_context().
+ */
+void
+init_contexts(options_t *options, vccontext_t *contexts[NUM_CONTEXTS]);
+
+/* Set the show_* fields of options from options->format.  Return 0
+ * (after complaining on stderr) if it has an invalid % sequence.
+ */
+int
+parse_format(options_t *options);
+
+/* Starting in dir start (NULL: the current dir), walk up the directory
+ * tree until one of contexts claims a working copy.  Return that
+ * context, with its top and dirfd set to the top of the working copy,
+ * or NULL.
+ */
+vccontext_t*
+probe_dirs(vccontext_t** contexts, int num_contexts, const char *start);
+
+/* Like probe_dirs(), but start in the dir open on fd, whose absolute
+ * path (with no symlinks) is start_dir.  Takes over fd: it is either
+ * closed or handed to the context that is returned.
+ */
+vccontext_t*
+probe_dir_at(vccontext_t** contexts, int num_contexts,
+             int fd, const char *start_dir);
+
+/* Get the result for the working copy that context claimed: from the
+ * cache if the options allow it, else from get_info() (via the cache,
+ * so that concurrent vcprompts share the work).  key is filled in if
+ * the cache was involved, i.e. if result->stale might be set.
+ */
+result_t*
+get_result(vccontext_t *context, cache_key_t *key);
+
+/* Expand options->format with the info in result, writing to out. */
+void
+print_result(FILE *out, vccontext_t *context, options_t *options,
+             result_t *result);
+
+#endif
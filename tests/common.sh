@@ -115,6 +115,39 @@ assert_vcprompt()
     fi
 }
 
+# Assert that vcprompt does not need to spawn any child process to
+# expand format.
+assert_no_child()
+{
+    message=$1
+    format=$2
+
+    if $vcprompt -d -f "$format" | grep -q "spawning child process"; then
+        echo "fail: $message: spawned a child process" >&2
+        failed="y"
+        return 1
+    else
+        echo "pass: $message: no child process"
+    fi
+}
+
+# Check that the debug output of vcprompt contains pattern (a grep
+# regex), i.e. that it took the expected code path.
+assert_debug()
+{
+    message=$1
+    pattern=$2
+    format=$3
+
+    if $vcprompt -d -f "$format" 2>&1 | grep -q -e "$pattern"; then
+        echo "pass: $message: debug output matches '$pattern'"
+    else
+        echo "fail: $message: debug output does not match '$pattern'" >&2
+        failed="y"
+        return 1
+    fi
+}
+
 report()
 {
     if [ "$failed" ]; then